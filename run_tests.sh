@@ -8,18 +8,41 @@ PASS=0
 FAIL=0
 FAILED_TESTS=""
 
+# run_test FILE [FLAGS...]: the flags go to "glipt run" too
 run_test() {
     local file="$1"
+    shift
     local name
     name=$(basename "$file")
-    printf "  %-30s " "$name"
-    if output=$($GLIPT run --allow-all "$file" 2>&1); then
+    [ $# -gt 0 ] && name="$name $*"
+    printf "  %-40s " "$name"
+    if output=$($GLIPT run --allow-all "$@" "$file" 2>&1); then
         echo "PASS"
         PASS=$((PASS + 1))
     else
         echo "FAIL"
         FAIL=$((FAIL + 1))
-        FAILED_TESTS="$FAILED_TESTS  $file\n"
+        FAILED_TESTS="$FAILED_TESTS  $file $*\n"
+        echo "    Output: $(echo "$output" | tail -3)"
+    fi
+}
+
+# run_same FILE FLAGS...: like run_test, and the output must also be what
+# the plain interpreter prints, so another engine is checked against it
+run_same() {
+    local file="$1"
+    shift
+    local expected
+    printf "  %-40s " "$(basename "$file") $*"
+    if expected=$($GLIPT run --allow-all "$file" 2>&1) &&
+       output=$($GLIPT run --allow-all "$@" "$file" 2>&1) &&
+       [ "$output" = "$expected" ]; then
+        echo "PASS"
+        PASS=$((PASS + 1))
+    else
+        echo "FAIL"
+        FAIL=$((FAIL + 1))
+        FAILED_TESTS="$FAILED_TESTS  $file $*\n"
         echo "    Output: $(echo "$output" | tail -3)"
     fi
 }
@@ -58,6 +81,41 @@ echo ""
 echo "Phase 3:"
 run_test examples/phase3_test.glipt
 
+# Runtime tests
+echo ""
+echo "Runtime:"
+run_test examples/quicken_test.glipt
+run_test examples/table_test.glipt
+run_test examples/property_ic_test.glipt
+run_test examples/gc_test.glipt --gc-max-heap=8M
+run_test examples/gc_test.glipt --gc-max-heap=8M --gc-pause-us=50
+run_test examples/gc_test.glipt --gc-max-heap=8M --gc-threads=4
+run_test examples/gc_test.glipt --gc-max-heap=8M --gc-compact
+run_test examples/tail_call_test.glipt
+run_test examples/intrinsic_test.glipt
+
+# The register VM (run --vm=register) on the runtime tests
+echo ""
+echo "Register VM:"
+run_same examples/full_test.glipt --vm=register
+run_same examples/quicken_test.glipt --vm=register
+run_same examples/table_test.glipt --vm=register
+run_same examples/property_ic_test.glipt --vm=register
+run_test examples/gc_test.glipt --gc-max-heap=8M --vm=register
+run_same examples/tail_call_test.glipt --vm=register
+run_same examples/intrinsic_test.glipt --vm=register
+
+# The template JIT (run --jit), on tests whose loops pass its threshold.
+# Elsewhere --jit only warns and interprets.
+if [ "$(uname -s)" = Linux ] && [ "$(uname -m)" = x86_64 ]; then
+    echo ""
+    echo "JIT:"
+    run_same examples/full_test.glipt --jit
+    run_same examples/quicken_test.glipt --jit
+    run_same examples/intrinsic_test.glipt --jit
+    run_same examples/tail_call_test.glipt --jit
+fi
+
 # Summary
 echo ""
 echo "---"
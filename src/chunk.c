@@ -7,6 +7,11 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->quickenMisses = NULL;
+    chunk->propertyICs = NULL;
+    chunk->propertyICCount = 0;
+    chunk->propertyICCapacity = 0;
+    chunk->threaded = NULL;
     initValueArray(&chunk->constants);
     initTable(&chunk->constantIndex);
 }
@@ -14,11 +19,40 @@ void initChunk(Chunk* chunk) {
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(uint8_t, chunk->quickenMisses, chunk->capacity);
+    FREE_ARRAY(PropertyICSlot, chunk->propertyICs, chunk->propertyICCapacity);
+    FREE_ARRAY(void*, chunk->threaded, chunk->count);
     freeValueArray(&chunk->constants);
     freeTable(&chunk->constantIndex);
     initChunk(chunk);
 }
 
+void initRegChunk(RegChunk* chunk) {
+    chunk->count = 0;
+    chunk->capacity = 0;
+    chunk->code = NULL;
+    chunk->lines = NULL;
+    chunk->maxRegisters = 0;
+}
+
+void freeRegChunk(RegChunk* chunk) {
+    FREE_ARRAY(uint32_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    initRegChunk(chunk);
+}
+
+void writeRegChunk(RegChunk* chunk, uint32_t instruction, int line) {
+    if (chunk->capacity < chunk->count + 1) {
+        int oldCapacity = chunk->capacity;
+        chunk->capacity = GROW_CAPACITY(oldCapacity);
+        chunk->code = GROW_ARRAY(uint32_t, chunk->code, oldCapacity, chunk->capacity);
+        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    }
+    chunk->code[chunk->count] = instruction;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
+}
+
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
@@ -36,12 +70,12 @@ int addConstant(Chunk* chunk, Value value) {
     // O(1) dedup for string constants via hash table
     if (IS_OBJ(value) && IS_STRING(value)) {
         Value existing;
-        if (tableGet(&chunk->constantIndex, AS_STRING(value), &existing)) {
+        if (tableGet(&chunk->constantIndex, value, &existing)) {
             return (int)AS_NUMBER(existing);
         }
         writeValueArray(&chunk->constants, value);
         int index = chunk->constants.count - 1;
-        tableSet(&chunk->constantIndex, AS_STRING(value), NUMBER_VAL(index));
+        tableSet(&chunk->constantIndex, value, NUMBER_VAL(index));
         return index;
     }
 
@@ -52,3 +86,109 @@ int addConstant(Chunk* chunk, Value value) {
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
 }
+
+// Reserve an inline cache slot for a property access site. The operand is one
+// byte, so sites past the 255th get PROPERTY_IC_NONE (a shared slot would let
+// sites with different names read each other's cached index).
+int addPropertyIC(Chunk* chunk) {
+    if (chunk->propertyICCount == PROPERTY_IC_NONE) return PROPERTY_IC_NONE;
+    if (chunk->propertyICCapacity < chunk->propertyICCount + 1) {
+        int oldCapacity = chunk->propertyICCapacity;
+        chunk->propertyICCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->propertyICs = GROW_ARRAY(PropertyICSlot, chunk->propertyICs,
+            oldCapacity, chunk->propertyICCapacity);
+    }
+    PropertyICSlot* ic = &chunk->propertyICs[chunk->propertyICCount];
+    ic->shape = NULL;
+    ic->tableCapacity = -1;
+    ic->index = 0;
+    return chunk->propertyICCount++;
+}
+
+// Size in bytes of the instruction at offset, including its operands.
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_NEGATE:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_NOT:
+        case OP_RETURN:
+        case OP_CLOSE_UPVALUE:
+        case OP_INDEX_GET:
+        case OP_INDEX_SET:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_POP_HANDLER:
+        case OP_THROW:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_GREATER_NUM:
+        case OP_GREATER_EQUAL_NUM:
+        case OP_LESS_NUM:
+        case OP_LESS_EQUAL_NUM:
+            return 1;
+
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_BUILD_LIST:
+        case OP_BUILD_MAP:
+        case OP_SET_LOCAL_POP:
+        case OP_RANGE:
+            return 2;
+
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_PUSH_HANDLER:
+        case OP_ALLOW:
+        case OP_IMPORT:
+        case OP_INC_LOCAL:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_LESS_JUMP:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL_POP:
+        case OP_LEN:
+        case OP_TYPE:
+        case OP_STR:
+        case OP_APPEND:
+        case OP_CONTAINS:
+            return 3;
+
+        case OP_LESS_CONST_JUMP:
+        case OP_FOR_ITER:
+        case OP_INC_GLOBAL:
+            return 4;
+
+        case OP_LESS_LOCALS_JUMP:
+            return 5;
+
+        case OP_CLOSURE: {
+            ObjFunction* function =
+                AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 2;
+        }
+    }
+    return 1;
+}
@@ -4,8 +4,23 @@
 #include "common.h"
 #include "value.h"
 #include "opcode.h"
+#include "regcode.h"
 #include "table.h"
 
+// Inline cache for one GET_PROPERTY/SET_PROPERTY site. For shape-mode maps
+// it remembers the shape and the value slot; for dictionary-mode maps, the
+// entry index, valid while the table has the same capacity and still holds
+// the name in that entry.
+typedef struct {
+    struct Shape* shape;
+    int tableCapacity;
+    int index;
+} PropertyICSlot;
+
+// IC operand of the sites past the first PROPERTY_IC_NONE of a chunk: they
+// have no slot and look the property up every time
+#define PROPERTY_IC_NONE UINT8_MAX
+
 typedef struct {
     int count;
     int capacity;
@@ -13,11 +28,21 @@ typedef struct {
     int* lines;         // source line for each byte
     ValueArray constants;
     Table constantIndex; // string constant dedup (ObjString* -> index)
+    uint8_t* quickenMisses; // per-byte de-quicken count, allocated on first miss
+    PropertyICSlot* propertyICs; // indexed by the property instruction's IC operand
+    int propertyICCount;
+    int propertyICCapacity;
+    void** threaded;    // THREADED_CODE builds: handler address per byte, built on first run
 } Chunk;
 
+// A site that de-quickens this many times stays generic for good
+#define QUICKEN_MISS_LIMIT 4
+
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addPropertyIC(Chunk* chunk);
+int instructionLength(Chunk* chunk, int offset);
 
 #endif
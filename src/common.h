@@ -16,5 +16,7 @@
 // Uncomment or define via -D to enable debug features:
 // #define DEBUG_TRACE
 // #define DEBUG_STRESS_GC
+// #define DEBUG_IC_STATS     (print inline cache hit/miss counts at exit)
+// #define THREADED_CODE      (dispatch through pre-decoded handler addresses; make THREADED=1)
 
 #endif
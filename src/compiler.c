@@ -3,6 +3,7 @@
 #include "parser.h"
 #include "memory.h"
 #include "debug.h"
+#include "regcompiler.h"
 
 typedef enum {
     TYPE_SCRIPT,
@@ -41,12 +42,20 @@ typedef struct Compiler {
     int breakJumps[256];
     int breakCount;
 
+    // Open 'on failure' regions; a tail call would discard their handler frame
+    int handlerDepth;
+
     bool hadError;
 } Compiler;
 
+// Innermost compiler running, for markCompilerRoots
+static Compiler* current = NULL;
+
 static void initCompiler(Compiler* compiler, Compiler* enclosing,
                           FunctionType type, VM* vm) {
     compiler->enclosing = enclosing;
+    compiler->function = NULL;  // newFunction may collect: already a root
+    current = compiler;
     compiler->function = newFunction(vm);
     compiler->type = type;
     compiler->localCount = 0;
@@ -55,6 +64,7 @@ static void initCompiler(Compiler* compiler, Compiler* enclosing,
     compiler->loopStart = -1;
     compiler->loopDepth = 0;
     compiler->breakCount = 0;
+    compiler->handlerDepth = 0;
     compiler->hadError = false;
 
     // Slot 0 is reserved for the function/closure itself
@@ -112,7 +122,11 @@ static void emitLoop(Compiler* compiler, int loopStart, int line) {
 }
 
 static uint8_t makeConstant(Compiler* compiler, Value value) {
+    // Protect from GC while the constant table grows
+    vmPush(compiler->vm, value);
     int constant = addConstant(currentChunk(compiler), value);
+    WRITE_BARRIER(compiler->function, value);
+    vmPop(compiler->vm);
     if (constant > UINT8_MAX) {
         fprintf(stderr, "Too many constants in one chunk.\n");
         compiler->hadError = true;
@@ -130,6 +144,230 @@ static void emitReturn(Compiler* compiler, int line) {
     emitByte(compiler, OP_RETURN, line);
 }
 
+// ---- Peephole Optimizer ----
+//
+// Runs once on each finished chunk. Hot multi-instruction sequences are
+// rewritten into superinstructions, then the code is compacted and every jump
+// is re-targeted. A sequence is only fused when no jump lands inside it.
+
+typedef struct {
+    int count;          // instructions consumed
+    uint8_t op;         // fused opcode
+    uint8_t operands[3];
+    int operandCount;   // byte operands before the (optional) jump offset
+    int jumpTarget;     // original target offset, or -1 if not a branch
+} Fusion;
+
+// If the JUMP_IF_FALSE at 'offset' lands on a POP, return the offset just past
+// that POP (where a popping branch should land), otherwise -1.
+static int popJumpTarget(Chunk* chunk, int offset) {
+    int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    int target = offset + 3 + jump;
+    if (target >= chunk->count || chunk->code[target] != OP_POP) return -1;
+    return target + 1;
+}
+
+// Position of the 2-byte jump operand within a branch instruction, or 0 if
+// the instruction does not branch.
+static int branchOperand(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_PUSH_HANDLER:
+            return 1;
+        case OP_FOR_ITER:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static bool matchFusion(Chunk* chunk, int* starts, int index, int count,
+                        bool* isTarget, Fusion* out) {
+    uint8_t* code = chunk->code;
+    int remaining = count - index;
+
+#define OP_AT(k)   (code[starts[index + (k)]])
+#define ARG_AT(k)  (code[starts[index + (k)] + 1])
+#define AT(k)      (starts[index + (k)])
+#define SLOT_AT(k) ((code[starts[index + (k)] + 1] << 8) | code[starts[index + (k)] + 2])
+
+    // No jump may land on any instruction after the first in the sequence
+    int clear = 1;
+    while (clear < remaining && clear < 5 && !isTarget[AT(clear)]) clear++;
+
+    // local = local + number
+    if (clear >= 5 && OP_AT(0) == OP_GET_LOCAL && OP_AT(1) == OP_CONSTANT &&
+        OP_AT(2) == OP_ADD && OP_AT(3) == OP_SET_LOCAL && OP_AT(4) == OP_POP &&
+        ARG_AT(0) == ARG_AT(3) && IS_NUMBER(chunk->constants.values[ARG_AT(1)])) {
+        *out = (Fusion){5, OP_INC_LOCAL, {ARG_AT(0), ARG_AT(1)}, 2, -1};
+        return true;
+    }
+
+    // global = global + number
+    if (clear >= 5 && OP_AT(0) == OP_GET_GLOBAL && OP_AT(1) == OP_CONSTANT &&
+        OP_AT(2) == OP_ADD && OP_AT(3) == OP_SET_GLOBAL && OP_AT(4) == OP_POP &&
+        SLOT_AT(0) == SLOT_AT(3) && IS_NUMBER(chunk->constants.values[ARG_AT(1)])) {
+        *out = (Fusion){5, OP_INC_GLOBAL,
+                        {code[AT(0) + 1], code[AT(0) + 2], ARG_AT(1)}, 3, -1};
+        return true;
+    }
+
+    // if/while (localA < localB)
+    if (clear >= 5 && OP_AT(0) == OP_GET_LOCAL && OP_AT(1) == OP_GET_LOCAL &&
+        OP_AT(2) == OP_LESS && OP_AT(3) == OP_JUMP_IF_FALSE && OP_AT(4) == OP_POP) {
+        int target = popJumpTarget(chunk, AT(3));
+        if (target != -1) {
+            *out = (Fusion){5, OP_LESS_LOCALS_JUMP, {ARG_AT(0), ARG_AT(1)}, 2, target};
+            return true;
+        }
+    }
+
+    // if/while (x < constant)
+    if (clear >= 4 && OP_AT(0) == OP_CONSTANT && OP_AT(1) == OP_LESS &&
+        OP_AT(2) == OP_JUMP_IF_FALSE && OP_AT(3) == OP_POP) {
+        int target = popJumpTarget(chunk, AT(2));
+        if (target != -1) {
+            *out = (Fusion){4, OP_LESS_CONST_JUMP, {ARG_AT(0), 0}, 1, target};
+            return true;
+        }
+    }
+
+    // if/while (a < b)
+    if (clear >= 3 && OP_AT(0) == OP_LESS && OP_AT(1) == OP_JUMP_IF_FALSE &&
+        OP_AT(2) == OP_POP) {
+        int target = popJumpTarget(chunk, AT(1));
+        if (target != -1) {
+            *out = (Fusion){3, OP_LESS_JUMP, {0, 0}, 0, target};
+            return true;
+        }
+    }
+
+    // if/while (cond)
+    if (clear >= 2 && OP_AT(0) == OP_JUMP_IF_FALSE && OP_AT(1) == OP_POP) {
+        int target = popJumpTarget(chunk, AT(0));
+        if (target != -1) {
+            *out = (Fusion){2, OP_POP_JUMP_IF_FALSE, {0, 0}, 0, target};
+            return true;
+        }
+    }
+
+    // Assignment statements
+    if (clear >= 2 && OP_AT(0) == OP_SET_LOCAL && OP_AT(1) == OP_POP) {
+        *out = (Fusion){2, OP_SET_LOCAL_POP, {ARG_AT(0), 0}, 1, -1};
+        return true;
+    }
+    if (clear >= 2 && OP_AT(0) == OP_SET_GLOBAL && OP_AT(1) == OP_POP) {
+        *out = (Fusion){2, OP_SET_GLOBAL_POP, {code[AT(0) + 1], code[AT(0) + 2]}, 2, -1};
+        return true;
+    }
+
+#undef OP_AT
+#undef ARG_AT
+#undef AT
+#undef SLOT_AT
+    return false;
+}
+
+typedef struct {
+    int operand;    // offset of the 2-byte jump operand in the new code
+    int target;     // original target offset
+    bool backward;
+} JumpFixup;
+
+static void optimizeChunk(Chunk* chunk) {
+    int size = chunk->count;
+    if (size == 0) return;
+
+    int* starts = (int*)malloc(sizeof(int) * size);
+    bool* isTarget = (bool*)calloc(size + 1, sizeof(bool));
+    int* newOffset = (int*)malloc(sizeof(int) * (size + 1));
+    uint8_t* code = (uint8_t*)malloc(size);
+    int* lines = (int*)malloc(sizeof(int) * size);
+    JumpFixup* fixups = (JumpFixup*)malloc(sizeof(JumpFixup) * size);
+    if (!starts || !isTarget || !newOffset || !code || !lines || !fixups) {
+        free(starts); free(isTarget); free(newOffset);
+        free(code); free(lines); free(fixups);
+        return;
+    }
+
+    // Pass 1: find instruction boundaries and every jump target
+    int count = 0;
+    for (int offset = 0; offset < size; offset += instructionLength(chunk, offset)) {
+        starts[count++] = offset;
+        uint8_t op = chunk->code[offset];
+        int operand = branchOperand(op);
+        if (operand != 0) {
+            int end = offset + operand + 2;
+            int jump = (chunk->code[offset + operand] << 8) | chunk->code[offset + operand + 1];
+            int target = op == OP_LOOP ? end - jump : end + jump;
+            isTarget[target] = true;
+            // A fused branch may land just past the POP at its target
+            if (op == OP_JUMP_IF_FALSE && target < size &&
+                chunk->code[target] == OP_POP) {
+                isTarget[target + 1] = true;
+            }
+        }
+    }
+
+    // Pass 2: emit fused or copied instructions into the new buffer
+    int out = 0;
+    int fixupCount = 0;
+    for (int i = 0; i < count; i++) {
+        int offset = starts[i];
+        int line = chunk->lines[offset];
+        newOffset[offset] = out;
+
+        Fusion fusion;
+        if (matchFusion(chunk, starts, i, count, isTarget, &fusion)) {
+            int begin = out;
+            code[out++] = fusion.op;
+            for (int j = 0; j < fusion.operandCount; j++) {
+                code[out++] = fusion.operands[j];
+            }
+            if (fusion.jumpTarget != -1) {
+                fixups[fixupCount++] = (JumpFixup){out, fusion.jumpTarget, false};
+                out += 2;
+            }
+            for (int j = begin; j < out; j++) lines[j] = line;
+            for (int j = 1; j < fusion.count; j++) newOffset[starts[i + j]] = begin;
+            i += fusion.count - 1;
+            continue;
+        }
+
+        int length = instructionLength(chunk, offset);
+        uint8_t op = chunk->code[offset];
+        int operand = branchOperand(op);
+        if (operand != 0) {
+            int end = offset + operand + 2;
+            int jump = (chunk->code[offset + operand] << 8) | chunk->code[offset + operand + 1];
+            int target = op == OP_LOOP ? end - jump : end + jump;
+            fixups[fixupCount++] = (JumpFixup){out + operand, target, op == OP_LOOP};
+        }
+        memcpy(code + out, chunk->code + offset, length);
+        for (int j = 0; j < length; j++) lines[out + j] = line;
+        out += length;
+    }
+    newOffset[size] = out;
+
+    // Pass 3: re-target jumps against the compacted layout
+    for (int i = 0; i < fixupCount; i++) {
+        int from = fixups[i].operand + 2;
+        int to = newOffset[fixups[i].target];
+        int jump = fixups[i].backward ? from - to : to - from;
+        code[fixups[i].operand] = (jump >> 8) & 0xff;
+        code[fixups[i].operand + 1] = jump & 0xff;
+    }
+
+    memcpy(chunk->code, code, out);
+    memcpy(chunk->lines, lines, sizeof(int) * out);
+    chunk->count = out;
+
+    free(starts); free(isTarget); free(newOffset);
+    free(code); free(lines); free(fixups);
+}
+
 // ---- Scope Management ----
 
 static void beginScope(Compiler* compiler) {
@@ -218,6 +456,22 @@ static uint8_t identifierConstant(Compiler* compiler, const char* name, int leng
         OBJ_VAL(copyString(compiler->vm, name, length)));
 }
 
+// Globals are resolved to a fixed slot in the VM's global array at compile
+// time; the slot is emitted as a 2-byte operand.
+static void emitGlobalOp(Compiler* compiler, uint8_t op,
+                         const char* name, int length, int line) {
+    ObjString* string = copyString(compiler->vm, name, length);
+    int slot = vmGlobalSlot(compiler->vm, string);
+    if (slot > UINT16_MAX) {
+        fprintf(stderr, "[line %d] Error: Too many global variables.\n", line);
+        compiler->hadError = true;
+        slot = 0;
+    }
+    emitByte(compiler, op, line);
+    emitByte(compiler, (uint8_t)((slot >> 8) & 0xff), line);
+    emitByte(compiler, (uint8_t)(slot & 0xff), line);
+}
+
 // ---- Compile AST Nodes ----
 
 static void compileNode(Compiler* compiler, AstNode* node);
@@ -233,7 +487,7 @@ static void compileLiteral(Compiler* compiler, AstNode* node) {
 
     switch (lit->type) {
         case LIT_NUMBER:
-            emitConstant(compiler, NUMBER_VAL(lit->as.number), line);
+            emitConstant(compiler, numberValue(lit->as.number), line);
             break;
         case LIT_STRING: {
             ObjString* str = copyString(compiler->vm,
@@ -278,12 +532,8 @@ static void compileVariable(Compiler* compiler, AstNode* node, bool forGet) {
                 emitBytes(compiler, OP_SET_UPVALUE, (uint8_t)upvalue, line);
             }
         } else {
-            uint8_t arg = identifierConstant(compiler, name, length);
-            if (forGet) {
-                emitBytes(compiler, OP_GET_GLOBAL, arg, line);
-            } else {
-                emitBytes(compiler, OP_SET_GLOBAL, arg, line);
-            }
+            emitGlobalOp(compiler, forGet ? OP_GET_GLOBAL : OP_SET_GLOBAL,
+                         name, length, line);
         }
     }
 }
@@ -345,8 +595,58 @@ static void compileBinary(Compiler* compiler, AstNode* node) {
     }
 }
 
-static void compileCall(Compiler* compiler, AstNode* node) {
+// Built-ins called often enough to get their own opcode. The opcode carries
+// the global slot of the name so the VM can check it still holds the native
+// from initVM and fall back to an ordinary call if the script rebound it.
+typedef struct {
+    const char* name;
+    int length;
+    int arity;
+    OpCode op;
+} Intrinsic;
+
+static const Intrinsic intrinsics[] = {
+    {"len",      3, 1, OP_LEN},
+    {"type",     4, 1, OP_TYPE},
+    {"str",      3, 1, OP_STR},
+    {"append",   6, 2, OP_APPEND},
+    {"contains", 8, 2, OP_CONTAINS},
+};
+
+static const Intrinsic* findIntrinsic(Compiler* compiler, AstNode* node) {
+    AstNode* callee = node->as.call.callee;
+    if (callee->type != NODE_VARIABLE) return NULL;
+    const char* name = callee->as.variable.name;
+    int length = callee->as.variable.length;
+
+    for (size_t i = 0; i < sizeof(intrinsics) / sizeof(intrinsics[0]); i++) {
+        const Intrinsic* intrinsic = &intrinsics[i];
+        if (intrinsic->length != length || intrinsic->arity != node->as.call.argCount ||
+            memcmp(intrinsic->name, name, length) != 0) {
+            continue;
+        }
+        // A local or captured variable shadows the built-in
+        if (resolveLocal(compiler, name, length) != -1 ||
+            resolveUpvalue(compiler, name, length) != -1) {
+            return NULL;
+        }
+        return intrinsic;
+    }
+    return NULL;
+}
+
+static void compileCallOp(Compiler* compiler, AstNode* node, OpCode op) {
     int line = node->line;
+
+    const Intrinsic* intrinsic = findIntrinsic(compiler, node);
+    if (intrinsic != NULL) {
+        for (int i = 0; i < node->as.call.argCount; i++) {
+            compileExpression(compiler, node->as.call.args[i]);
+        }
+        emitGlobalOp(compiler, intrinsic->op, intrinsic->name, intrinsic->length, line);
+        return;
+    }
+
     compileExpression(compiler, node->as.call.callee);
 
     int argCount = node->as.call.argCount;
@@ -360,7 +660,11 @@ static void compileCall(Compiler* compiler, AstNode* node) {
         compileExpression(compiler, node->as.call.args[i]);
     }
 
-    emitBytes(compiler, OP_CALL, (uint8_t)argCount, line);
+    emitBytes(compiler, op, (uint8_t)argCount, line);
+}
+
+static void compileCall(Compiler* compiler, AstNode* node) {
+    compileCallOp(compiler, node, OP_CALL);
 }
 
 static void compileList(Compiler* compiler, AstNode* node) {
@@ -409,12 +713,17 @@ static void compileIndexSet(Compiler* compiler, AstNode* node) {
     emitByte(compiler, OP_INDEX_SET, line);
 }
 
+static void emitPropertyOp(Compiler* compiler, uint8_t op, uint8_t name, int line) {
+    emitBytes(compiler, op, name, line);
+    emitByte(compiler, (uint8_t)addPropertyIC(currentChunk(compiler)), line);
+}
+
 static void compileDot(Compiler* compiler, AstNode* node) {
     int line = node->line;
     compileExpression(compiler, node->as.dot.object);
     uint8_t name = identifierConstant(compiler,
         node->as.dot.name, node->as.dot.nameLength);
-    emitBytes(compiler, OP_GET_PROPERTY, name, line);
+    emitPropertyOp(compiler, OP_GET_PROPERTY, name, line);
 }
 
 static void compileDotSet(Compiler* compiler, AstNode* node) {
@@ -423,7 +732,7 @@ static void compileDotSet(Compiler* compiler, AstNode* node) {
     compileExpression(compiler, node->as.dotSet.value);
     uint8_t name = identifierConstant(compiler,
         node->as.dotSet.name, node->as.dotSet.nameLength);
-    emitBytes(compiler, OP_SET_PROPERTY, name, line);
+    emitPropertyOp(compiler, OP_SET_PROPERTY, name, line);
 }
 
 // Forward declaration needed because compileStatements calls compileNode,
@@ -438,6 +747,7 @@ static ObjFunction* compileFunction(Compiler* parent, AstNode* node,
     if (node->as.function.name != NULL) {
         compiler.function->name = copyString(parent->vm,
             node->as.function.name, node->as.function.nameLength);
+        WRITE_BARRIER(compiler.function, OBJ_VAL(compiler.function->name));
     }
 
     beginScope(&compiler);
@@ -458,6 +768,7 @@ static ObjFunction* compileFunction(Compiler* parent, AstNode* node,
     }
 
     emitReturn(&compiler, node->line); // implicit nil return
+    optimizeChunk(currentChunk(&compiler));
 
     ObjFunction* function = compiler.function;
 
@@ -478,6 +789,11 @@ static ObjFunction* compileFunction(Compiler* parent, AstNode* node,
         emitByte(parent, compiler.upvalues[i].index, node->line);
     }
 
+    if (parent->vm->registerMode) {
+        compileRegisterFunction(parent->vm, function, node);
+    }
+
+    current = parent;
     return function;
 }
 
@@ -491,9 +807,11 @@ static void compileStatements(Compiler* compiler, AstNode** stmts, int count) {
             int line = stmts[i]->line;
             int handlerJump = emitJump(compiler, OP_PUSH_HANDLER, line);
 
+            compiler->handlerDepth++;
             for (int j = i + 1; j < count; j++) {
                 compileNode(compiler, stmts[j]);
             }
+            compiler->handlerDepth--;
 
             emitByte(compiler, OP_POP_HANDLER, line);
             int endJump = emitJump(compiler, OP_JUMP, line);
@@ -588,73 +906,138 @@ static void compileWhile(Compiler* compiler, AstNode* node) {
     compiler->breakCount = prevBreakCount;
 }
 
-static void compileFor(Compiler* compiler, AstNode* node) {
-    int line = node->line;
-
-    // Save outer loop state so nested loops restore correctly
-    int prevLoopStart = compiler->loopStart;
-    int prevLoopDepth = compiler->loopDepth;
-    int prevBreakCount = compiler->breakCount;
+static void compileLoopBody(Compiler* compiler, AstNode* body, int line) {
+    if (body->type == NODE_BLOCK) {
+        beginScope(compiler);
+        for (int i = 0; i < body->as.block.count; i++) {
+            compileNode(compiler, body->as.block.statements[i]);
+        }
+        endScope(compiler, line);
+    } else {
+        compileNode(compiler, body);
+    }
+}
 
-    beginScope(compiler);
+static bool isRangeCall(AstNode* node) {
+    if (node->type != NODE_CALL) return false;
+    AstNode* callee = node->as.call.callee;
+    return callee->type == NODE_VARIABLE && callee->as.variable.length == 5 &&
+           memcmp(callee->as.variable.name, "range", 5) == 0;
+}
 
-    // Three hidden locals: iterable, index counter, loop variable
-    compileExpression(compiler, node->as.forStmt.iterable);
-    addLocal(compiler, " iterable", 9);
-    int iterSlot = compiler->localCount - 1;
+// for i in a..b: count a hidden index from a to b. Nothing is allocated and
+// the peephole pass turns the step and the test into INC_LOCAL and
+// LESS_LOCALS_JUMP. 'continue' lands on the increment.
+static void compileForRange(Compiler* compiler, AstNode* node) {
+    int line = node->line;
+    AstNode* range = node->as.forStmt.iterable;
 
-    emitConstant(compiler, NUMBER_VAL(0), line);
+    compileExpression(compiler, range->as.range.start);
     addLocal(compiler, " index", 6);
     int idxSlot = compiler->localCount - 1;
 
+    compileExpression(compiler, range->as.range.end);
+    addLocal(compiler, " end", 4);
+    int endSlot = compiler->localCount - 1;
+
     emitByte(compiler, OP_NIL, line);
     addLocal(compiler, node->as.forStmt.varName, node->as.forStmt.varNameLength);
     int varSlot = compiler->localCount - 1;
 
+    int skipStep = emitJump(compiler, OP_JUMP, line);
+
     int loopStart = currentChunk(compiler)->count;
     compiler->loopStart = loopStart;
     compiler->loopDepth = compiler->scopeDepth;
     compiler->breakCount = 0;
 
-    // Condition: index < iterable.length
+    // index++
     emitBytes(compiler, OP_GET_LOCAL, (uint8_t)idxSlot, line);
-    emitBytes(compiler, OP_GET_LOCAL, (uint8_t)iterSlot, line);
-    uint8_t lengthConst = identifierConstant(compiler, "length", 6);
-    emitBytes(compiler, OP_GET_PROPERTY, lengthConst, line);
-    emitByte(compiler, OP_LESS, line);
+    emitConstant(compiler, INT_VAL(1), line);
+    emitByte(compiler, OP_ADD, line);
+    emitBytes(compiler, OP_SET_LOCAL, (uint8_t)idxSlot, line);
+    emitByte(compiler, OP_POP, line);
+
+    patchJump(compiler, skipStep);
 
+    // Condition: index < end
+    emitBytes(compiler, OP_GET_LOCAL, (uint8_t)idxSlot, line);
+    emitBytes(compiler, OP_GET_LOCAL, (uint8_t)endSlot, line);
+    emitByte(compiler, OP_LESS, line);
     int exitJump = emitJump(compiler, OP_JUMP_IF_FALSE, line);
     emitByte(compiler, OP_POP, line);
 
-    // Set loop var = iterable[index]
-    emitBytes(compiler, OP_GET_LOCAL, (uint8_t)iterSlot, line);
+    // Loop variable is a copy, so assigning to it does not skip iterations
     emitBytes(compiler, OP_GET_LOCAL, (uint8_t)idxSlot, line);
-    emitByte(compiler, OP_INDEX_GET, line);
     emitBytes(compiler, OP_SET_LOCAL, (uint8_t)varSlot, line);
     emitByte(compiler, OP_POP, line);
 
-    if (node->as.forStmt.body->type == NODE_BLOCK) {
-        AstNode* body = node->as.forStmt.body;
-        beginScope(compiler);
-        for (int i = 0; i < body->as.block.count; i++) {
-            compileNode(compiler, body->as.block.statements[i]);
+    compileLoopBody(compiler, node->as.forStmt.body, line);
+    emitLoop(compiler, loopStart, line);
+
+    patchJump(compiler, exitJump);
+    emitByte(compiler, OP_POP, line);
+}
+
+// for x in <iterable>: OP_FOR_ITER keeps the iterable, a cursor and the loop
+// variable in three consecutive locals and advances them in one dispatch.
+static void compileForIter(Compiler* compiler, AstNode* node) {
+    int line = node->line;
+    AstNode* iterable = node->as.forStmt.iterable;
+
+    if (isRangeCall(iterable)) {
+        // range(...) as a loop source: iterate lazily instead of building a list
+        int argCount = iterable->as.call.argCount;
+        if (argCount > UINT8_MAX) argCount = UINT8_MAX;
+        compileExpression(compiler, iterable->as.call.callee);
+        for (int i = 0; i < argCount; i++) {
+            compileExpression(compiler, iterable->as.call.args[i]);
         }
-        endScope(compiler, line);
+        emitBytes(compiler, OP_RANGE, (uint8_t)argCount, line);
+        emitBytes(compiler, OP_CALL, (uint8_t)argCount, line);
     } else {
-        compileNode(compiler, node->as.forStmt.body);
+        compileExpression(compiler, iterable);
     }
+    addLocal(compiler, " iterable", 9);
+    int iterSlot = compiler->localCount - 1;
 
-    // index++
-    emitBytes(compiler, OP_GET_LOCAL, (uint8_t)idxSlot, line);
-    emitConstant(compiler, NUMBER_VAL(1), line);
-    emitByte(compiler, OP_ADD, line);
-    emitBytes(compiler, OP_SET_LOCAL, (uint8_t)idxSlot, line);
-    emitByte(compiler, OP_POP, line);
+    emitConstant(compiler, INT_VAL(0), line);
+    addLocal(compiler, " cursor", 7);
+
+    emitByte(compiler, OP_NIL, line);
+    addLocal(compiler, node->as.forStmt.varName, node->as.forStmt.varNameLength);
+
+    int loopStart = currentChunk(compiler)->count;
+    compiler->loopStart = loopStart;
+    compiler->loopDepth = compiler->scopeDepth;
+    compiler->breakCount = 0;
+
+    emitBytes(compiler, OP_FOR_ITER, (uint8_t)iterSlot, line);
+    emitByte(compiler, 0xff, line);
+    emitByte(compiler, 0xff, line);
+    int exitJump = currentChunk(compiler)->count - 2;
 
+    compileLoopBody(compiler, node->as.forStmt.body, line);
     emitLoop(compiler, loopStart, line);
 
     patchJump(compiler, exitJump);
-    emitByte(compiler, OP_POP, line);
+}
+
+static void compileFor(Compiler* compiler, AstNode* node) {
+    int line = node->line;
+
+    // Save outer loop state so nested loops restore correctly
+    int prevLoopStart = compiler->loopStart;
+    int prevLoopDepth = compiler->loopDepth;
+    int prevBreakCount = compiler->breakCount;
+
+    beginScope(compiler);
+
+    if (node->as.forStmt.iterable->type == NODE_RANGE) {
+        compileForRange(compiler, node);
+    } else {
+        compileForIter(compiler, node);
+    }
 
     for (int i = 0; i < compiler->breakCount; i++) {
         patchJump(compiler, compiler->breakJumps[i]);
@@ -694,13 +1077,11 @@ static void compileVarDecl(Compiler* compiler, AstNode* node) {
         if (compiler->enclosing != NULL) {
             addLocal(compiler, name, length);
         } else {
-            uint8_t global = identifierConstant(compiler, name, length);
-            emitBytes(compiler, OP_SET_GLOBAL, global, line);
+            emitGlobalOp(compiler, OP_SET_GLOBAL, name, length, line);
             emitByte(compiler, OP_POP, line);
         }
     } else {
-        uint8_t global = identifierConstant(compiler, name, length);
-        emitBytes(compiler, OP_DEFINE_GLOBAL, global, line);
+        emitGlobalOp(compiler, OP_DEFINE_GLOBAL, name, length, line);
     }
 }
 
@@ -716,9 +1097,8 @@ static void compileAssign(Compiler* compiler, AstNode* node) {
         if (upvalue != -1) {
             emitBytes(compiler, OP_SET_UPVALUE, (uint8_t)upvalue, line);
         } else {
-            uint8_t arg = identifierConstant(compiler,
-                node->as.assign.name, node->as.assign.length);
-            emitBytes(compiler, OP_SET_GLOBAL, arg, line);
+            emitGlobalOp(compiler, OP_SET_GLOBAL,
+                         node->as.assign.name, node->as.assign.length, line);
         }
     }
 }
@@ -736,8 +1116,7 @@ static void compileCompoundAssign(Compiler* compiler, AstNode* node) {
         if (upvalue != -1) {
             emitBytes(compiler, OP_GET_UPVALUE, (uint8_t)upvalue, line);
         } else {
-            uint8_t arg = identifierConstant(compiler, name, length);
-            emitBytes(compiler, OP_GET_GLOBAL, arg, line);
+            emitGlobalOp(compiler, OP_GET_GLOBAL, name, length, line);
         }
     }
 
@@ -758,8 +1137,7 @@ static void compileCompoundAssign(Compiler* compiler, AstNode* node) {
         if (upvalue != -1) {
             emitBytes(compiler, OP_SET_UPVALUE, (uint8_t)upvalue, line);
         } else {
-            uint8_t arg = identifierConstant(compiler, name, length);
-            emitBytes(compiler, OP_SET_GLOBAL, arg, line);
+            emitGlobalOp(compiler, OP_SET_GLOBAL, name, length, line);
         }
     }
 }
@@ -826,7 +1204,9 @@ static void compileNode(Compiler* compiler, AstNode* node) {
             break;
 
         case NODE_COMPOUND_ASSIGN:
+            // Parsed only as a statement: discard the assigned value
             compileCompoundAssign(compiler, node);
+            emitByte(compiler, OP_POP, node->line);
             break;
 
         case NODE_PIPE:
@@ -835,8 +1215,7 @@ static void compileNode(Compiler* compiler, AstNode* node) {
 
         case NODE_RANGE: {
             // 1..10 compiles as range(1, 10) — produces a real list value
-            uint8_t nameConst = identifierConstant(compiler, "range", 5);
-            emitBytes(compiler, OP_GET_GLOBAL, nameConst, node->line);
+            emitGlobalOp(compiler, OP_GET_GLOBAL, "range", 5, node->line);
             compileExpression(compiler, node->as.range.start);
             compileExpression(compiler, node->as.range.end);
             emitBytes(compiler, OP_CALL, 2, node->line);
@@ -871,8 +1250,7 @@ static void compileNode(Compiler* compiler, AstNode* node) {
             if (compiler->scopeDepth > 0) {
                 addLocal(compiler, name, nameLen);
             } else {
-                uint8_t global = identifierConstant(compiler, name, nameLen);
-                emitBytes(compiler, OP_DEFINE_GLOBAL, global, line);
+                emitGlobalOp(compiler, OP_DEFINE_GLOBAL, name, nameLen, line);
             }
             break;
         }
@@ -894,8 +1272,15 @@ static void compileNode(Compiler* compiler, AstNode* node) {
             if (compiler->type == TYPE_SCRIPT) {
                 fprintf(stderr, "[line %d] Error: Can't return from top-level code.\n", line);
             }
-            if (node->as.returnStmt.value != NULL) {
-                compileExpression(compiler, node->as.returnStmt.value);
+            AstNode* value = node->as.returnStmt.value;
+            if (value != NULL && value->type == NODE_CALL &&
+                compiler->type != TYPE_SCRIPT && compiler->handlerDepth == 0) {
+                // Tail position: OP_TAIL_CALL replaces this frame with the
+                // callee's. Natives just run in place, so the OP_RETURN after
+                // it still hands their result back.
+                compileCallOp(compiler, value, OP_TAIL_CALL);
+            } else if (value != NULL) {
+                compileExpression(compiler, value);
             } else {
                 emitByte(compiler, OP_NIL, line);
             }
@@ -961,8 +1346,7 @@ static void compileNode(Compiler* compiler, AstNode* node) {
 
         case NODE_EXEC: {
             int line = node->line;
-            uint8_t execGlobal = identifierConstant(compiler, "exec", 4);
-            emitBytes(compiler, OP_GET_GLOBAL, execGlobal, line);
+            emitGlobalOp(compiler, OP_GET_GLOBAL, "exec", 4, line);
             compileExpression(compiler, node->as.exec.command);
             emitBytes(compiler, OP_CALL, 1, line);
             break;
@@ -1103,6 +1487,7 @@ ObjFunction* compile(VM* vm, const char* source) {
     compileNode(&compiler, program);
 
     emitReturn(&compiler, 0);
+    optimizeChunk(currentChunk(&compiler));
 
     ObjFunction* function = compiler.function;
 
@@ -1111,8 +1496,15 @@ ObjFunction* compile(VM* vm, const char* source) {
 #endif
 
     arenaFree(&arena);
+    current = NULL;
 
     if (compiler.hadError) return NULL;
 
     return function;
 }
+
+void markCompilerRoots(void) {
+    for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+        markObject((Obj*)compiler->function);
+    }
+}
@@ -6,4 +6,7 @@
 
 ObjFunction* compile(VM* vm, const char* source);
 
+// GC roots: the functions of the compilers currently running
+void markCompilerRoots(void);
+
 #endif
@@ -179,7 +179,7 @@ static Value jsonParseObject(JSONParser* p) {
             jsonSkipWhitespace(p);
             Value val = jsonParseValue(p);
             if (p->hadError) break;
-            tableSet(&map->table, AS_STRING(key), val);
+            mapSet(p->vm, map, AS_STRING(key), val);
             jsonSkipWhitespace(p);
         } while (jsonMatch(p, ','));
     }
@@ -262,10 +262,10 @@ static void jsonWriteChar(JSONWriter* w, char c) {
 
 static void jsonWriteValue(JSONWriter* w, Value value);
 
-static void jsonWriteString(JSONWriter* w, ObjString* str) {
+static void jsonWriteChars(JSONWriter* w, const char* chars, int length) {
     jsonWriteChar(w, '"');
-    for (int i = 0; i < str->length; i++) {
-        char c = str->chars[i];
+    for (int i = 0; i < length; i++) {
+        char c = chars[i];
         switch (c) {
             case '"':  jsonWrite(w, "\\\"", 2); break;
             case '\\': jsonWrite(w, "\\\\", 2); break;
@@ -280,6 +280,24 @@ static void jsonWriteString(JSONWriter* w, ObjString* str) {
     jsonWriteChar(w, '"');
 }
 
+static void jsonWriteString(JSONWriter* w, ObjString* str) {
+    jsonWriteChars(w, str->chars, str->length);
+}
+
+// JSON keys are strings: any other key is written as the string of its
+// JSON text (1 as "1", [1, 2] as "[1,2]")
+static void jsonWriteKey(JSONWriter* w, Value key) {
+    if (IS_STRING(key)) {
+        jsonWriteString(w, AS_STRING(key));
+        return;
+    }
+    JSONWriter text;
+    jsonWriterInit(&text, w->vm);
+    jsonWriteValue(&text, key);
+    jsonWriteChars(w, text.buffer, text.length);
+    free(text.buffer);
+}
+
 static void jsonWriteValue(JSONWriter* w, Value value) {
     if (IS_NIL(value)) {
         jsonWrite(w, "null", 4);
@@ -309,19 +327,28 @@ static void jsonWriteValue(JSONWriter* w, Value value) {
             jsonWriteValue(w, list->items[i]);
         }
         jsonWriteChar(w, ']');
+    } else if (IS_SET(value)) {
+        jsonWriteChar(w, '[');
+        int cursor = 0;
+        Value member;
+        for (bool first = true; setNext(AS_SET(value), &cursor, &member); first = false) {
+            if (!first) jsonWriteChar(w, ',');
+            jsonWriteValue(w, member);
+        }
+        jsonWriteChar(w, ']');
     } else if (IS_MAP(value)) {
         ObjMap* map = AS_MAP(value);
         jsonWriteChar(w, '{');
         bool first = true;
-        for (int i = 0; i < map->table.capacity; i++) {
-            Entry* entry = &map->table.entries[i];
-            if (entry->key != NULL) {
-                if (!first) jsonWriteChar(w, ',');
-                first = false;
-                jsonWriteString(w, entry->key);
-                jsonWriteChar(w, ':');
-                jsonWriteValue(w, entry->value);
-            }
+        int cursor = 0;
+        Value key;
+        Value entryValue;
+        while (mapNext(map, &cursor, &key, &entryValue)) {
+            if (!first) jsonWriteChar(w, ',');
+            first = false;
+            jsonWriteKey(w, key);
+            jsonWriteChar(w, ':');
+            jsonWriteValue(w, entryValue);
         }
         jsonWriteChar(w, '}');
     } else {
@@ -1,6 +1,7 @@
 #include "debug.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
@@ -36,6 +37,79 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
     return offset + 3;
 }
 
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t ic = chunk->code[offset + 2];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", ic);
+    return offset + 3;
+}
+
+static int slotConstantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static void printGlobalName(int slot) {
+    VM* vm = getCurrentVM();
+    if (vm != NULL && slot < vm->globalCount) {
+        printf("%s", vm->globalNames[slot]->chars);
+    } else {
+        printf("?");
+    }
+}
+
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+    int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    printGlobalName(slot);
+    printf("'\n");
+    return offset + 3;
+}
+
+static int globalIncrementInstruction(const char* name, Chunk* chunk, int offset) {
+    int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    uint8_t constant = chunk->code[offset + 3];
+    printf("%-16s %4d '", name, slot);
+    printGlobalName(slot);
+    printf("' += '");
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+static int constantJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' -> %d\n", offset + 4 + jump);
+    return offset + 4;
+}
+
+static int slotsJumpInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t a = chunk->code[offset + 1];
+    uint8_t b = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+    jump |= chunk->code[offset + 4];
+    printf("%-16s %4d %4d -> %d\n", name, a, b, offset + 5 + jump);
+    return offset + 5;
+}
+
+static int forIterInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d -> %d\n", name, slot, offset + 4 + jump);
+    return offset + 4;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
     if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
@@ -65,15 +139,16 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_NOT:           return simpleInstruction("OP_NOT", offset);
         case OP_GET_LOCAL:     return byteInstruction("OP_GET_LOCAL", chunk, offset);
         case OP_SET_LOCAL:     return byteInstruction("OP_SET_LOCAL", chunk, offset);
-        case OP_GET_GLOBAL:    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-        case OP_SET_GLOBAL:    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
-        case OP_DEFINE_GLOBAL: return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL:    return globalInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:    return globalInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_DEFINE_GLOBAL: return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:   return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:   return byteInstruction("OP_SET_UPVALUE", chunk, offset);
         case OP_JUMP:          return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_JUMP_IF_FALSE: return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:          return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:          return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:     return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_CLOSURE: {
             offset++;
             uint8_t constant = chunk->code[offset++];
@@ -96,8 +171,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_BUILD_MAP:     return byteInstruction("OP_BUILD_MAP", chunk, offset);
         case OP_INDEX_GET:     return simpleInstruction("OP_INDEX_GET", offset);
         case OP_INDEX_SET:     return simpleInstruction("OP_INDEX_SET", offset);
-        case OP_GET_PROPERTY:  return constantInstruction("OP_GET_PROPERTY", chunk, offset);
-        case OP_SET_PROPERTY:  return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_GET_PROPERTY:  return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_SET_PROPERTY:  return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
         case OP_PRINT:         return simpleInstruction("OP_PRINT", offset);
         case OP_POP:           return simpleInstruction("OP_POP", offset);
         case OP_ALLOW: {
@@ -122,8 +197,139 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             printf("'\n");
             return offset + 3;
         }
+        case OP_RANGE:             return byteInstruction("OP_RANGE", chunk, offset);
+        case OP_FOR_ITER:          return forIterInstruction("OP_FOR_ITER", chunk, offset);
+        case OP_LEN:               return globalInstruction("OP_LEN", chunk, offset);
+        case OP_TYPE:              return globalInstruction("OP_TYPE", chunk, offset);
+        case OP_STR:               return globalInstruction("OP_STR", chunk, offset);
+        case OP_APPEND:            return globalInstruction("OP_APPEND", chunk, offset);
+        case OP_CONTAINS:          return globalInstruction("OP_CONTAINS", chunk, offset);
+        case OP_SET_LOCAL_POP:     return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+        case OP_SET_GLOBAL_POP:    return globalInstruction("OP_SET_GLOBAL_POP", chunk, offset);
+        case OP_INC_LOCAL:         return slotConstantInstruction("OP_INC_LOCAL", chunk, offset);
+        case OP_INC_GLOBAL:        return globalIncrementInstruction("OP_INC_GLOBAL", chunk, offset);
+        case OP_POP_JUMP_IF_FALSE: return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_LESS_JUMP:         return jumpInstruction("OP_LESS_JUMP", 1, chunk, offset);
+        case OP_LESS_CONST_JUMP:   return constantJumpInstruction("OP_LESS_CONST_JUMP", chunk, offset);
+        case OP_LESS_LOCALS_JUMP:  return slotsJumpInstruction("OP_LESS_LOCALS_JUMP", chunk, offset);
+        case OP_ADD_NUM:           return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_SUBTRACT_NUM:      return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:      return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case OP_GREATER_NUM:       return simpleInstruction("OP_GREATER_NUM", offset);
+        case OP_GREATER_EQUAL_NUM: return simpleInstruction("OP_GREATER_EQUAL_NUM", offset);
+        case OP_LESS_NUM:          return simpleInstruction("OP_LESS_NUM", offset);
+        case OP_LESS_EQUAL_NUM:    return simpleInstruction("OP_LESS_EQUAL_NUM", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
+
+// ---- Register code ----
+
+void disassembleRegChunk(RegChunk* chunk, Chunk* owner, const char* name) {
+    printf("== %s (registers: %d) ==\n", name, chunk->maxRegisters);
+
+    for (int offset = 0; offset < chunk->count;) {
+        offset = disassembleRegInstruction(chunk, owner, offset);
+    }
+}
+
+static int regABC(const char* name, uint32_t instruction, int offset) {
+    printf("%-16s %4d %4d %4d\n", name,
+           REG_A(instruction), REG_B(instruction), REG_C(instruction));
+    return offset + 1;
+}
+
+static int regAB(const char* name, uint32_t instruction, int offset) {
+    printf("%-16s %4d %4d\n", name, REG_A(instruction), REG_B(instruction));
+    return offset + 1;
+}
+
+static int regConstant(const char* name, uint32_t instruction, Chunk* owner, int offset) {
+    printf("%-16s %4d %4d '", name, REG_A(instruction), REG_BX(instruction));
+    printValue(owner->constants.values[REG_BX(instruction)]);
+    printf("'\n");
+    return offset + 1;
+}
+
+static int regConstantOperand(const char* name, uint32_t instruction, Chunk* owner, int offset) {
+    printf("%-16s %4d %4d %4d '", name,
+           REG_A(instruction), REG_B(instruction), REG_C(instruction));
+    printValue(owner->constants.values[REG_C(instruction)]);
+    printf("'\n");
+    return offset + 1;
+}
+
+static int regGlobal(const char* name, uint32_t instruction, int offset) {
+    printf("%-16s %4d %4d '", name, REG_A(instruction), REG_BX(instruction));
+    printGlobalName(REG_BX(instruction));
+    printf("'\n");
+    return offset + 1;
+}
+
+static int regJump(const char* name, uint32_t instruction, int offset) {
+    printf("%-16s %4d -> %d\n", name, REG_A(instruction),
+           offset + 1 + REG_SBX(instruction));
+    return offset + 1;
+}
+
+static int regCompareJump(const char* name, RegChunk* chunk, int offset) {
+    uint32_t instruction = chunk->code[offset];
+    printf("%-16s %4d %4d -> %d\n", name, REG_A(instruction), REG_B(instruction),
+           offset + 2 + (int32_t)chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+int disassembleRegInstruction(RegChunk* chunk, Chunk* owner, int offset) {
+    printf("%04d ", offset);
+    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+        printf("   | ");
+    } else {
+        printf("%4d ", chunk->lines[offset]);
+    }
+
+    uint32_t instruction = chunk->code[offset];
+    switch (REG_OP(instruction)) {
+        case ROP_MOVE:          return regAB("MOVE", instruction, offset);
+        case ROP_LOADK:         return regConstant("LOADK", instruction, owner, offset);
+        case ROP_LOADNIL:       return regAB("LOADNIL", instruction, offset);
+        case ROP_LOADBOOL:      return regAB("LOADBOOL", instruction, offset);
+        case ROP_GET_GLOBAL:    return regGlobal("GET_GLOBAL", instruction, offset);
+        case ROP_SET_GLOBAL:    return regGlobal("SET_GLOBAL", instruction, offset);
+        case ROP_ADD:           return regABC("ADD", instruction, offset);
+        case ROP_SUBTRACT:      return regABC("SUBTRACT", instruction, offset);
+        case ROP_MULTIPLY:      return regABC("MULTIPLY", instruction, offset);
+        case ROP_DIVIDE:        return regABC("DIVIDE", instruction, offset);
+        case ROP_MODULO:        return regABC("MODULO", instruction, offset);
+        case ROP_ADDK:          return regConstantOperand("ADDK", instruction, owner, offset);
+        case ROP_SUBTRACTK:     return regConstantOperand("SUBTRACTK", instruction, owner, offset);
+        case ROP_EQUAL:         return regABC("EQUAL", instruction, offset);
+        case ROP_NOT_EQUAL:     return regABC("NOT_EQUAL", instruction, offset);
+        case ROP_LESS:          return regABC("LESS", instruction, offset);
+        case ROP_LESS_EQUAL:    return regABC("LESS_EQUAL", instruction, offset);
+        case ROP_GREATER:       return regABC("GREATER", instruction, offset);
+        case ROP_GREATER_EQUAL: return regABC("GREATER_EQUAL", instruction, offset);
+        case ROP_NOT:           return regAB("NOT", instruction, offset);
+        case ROP_NEGATE:        return regAB("NEGATE", instruction, offset);
+        case ROP_JUMP:          return regJump("JUMP", instruction, offset);
+        case ROP_JUMP_IF_FALSE: return regJump("JUMP_IF_FALSE", instruction, offset);
+        case ROP_JUMP_IF_TRUE:  return regJump("JUMP_IF_TRUE", instruction, offset);
+        case ROP_JUMP_UNLESS_LESS:
+            return regCompareJump("JUMP_UNLESS_LT", chunk, offset);
+        case ROP_JUMP_UNLESS_LESS_EQUAL:
+            return regCompareJump("JUMP_UNLESS_LE", chunk, offset);
+        case ROP_FOR_PREP:      return regJump("FOR_PREP", instruction, offset);
+        case ROP_FOR_LOOP:      return regJump("FOR_LOOP", instruction, offset);
+        case ROP_INDEX_GET:     return regABC("INDEX_GET", instruction, offset);
+        case ROP_INDEX_SET:     return regABC("INDEX_SET", instruction, offset);
+        case ROP_BUILD_LIST:    return regABC("BUILD_LIST", instruction, offset);
+        case ROP_CALL:          return regAB("CALL", instruction, offset);
+        case ROP_TAIL_CALL:     return regAB("TAIL_CALL", instruction, offset);
+        case ROP_RETURN:        return regAB("RETURN", instruction, offset);
+        case ROP_RETURN_NIL:    printf("RETURN_NIL\n"); return offset + 1;
+        default:
+            printf("Unknown register opcode %d\n", REG_OP(instruction));
+            return offset + 1;
+    }
+}
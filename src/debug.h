@@ -6,4 +6,8 @@
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
 
+// Register code (--vm=register); constants live in the function's stack chunk
+void disassembleRegChunk(RegChunk* chunk, Chunk* owner, const char* name);
+int disassembleRegInstruction(RegChunk* chunk, Chunk* owner, int offset);
+
 #endif
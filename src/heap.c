@@ -0,0 +1,382 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "heap.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+void initHeap(Heap* heap) {
+    memset(heap, 0, sizeof(Heap));
+}
+
+static int sizeClassOf(size_t size) {
+    return (int)((size + HEAP_GRANULE - 1) / HEAP_GRANULE) - 1;
+}
+
+size_t heapObjectSize(size_t size) {
+    if (size > HEAP_MAX_SMALL) return sizeof(LargeObject) + size;
+    return (size_t)(sizeClassOf(size) + 1) * HEAP_GRANULE;
+}
+
+static void outOfMemory(void) {
+    fprintf(stderr, "Error: Out of memory.\n");
+    exit(1);
+}
+
+// Pages are mapped from the system HEAP_MAP_PAGES at a time and unmapped
+// one by one, so memory a shrinking heap releases goes back to the system
+// (free() would keep most of it). The rest of a batch costs nothing until
+// it is used. On Windows each page is its own VirtualAlloc, which is
+// aligned to the 64K allocation granularity, so to HEAP_PAGE_SIZE.
+static HeapPage* mapPage(Heap* heap) {
+#ifdef _WIN32
+    HeapPage* page = (HeapPage*)VirtualAlloc(NULL, HEAP_PAGE_SIZE,
+                                             MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (page == NULL) outOfMemory();
+    (void)heap;
+    return page;
+#else
+    if (heap->spareCount == 0) {
+        size_t size = (size_t)HEAP_PAGE_SIZE * (HEAP_MAP_PAGES + 1);
+        char* memory = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) outOfMemory();
+        // Trim the mapping to HEAP_MAP_PAGES aligned pages
+        char* start = (char*)(((uintptr_t)memory + HEAP_PAGE_SIZE - 1) &
+                              ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+        char* end = start + (size_t)HEAP_PAGE_SIZE * HEAP_MAP_PAGES;
+        if (start > memory) munmap(memory, (size_t)(start - memory));
+        if (end < memory + size) munmap(end, (size_t)(memory + size - end));
+        heap->spare = start;
+        heap->spareCount = HEAP_MAP_PAGES;
+    }
+    HeapPage* page = (HeapPage*)heap->spare;
+    heap->spare += HEAP_PAGE_SIZE;
+    heap->spareCount--;
+    return page;
+#endif
+}
+
+static void unmapPage(HeapPage* page) {
+#ifdef _WIN32
+    VirtualFree(page, 0, MEM_RELEASE);
+#else
+    munmap(page, HEAP_PAGE_SIZE);
+#endif
+}
+
+static HeapPage* newPage(Heap* heap, SizeClass* sizeClass, int index) {
+    HeapPage* page = mapPage(heap);
+    memset(page, 0, offsetof(HeapPage, slots));
+
+    page->sizeClass = sizeClass;
+    page->slotSize = (uint32_t)(index + 1) * HEAP_GRANULE;
+    page->slotDivisor = (uint32_t)(((1ull << 32) + page->slotSize - 1) / page->slotSize);
+    page->slotCount = (int)((HEAP_PAGE_SIZE - offsetof(HeapPage, slots)) / page->slotSize);
+    page->sweptCycle = heap->cycle;
+
+    page->next = sizeClass->pages;
+    sizeClass->pages = page;
+    sizeClass->freeSlots += page->slotCount;
+    heap->pageCount++;
+    return page;
+}
+
+// The bits of bitmap word 'word' that stand for real slots
+static inline uint64_t slotMask(HeapPage* page, int word) {
+    int rest = page->slotCount - word * 64;
+    return rest >= 64 ? ~0ull : (1ull << rest) - 1;
+}
+
+static int takeSlot(HeapPage* page) {
+    int words = (page->slotCount + 63) / 64;
+    for (int word = page->freeHint; word < words; word++) {
+        uint64_t free = ~page->allocated[word] & slotMask(page, word);
+        if (free != 0) {
+            page->freeHint = word;
+            return word * 64 + __builtin_ctzll(free);
+        }
+    }
+    return -1;  // unreachable: callers check liveCount first
+}
+
+// A page of the class with a free slot: walk on from the last one used,
+// sweeping pages the current sweep has not reached yet, and wrap around
+// once before adding a page
+static HeapPage* findPage(VM* vm, SizeClass* sizeClass, int index) {
+    Heap* heap = &vm->heap;
+    bool sweeping = vm->gcPhase == GC_SWEEP;
+    HeapPage* start = sizeClass->allocPage != NULL ? sizeClass->allocPage
+                                                   : sizeClass->pages;
+
+    for (int pass = 0; pass < 2; pass++) {
+        HeapPage* end = pass == 0 ? NULL : start;
+        HeapPage* page = pass == 0 ? start : sizeClass->pages;
+        for (; page != end; page = page->next) {
+            if (!sweeping && sizeClass->freeSlots == 0) break;
+            if (sweeping && page->sweptCycle != heap->cycle) sweepPage(vm, page);
+            if (page->liveCount < page->slotCount) {
+                sizeClass->allocPage = page;
+                return page;
+            }
+        }
+    }
+
+    sizeClass->allocPage = newPage(heap, sizeClass, index);
+    return sizeClass->allocPage;
+}
+
+static void addYoungPage(Heap* heap, HeapPage* page) {
+    page->hasYoung = true;
+    if (heap->youngPageCapacity < heap->youngPageCount + 1) {
+        heap->youngPageCapacity = GROW_CAPACITY(heap->youngPageCapacity);
+        heap->youngPages = (HeapPage**)realloc(heap->youngPages,
+            sizeof(HeapPage*) * heap->youngPageCapacity);
+        if (heap->youngPages == NULL) outOfMemory();
+    }
+    heap->youngPages[heap->youngPageCount++] = page;
+}
+
+Obj* heapAllocate(VM* vm, size_t size) {
+    Heap* heap = &vm->heap;
+
+    if (size > HEAP_MAX_SMALL) {
+        LargeObject* large = (LargeObject*)malloc(sizeof(LargeObject) + size);
+        if (large == NULL) outOfMemory();
+        large->size = size;
+        large->marked = false;
+        large->next = heap->youngLarge;
+        heap->youngLarge = large;
+
+        Obj* object = LARGE_OBJECT(large);
+        object->isLarge = true;
+        return object;
+    }
+
+    int index = sizeClassOf(size);
+    SizeClass* sizeClass = &heap->classes[index];
+    HeapPage* page = sizeClass->allocPage;
+    if (page == NULL || page->liveCount == page->slotCount ||
+        page->sweptCycle != heap->cycle) {
+        page = findPage(vm, sizeClass, index);
+    }
+
+    int slot = takeSlot(page);
+    int word = slot / 64;
+    uint64_t bit = 1ull << (slot % 64);
+    page->allocated[word] |= bit;
+    page->young[word] |= bit;
+    page->marked[word] &= ~bit;
+    page->liveCount++;
+    sizeClass->freeSlots--;
+
+    if (!page->hasYoung) addYoungPage(heap, page);
+
+    Obj* object = heapSlot(page, slot);
+    object->isLarge = false;
+    return object;
+}
+
+size_t heapFree(Obj* object) {
+    if (object->isLarge) {
+        LargeObject* large = LARGE_HEADER(object);
+        size_t size = sizeof(LargeObject) + large->size;
+        free(large);
+        return size;
+    }
+
+    HeapPage* page = HEAP_PAGE_OF(object);
+    int slot = heapSlotIndex(page, object);
+    int word = slot / 64;
+    uint64_t bit = 1ull << (slot % 64);
+    page->allocated[word] &= ~bit;
+    page->young[word] &= ~bit;
+    page->liveCount--;
+    page->sizeClass->freeSlots++;
+    if (word < page->freeHint) page->freeHint = word;
+    return page->slotSize;
+}
+
+void heapReleasePage(Heap* heap, HeapPage* page) {
+    page->sizeClass->freeSlots -= page->slotCount;
+    heap->pageCount--;
+    unmapPage(page);
+}
+
+void heapCountObjects(Heap* heap, size_t* counts) {
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+            int words = (page->slotCount + 63) / 64;
+            for (int word = 0; word < words; word++) {
+                for (uint64_t bits = page->allocated[word]; bits != 0; bits &= bits - 1) {
+                    counts[heapSlot(page, word * 64 + __builtin_ctzll(bits))->type]++;
+                }
+            }
+        }
+    }
+    for (LargeObject* large = heap->youngLarge; large != NULL; large = large->next) {
+        counts[LARGE_OBJECT(large)->type]++;
+    }
+    for (LargeObject* large = heap->oldLarge; large != NULL; large = large->next) {
+        counts[LARGE_OBJECT(large)->type]++;
+    }
+}
+
+// ---- Compaction ----
+
+static int byLiveCount(const void* a, const void* b) {
+    int left = (*(HeapPage* const*)a)->liveCount;
+    int right = (*(HeapPage* const*)b)->liveCount;
+    return (left > right) - (left < right);
+}
+
+// In each class, take the sparsest pages while they are at most half full
+// and the pages that stay have room for everything moved so far
+bool heapPlanEvacuation(Heap* heap) {
+    HeapPage** pages = NULL;
+    int capacity = 0;
+    size_t chosen = 0;
+
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        SizeClass* sizeClass = &heap->classes[i];
+        int count = 0;
+        for (HeapPage* page = sizeClass->pages; page != NULL; page = page->next) {
+            if (count == capacity) {
+                capacity = GROW_CAPACITY(capacity);
+                pages = (HeapPage**)realloc(pages, sizeof(HeapPage*) * capacity);
+                if (pages == NULL) outOfMemory();
+            }
+            pages[count++] = page;
+        }
+        if (count < 2) continue;
+        qsort(pages, (size_t)count, sizeof(HeapPage*), byLiveCount);
+
+        size_t room = sizeClass->freeSlots;     // in the pages that stay
+        size_t moving = 0;
+        for (int j = 0; j < count; j++) {
+            HeapPage* page = pages[j];
+            size_t free = (size_t)(page->slotCount - page->liveCount);
+            if (page->liveCount * 2 > page->slotCount) break;
+            if (room - free < moving + (size_t)page->liveCount) break;
+            room -= free;
+            moving += (size_t)page->liveCount;
+            page->evacuating = true;
+            chosen++;
+        }
+    }
+    free(pages);
+
+    if (chosen > 0 && chosen * HEAP_COMPACT_RATIO >= heap->pageCount) return true;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+            page->evacuating = false;
+        }
+    }
+    return false;
+}
+
+static void moveObject(Heap* heap, HeapPage* from, int slot, HeapPage* to) {
+    int word = slot / 64;
+    uint64_t bit = 1ull << (slot % 64);
+    bool young = (from->young[word] & bit) != 0;
+    from->allocated[word] &= ~bit;
+    from->young[word] &= ~bit;
+    from->liveCount--;
+
+    int target = takeSlot(to);
+    int targetWord = target / 64;
+    uint64_t targetBit = 1ull << (target % 64);
+    to->allocated[targetWord] |= targetBit;
+    to->marked[targetWord] &= ~targetBit;
+    if (young) {
+        to->young[targetWord] |= targetBit;
+        if (!to->hasYoung) addYoungPage(heap, to);
+    }
+    to->liveCount++;
+
+    Obj* object = heapSlot(from, slot);
+    Obj* copy = heapSlot(to, target);
+    memcpy(copy, object, from->slotSize);
+    ((ObjForward*)object)->to = copy;
+}
+
+void heapEvacuate(Heap* heap) {
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        SizeClass* sizeClass = &heap->classes[i];
+        HeapPage* target = sizeClass->pages;
+        for (HeapPage* page = sizeClass->pages; page != NULL; page = page->next) {
+            if (!page->evacuating) continue;
+            int words = (page->slotCount + 63) / 64;
+            for (int word = 0; word < words; word++) {
+                for (uint64_t bits = page->allocated[word]; bits != 0; bits &= bits - 1) {
+                    // heapPlanEvacuation left room, so a target turns up
+                    while (target->evacuating || target->liveCount == target->slotCount) {
+                        target = target->next;
+                    }
+                    moveObject(heap, page, word * 64 + __builtin_ctzll(bits), target);
+                }
+            }
+        }
+        sizeClass->allocPage = NULL;
+    }
+}
+
+void heapReleaseEvacuated(Heap* heap) {
+    int kept = 0;
+    for (int i = 0; i < heap->youngPageCount; i++) {
+        if (!heap->youngPages[i]->evacuating) heap->youngPages[kept++] = heap->youngPages[i];
+    }
+    heap->youngPageCount = kept;
+
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        SizeClass* sizeClass = &heap->classes[i];
+        HeapPage** link = &sizeClass->pages;
+        while (*link != NULL) {
+            HeapPage* page = *link;
+            if (page->evacuating) {
+                *link = page->next;
+                heapReleasePage(heap, page);
+            } else {
+                link = &page->next;
+            }
+        }
+    }
+}
+
+static void freeLargeList(LargeObject* large) {
+    while (large != NULL) {
+        LargeObject* next = large->next;
+        free(large);
+        large = next;
+    }
+}
+
+void freeHeap(Heap* heap) {
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        HeapPage* page = heap->classes[i].pages;
+        while (page != NULL) {
+            HeapPage* next = page->next;
+            unmapPage(page);
+            page = next;
+        }
+    }
+    freeLargeList(heap->youngLarge);
+    freeLargeList(heap->oldLarge);
+    free(heap->youngPages);
+#ifndef _WIN32
+    if (heap->spareCount > 0) munmap(heap->spare, (size_t)HEAP_PAGE_SIZE * heap->spareCount);
+#endif
+    initHeap(heap);
+}
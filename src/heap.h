@@ -0,0 +1,119 @@
+#ifndef glipt_heap_h
+#define glipt_heap_h
+
+#include "common.h"
+#include "value.h"
+
+typedef struct VM VM;
+
+// Object storage. Objects up to HEAP_MAX_SMALL bytes live in size-class
+// pages: HEAP_PAGE_SIZE-aligned blocks of equal slots, with one bit per
+// slot in each of three bitmaps (allocated, marked, young). The page of an
+// object is found by masking its address, so small objects carry no list
+// link and their mark bits sit apart from the objects. Larger objects get
+// their own malloc block behind a LargeObject header and stay on lists.
+
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 16
+#define HEAP_MAX_SMALL 256
+#define HEAP_SIZE_CLASSES (HEAP_MAX_SMALL / HEAP_GRANULE)
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)
+#define HEAP_MAP_PAGES 16   // pages mapped from the system at once
+// Compaction runs only when it would release at least 1/HEAP_COMPACT_RATIO
+// of the pages
+#define HEAP_COMPACT_RATIO 8
+
+typedef struct SizeClass SizeClass;
+
+typedef struct HeapPage {
+    struct HeapPage* next;      // in its size class
+    SizeClass* sizeClass;
+    uint32_t slotSize;
+    uint32_t slotDivisor;       // 2^32 / slotSize, rounded up (see heapSlotIndex)
+    int slotCount;
+    int liveCount;
+    int freeHint;               // no free slot in the bitmap words before this
+    uint32_t sweptCycle;        // == heap cycle once the current sweep is done here
+    bool hasYoung;              // in heap->youngPages
+    bool evacuating;            // being emptied by compaction (see heapEvacuate)
+    uint64_t allocated[HEAP_BITMAP_WORDS];
+    uint64_t marked[HEAP_BITMAP_WORDS];
+    uint64_t young[HEAP_BITMAP_WORDS];  // allocated since the last collection
+    _Alignas(HEAP_GRANULE) char slots[];
+} HeapPage;
+
+struct SizeClass {
+    HeapPage* pages;
+    HeapPage* allocPage;        // allocation resumes here
+    size_t freeSlots;           // in swept pages
+};
+
+typedef struct LargeObject {
+    struct LargeObject* next;
+    size_t size;
+    bool marked;
+    // the object follows
+} LargeObject;
+
+typedef struct {
+    SizeClass classes[HEAP_SIZE_CLASSES];
+    HeapPage** youngPages;      // pages with young objects
+    int youngPageCount;
+    int youngPageCapacity;
+    LargeObject* youngLarge;    // large objects allocated since the last collection
+    LargeObject* oldLarge;
+    uint32_t cycle;             // full collections that reached the sweep
+    size_t pageCount;
+    char* spare;                // mapped pages not used yet
+    int spareCount;
+} Heap;
+
+#define HEAP_PAGE_OF(object) \
+    ((HeapPage*)((uintptr_t)(object) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1)))
+#define LARGE_HEADER(object) ((LargeObject*)(object) - 1)
+#define LARGE_OBJECT(large) ((Obj*)((LargeObject*)(large) + 1))
+
+// Slot number of an object in its page, by multiplying with the rounded-up
+// reciprocal of the slot size (exact for offsets below 2^16)
+static inline int heapSlotIndex(HeapPage* page, Obj* object) {
+    uint32_t offset = (uint32_t)((char*)object - page->slots);
+    return (int)(((uint64_t)offset * page->slotDivisor) >> 32);
+}
+
+static inline Obj* heapSlot(HeapPage* page, int slot) {
+    return (Obj*)(page->slots + (size_t)slot * page->slotSize);
+}
+
+void initHeap(Heap* heap);
+// Bytes an object of 'size' bytes takes up (its slot or its large block)
+size_t heapObjectSize(size_t size);
+// Memory for a new young object; the caller sets the header. During a
+// sweep, pages are swept lazily as allocation reaches them.
+Obj* heapAllocate(VM* vm, size_t size);
+// Release an object's memory; returns what heapObjectSize charged for it.
+// Large objects must already be off their list.
+size_t heapFree(Obj* object);
+// Give an empty page back to the system; the caller unlinks it
+void heapReleasePage(Heap* heap, HeapPage* page);
+// Add up the objects in the heap (dead ones not swept yet included) by
+// type: counts[type] for type < OBJ_TYPE_COUNT
+void heapCountObjects(Heap* heap, size_t* counts);
+
+// Compaction (run --gc-compact). Between collections, the objects of the
+// sparsest pages of each class are copied into the free slots of the
+// others, and each old slot keeps the address of its copy (see
+// forwardObject in object.h). Once every reference has been passed through
+// it, the emptied pages are released. Large objects do not move.
+//
+// Choose the pages to empty; false (and nothing chosen) if too few would be
+// released to be worth a pass over the heap
+bool heapPlanEvacuation(Heap* heap);
+// Move every object out of the chosen pages
+void heapEvacuate(Heap* heap);
+// Release the emptied pages (their forwarding addresses with them)
+void heapReleaseEvacuated(Heap* heap);
+// Release every page and large object (the objects must be freed already
+// or be of no further interest)
+void freeHeap(Heap* heap);
+
+#endif
@@ -0,0 +1,994 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "jit.h"
+
+#ifdef GLIPT_JIT
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "opcode.h"
+
+// ---- Code layout ----
+//
+//   prologue    save callee-saved registers, pin VM state, jmp to the entry
+//   epilogue    restore and return the status in eax
+//   body        one template per bytecode instruction, in bytecode order
+//   exit stubs  one per instruction that can bail out: sync stackTop and ip,
+//               return JIT_EXIT
+//
+// Pinned registers (all callee-saved, so helper calls preserve them):
+//   rbx  stack top (vm->stackTop while inside machine code)
+//   rbp  QNAN, for number guards
+//   r12  VM*
+//   r13  CallFrame*
+//   r14  frame->slots
+//   r15  vm->globalValues (reloaded after calls)
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define R_TOP     RBX
+#define R_QNAN    RBP
+#define R_VM      R12
+#define R_FRAME   R13
+#define R_SLOTS   R14
+#define R_GLOBALS R15
+
+enum { XMM0, XMM1, XMM2 };
+
+// Condition codes (low nibble of Jcc/SETcc)
+enum { CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+       CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+// ALU opcodes, reg -> r/m form
+enum { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29,
+       ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_TEST = 0x85 };
+
+// ALU opcode extensions for the immediate form (0x81 /n)
+enum { IMM_ADD = 0, IMM_SUB = 5, IMM_CMP = 7 };
+
+typedef struct {
+    int at;         // position of a rel32 field
+    int target;     // bytecode offset it jumps to
+} JitPatch;
+
+typedef struct {
+    Chunk* chunk;
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    int32_t* entries;   // bytecode offset -> code offset
+    int32_t* stubs;     // bytecode offset -> exit stub offset
+
+    JitPatch* jumps;    // branches to bytecode targets
+    int jumpCount;
+    int jumpCapacity;
+    JitPatch* exits;    // branches to exit stubs
+    int exitCount;
+    int exitCapacity;
+
+    int epilogue;
+    bool safepoints;    // loops leave for the interpreter's compaction safepoint
+    bool failed;        // out of memory
+} Assembler;
+
+// ---- Emitting ----
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->count == as->capacity) {
+        int capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        uint8_t* code = realloc(as->code, capacity);
+        if (code == NULL) {
+            as->failed = true;
+            as->count = 0;
+            return;
+        }
+        as->code = code;
+        as->capacity = capacity;
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) emitByte(as, bytes[i]);
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(as, (uint8_t)(value >> (8 * i)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte(as, (uint8_t)(value >> (8 * i)));
+}
+
+static void patch32(Assembler* as, int at, int32_t value) {
+    if (as->failed) return;
+    memcpy(as->code + at, &value, sizeof(value));
+}
+
+static void addPatch(Assembler* as, JitPatch** list, int* count, int* capacity,
+                     int at, int target) {
+    if (*count == *capacity) {
+        int grown = *capacity < 16 ? 16 : *capacity * 2;
+        JitPatch* patches = realloc(*list, sizeof(JitPatch) * grown);
+        if (patches == NULL) {
+            as->failed = true;
+            return;
+        }
+        *list = patches;
+        *capacity = grown;
+    }
+    (*list)[(*count)++] = (JitPatch){at, target};
+}
+
+// ---- x86-64 encodings ----
+
+static void rex(Assembler* as, bool wide, int reg, int rm) {
+    uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if (prefix != 0x40) emitByte(as, prefix);
+}
+
+static void modrmReg(Assembler* as, int reg, int rm) {
+    emitByte(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [base + disp32]
+static void modrmMem(Assembler* as, int reg, int base, int32_t disp) {
+    emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emitByte(as, 0x24); // rsp/r12 base needs a SIB byte
+    emit32(as, (uint32_t)disp);
+}
+
+// mov dst, [base + disp]
+static void load(Assembler* as, int dst, int base, int32_t disp) {
+    rex(as, true, dst, base);
+    emitByte(as, 0x8B);
+    modrmMem(as, dst, base, disp);
+}
+
+// mov [base + disp], src
+static void store(Assembler* as, int base, int32_t disp, int src) {
+    rex(as, true, src, base);
+    emitByte(as, 0x89);
+    modrmMem(as, src, base, disp);
+}
+
+// mov dst, imm64
+static void loadImm(Assembler* as, int dst, uint64_t value) {
+    rex(as, true, 0, dst);
+    emitByte(as, 0xB8 + (dst & 7));
+    emit64(as, value);
+}
+
+// mov r32, imm32 (zero-extends)
+static void loadImm32(Assembler* as, int dst, uint32_t value) {
+    rex(as, false, 0, dst);
+    emitByte(as, 0xB8 + (dst & 7));
+    emit32(as, value);
+}
+
+// op dst, src for the ALU_* opcodes (cmp/test set flags only)
+static void alu(Assembler* as, uint8_t op, int dst, int src) {
+    rex(as, true, src, dst);
+    emitByte(as, op);
+    modrmReg(as, src, dst);
+}
+
+static void aluImm(Assembler* as, int ext, int dst, int32_t value) {
+    rex(as, true, 0, dst);
+    emitByte(as, 0x81);
+    modrmReg(as, ext, dst);
+    emit32(as, (uint32_t)value);
+}
+
+// 32-bit forms, for tagged ints (the result zero-extends into the register)
+static void alu32(Assembler* as, uint8_t op, int dst, int src) {
+    rex(as, false, src, dst);
+    emitByte(as, op);
+    modrmReg(as, src, dst);
+}
+
+static void aluImm32(Assembler* as, int ext, int dst, int32_t value) {
+    rex(as, false, 0, dst);
+    emitByte(as, 0x81);
+    modrmReg(as, ext, dst);
+    emit32(as, (uint32_t)value);
+}
+
+// imul dst32, src32
+static void imul32(Assembler* as, int dst, int src) {
+    rex(as, false, dst, src);
+    emitBytes(as, (const uint8_t[]){0x0F, 0xAF}, 2);
+    modrmReg(as, dst, src);
+}
+
+// neg r32
+static void neg32(Assembler* as, int reg) {
+    rex(as, false, 0, reg);
+    emitByte(as, 0xF7);
+    modrmReg(as, 3, reg);
+}
+
+// shr r64, imm8
+static void shiftRight(Assembler* as, int reg, uint8_t count) {
+    rex(as, true, 0, reg);
+    emitByte(as, 0xC1);
+    modrmReg(as, 5, reg);
+    emitByte(as, count);
+}
+
+static void move(Assembler* as, int dst, int src) {
+    alu(as, 0x89, dst, src);
+}
+
+static void push(Assembler* as, int reg) {
+    rex(as, false, 0, reg);
+    emitByte(as, 0x50 + (reg & 7));
+}
+
+static void pop(Assembler* as, int reg) {
+    rex(as, false, 0, reg);
+    emitByte(as, 0x58 + (reg & 7));
+}
+
+// movq xmm, r64 / movq r64, xmm
+static void toXmm(Assembler* as, int xmm, int gpr) {
+    emitByte(as, 0x66);
+    rex(as, true, xmm, gpr);
+    emitBytes(as, (const uint8_t[]){0x0F, 0x6E}, 2);
+    modrmReg(as, xmm, gpr);
+}
+
+static void fromXmm(Assembler* as, int gpr, int xmm) {
+    emitByte(as, 0x66);
+    rex(as, true, xmm, gpr);
+    emitBytes(as, (const uint8_t[]){0x0F, 0x7E}, 2);
+    modrmReg(as, xmm, gpr);
+}
+
+// cvtsi2sd xmm, r32
+static void intToXmm(Assembler* as, int xmm, int gpr) {
+    emitByte(as, 0xF2);
+    rex(as, false, xmm, gpr);
+    emitBytes(as, (const uint8_t[]){0x0F, 0x2A}, 2);
+    modrmReg(as, xmm, gpr);
+}
+
+// Scalar double ops: F2 0F 58 addsd, 5C subsd, 59 mulsd, 5E divsd;
+// 66 0F 2E ucomisd, 66 0F 57 xorpd
+static void sse(Assembler* as, uint8_t prefix, uint8_t op, int dst, int src) {
+    emitBytes(as, (const uint8_t[]){prefix, 0x0F, op}, 3);
+    modrmReg(as, dst, src);
+}
+
+// setcc al; movzx eax, al
+static void setccEax(Assembler* as, int cc) {
+    emitBytes(as, (const uint8_t[]){0x0F, (uint8_t)(0x90 | cc), 0xC0, 0x0F, 0xB6, 0xC0}, 6);
+}
+
+typedef void (*JitHelper)(void);
+
+static void callAbsolute(Assembler* as, JitHelper function) {
+    loadImm(as, RAX, (uint64_t)(uintptr_t)function);
+    emitBytes(as, (const uint8_t[]){0xFF, 0xD0}, 2); // call rax
+}
+
+// jmp/jcc rel32 with the displacement left for patching; returns its position
+static int jump(Assembler* as) {
+    emitByte(as, 0xE9);
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+static int jumpIf(Assembler* as, int cc) {
+    emitBytes(as, (const uint8_t[]){0x0F, (uint8_t)(0x80 | cc)}, 2);
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+static void patchHere(Assembler* as, int at) {
+    patch32(as, at, as->count - (at + 4));
+}
+
+// ---- VM-level pieces ----
+
+static void jumpTo(Assembler* as, int cc, int target) {
+    int at = cc < 0 ? jump(as) : jumpIf(as, cc);
+    addPatch(as, &as->jumps, &as->jumpCount, &as->jumpCapacity, at, target);
+}
+
+// Leave machine code before instruction 'offset' has changed anything
+static void exitTo(Assembler* as, int cc, int offset) {
+    int at = cc < 0 ? jump(as) : jumpIf(as, cc);
+    addPatch(as, &as->exits, &as->exitCount, &as->exitCapacity, at, offset);
+}
+
+static void pushValue(Assembler* as, int reg) {
+    store(as, R_TOP, 0, reg);
+    aluImm(as, IMM_ADD, R_TOP, sizeof(Value));
+}
+
+static void dropValues(Assembler* as, int count) {
+    aluImm(as, IMM_SUB, R_TOP, (int32_t)(sizeof(Value) * count));
+}
+
+// Exit unless 'reg' holds a double
+static void guardNumber(Assembler* as, int reg, int offset) {
+    move(as, RDX, reg);
+    alu(as, ALU_AND, RDX, R_QNAN);
+    alu(as, ALU_CMP, RDX, R_QNAN);
+    exitTo(as, CC_E, offset);
+}
+
+// Branch (returned for patching) unless 'reg' holds a tagged int; clobbers rdx
+static int jumpUnlessInt(Assembler* as, int reg) {
+    move(as, RDX, reg);
+    shiftRight(as, RDX, 32);
+    aluImm32(as, IMM_CMP, RDX, (int32_t)((QNAN | TAG_INT) >> 32));
+    return jumpIf(as, CC_NE);
+}
+
+// Tag the 32-bit result in 'reg' as an int; clobbers rsi
+static void tagInt(Assembler* as, int reg) {
+    loadImm(as, RSI, QNAN | TAG_INT);
+    alu(as, ALU_OR, reg, RSI);
+}
+
+// Any number in 'reg' as a double in 'xmm', or exit
+static void toDouble(Assembler* as, int xmm, int reg, int offset) {
+    int notInt = jumpUnlessInt(as, reg);
+    intToXmm(as, xmm, reg);
+    int done = jump(as);
+    patchHere(as, notInt);
+    guardNumber(as, reg, offset);
+    toXmm(as, xmm, reg);
+    patchHere(as, done);
+}
+
+// Branches (stored in slow[]) taken unless both rax and rcx hold tagged ints
+static void jumpUnlessInts(Assembler* as, int slow[2]) {
+    slow[0] = jumpUnlessInt(as, RAX);
+    slow[1] = jumpUnlessInt(as, RCX);
+}
+
+static void loadConstant(Assembler* as, int dst, int index) {
+    loadImm(as, dst, (uint64_t)(uintptr_t)&as->chunk->constants.values[index]);
+    load(as, dst, dst, 0);
+}
+
+static void syncState(Assembler* as, int offset) {
+    store(as, R_VM, offsetof(VM, stackTop), R_TOP);
+    loadImm(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + offset));
+    store(as, R_FRAME, offsetof(CallFrame, ip), RAX);
+}
+
+static void returnStatus(Assembler* as, JitStatus status) {
+    loadImm32(as, RAX, status);
+    int at = jump(as);
+    patch32(as, at, as->epilogue - (at + 4));
+}
+
+// Boolean Value from the flags: FALSE_VAL + condition (TRUE_VAL is FALSE_VAL + 1)
+static void boolFromFlags(Assembler* as, int cc) {
+    setccEax(as, cc);
+    loadImm(as, RCX, FALSE_VAL);
+    alu(as, ALU_ADD, RAX, RCX);
+}
+
+static bool isFalseyValue(Value value) {
+    return isFalsey(value);
+}
+
+static bool valuesEqualValue(Value a, Value b) {
+    return valuesEqual(a, b);
+}
+
+// Branch to bytecode 'target' if the Value in rax is falsey. true and
+// false are decided inline; nil and numbers go through isFalsey.
+static void branchIfFalsey(Assembler* as, int target) {
+    loadImm(as, RCX, TRUE_VAL);
+    alu(as, ALU_CMP, RAX, RCX);
+    int truthy = jumpIf(as, CC_E);
+    loadImm(as, RCX, FALSE_VAL);
+    alu(as, ALU_CMP, RAX, RCX);
+    jumpTo(as, CC_E, target);
+    move(as, RDI, RAX);
+    callAbsolute(as, (JitHelper)isFalseyValue);
+    emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2); // test al, al
+    jumpTo(as, CC_NE, target);
+    patchHere(as, truthy);
+}
+
+// ---- Runtime helpers (plain C, called from machine code) ----
+
+// list[index] for an in-range numeric index; false leaves it to the interpreter
+static bool jitIndexGet(Value* top) {
+    Value object = top[-2];
+    Value index = top[-1];
+    if (!IS_LIST(object) || !IS_NUMBER(index)) return false;
+    ObjList* list = AS_LIST(object);
+    int i = asInt(index);
+    if (i < 0) i += list->count;
+    if (i < 0 || i >= list->count) return false;
+    top[-2] = list->items[i];
+    return true;
+}
+
+static bool jitIndexSet(Value* top) {
+    Value object = top[-3];
+    Value index = top[-2];
+    if (!IS_LIST(object) || !IS_NUMBER(index)) return false;
+    ObjList* list = AS_LIST(object);
+    int i = asInt(index);
+    if (i < 0) i += list->count;
+    if (i < 0 || i >= list->count) return false;
+    list->items[i] = top[-1];
+    LIST_WRITE_BARRIER(list, i, top[-1]);
+    top[-3] = top[-1];
+    return true;
+}
+
+// Upvalue store, through the write barrier
+static void jitSetUpvalue(ObjUpvalue* upvalue, Value value) {
+    *upvalue->location = value;
+    WRITE_BARRIER(upvalue, value);
+}
+
+// OP_FOR_ITER over lists and ranges: 0 = next value stored, 1 = done,
+// 2 = anything else (strings allocate, maps walk tables): interpret it
+static int jitForIter(Value* iter) {
+    Value iterable = iter[0];
+    int cursor = asInt(iter[1]);
+    if (IS_LIST(iterable)) {
+        ObjList* list = AS_LIST(iterable);
+        if (cursor >= list->count) return 1;
+        iter[2] = list->items[cursor];
+        iter[1] = INT_VAL(cursor + 1);
+    } else if (IS_RANGE(iterable)) {
+        ObjRange* range = AS_RANGE(iterable);
+        double value = range->next;
+        if (range->step > 0 ? !(value < range->end) : !(value > range->end)) return 1;
+        iter[2] = numberValue(value);
+        range->next = value + range->step;
+    } else {
+        return 2;
+    }
+    return 0;
+}
+
+// ---- Templates ----
+
+static uint16_t readShort(Chunk* chunk, int offset) {
+    return (uint16_t)((chunk->code[offset] << 8) | chunk->code[offset + 1]);
+}
+
+// a = stackTop[-2], b = stackTop[-1] (in rax/rcx) as doubles in xmm0/xmm1, or exit
+static void loadOperands(Assembler* as) {
+    load(as, RAX, R_TOP, -16);
+    load(as, RCX, R_TOP, -8);
+}
+
+static void numberOperands(Assembler* as, int offset) {
+    toDouble(as, XMM0, RAX, offset);
+    toDouble(as, XMM1, RCX, offset);
+}
+
+// add/sub/mul: int op int in 32 bits while it does not overflow, else doubles.
+// intOp is ALU_ADD, ALU_SUB or 0xAF (imul)
+static void arithmetic(Assembler* as, uint8_t sseOp, uint8_t intOp, int offset) {
+    int slow[2];
+    loadOperands(as);
+    jumpUnlessInts(as, slow);
+    alu32(as, 0x89, RDX, RAX);
+    if (intOp == 0xAF) {
+        imul32(as, RDX, RCX);
+    } else {
+        alu32(as, intOp, RDX, RCX);
+    }
+    int overflow = jumpIf(as, CC_O);
+    tagInt(as, RDX);
+    store(as, R_TOP, -16, RDX);
+    int done = jump(as);
+
+    patchHere(as, slow[0]);
+    patchHere(as, slow[1]);
+    patchHere(as, overflow);
+    numberOperands(as, offset);
+    sse(as, 0xF2, sseOp, XMM0, XMM1);
+    fromXmm(as, RAX, XMM0);
+    store(as, R_TOP, -16, RAX);
+    patchHere(as, done);
+    dropValues(as, 1);
+}
+
+// a < b etc. on numbers: signed compare for ints, else ucomisd (operands
+// in ucomisd order)
+static void comparison(Assembler* as, bool swap, int cc, int intCc, int offset) {
+    int slow[2];
+    loadOperands(as);
+    jumpUnlessInts(as, slow);
+    alu32(as, ALU_CMP, RAX, RCX);
+    boolFromFlags(as, intCc);
+    int done = jump(as);
+
+    patchHere(as, slow[0]);
+    patchHere(as, slow[1]);
+    numberOperands(as, offset);
+    if (swap) {
+        sse(as, 0x66, 0x2E, XMM1, XMM0);
+    } else {
+        sse(as, 0x66, 0x2E, XMM0, XMM1);
+    }
+    boolFromFlags(as, cc);
+    patchHere(as, done);
+    store(as, R_TOP, -16, RAX);
+    dropValues(as, 1);
+}
+
+// 'xmm' = the constant as a double; clobbers rcx
+static void constantToXmm(Assembler* as, int xmm, Value constant) {
+    loadImm(as, RCX, NUMBER_VAL(AS_NUMBER(constant)));
+    toXmm(as, xmm, RCX);
+}
+
+// local/global += constant; the slot's address is base + disp
+static void increment(Assembler* as, int base, int32_t disp, int constant, int offset) {
+    Value k = as->chunk->constants.values[constant];
+    if (!IS_NUMBER(k)) {
+        exitTo(as, -1, offset);
+        return;
+    }
+    load(as, RAX, base, disp);
+    int slow = -1, overflow = -1, done = -1;
+    if (IS_INT(k)) {
+        slow = jumpUnlessInt(as, RAX);
+        alu32(as, 0x89, RDX, RAX);
+        aluImm32(as, IMM_ADD, RDX, AS_INT(k));
+        overflow = jumpIf(as, CC_O);
+        tagInt(as, RDX);
+        store(as, base, disp, RDX);
+        done = jump(as);
+        patchHere(as, slow);
+        patchHere(as, overflow);
+    }
+    toDouble(as, XMM0, RAX, offset);
+    constantToXmm(as, XMM1, k);
+    sse(as, 0xF2, 0x58, XMM0, XMM1);
+    fromXmm(as, RAX, XMM0);
+    store(as, base, disp, RAX);
+    if (done >= 0) patchHere(as, done);
+}
+
+// Jump to 'target' unless xmm0 < xmm1 (unordered counts as not less)
+static void jumpUnlessLess(Assembler* as, int target) {
+    sse(as, 0x66, 0x2E, XMM1, XMM0);
+    jumpTo(as, CC_BE, target);
+}
+
+// Jump to 'target' unless rax < rcx; 'drop' values are popped first
+static void lessJump(Assembler* as, int drop, int target, int offset) {
+    int slow[2];
+    jumpUnlessInts(as, slow);
+    if (drop > 0) dropValues(as, drop);
+    alu32(as, ALU_CMP, RAX, RCX);
+    jumpTo(as, CC_GE, target);
+    int done = jump(as);
+
+    patchHere(as, slow[0]);
+    patchHere(as, slow[1]);
+    numberOperands(as, offset);
+    if (drop > 0) dropValues(as, drop);
+    jumpUnlessLess(as, target);
+    patchHere(as, done);
+}
+
+static void upvalueAddress(Assembler* as, int dst, int index) {
+    load(as, dst, R_FRAME, offsetof(CallFrame, closure));
+    load(as, dst, dst, (int32_t)(offsetof(ObjClosure, upvalues) + sizeof(ObjUpvalue*) * index));
+    load(as, dst, dst, offsetof(ObjUpvalue, location));
+}
+
+static void instruction(Assembler* as, int offset) {
+    Chunk* chunk = as->chunk;
+    uint8_t* code = chunk->code;
+    int next = offset + instructionLength(chunk, offset);
+
+    switch (code[offset]) {
+        case OP_CONSTANT:
+            loadConstant(as, RAX, code[offset + 1]);
+            pushValue(as, RAX);
+            break;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            loadImm(as, RAX, code[offset] == OP_NIL ? NIL_VAL
+                           : code[offset] == OP_TRUE ? TRUE_VAL : FALSE_VAL);
+            pushValue(as, RAX);
+            break;
+        case OP_POP:
+            dropValues(as, 1);
+            break;
+
+        case OP_GET_LOCAL:
+            load(as, RAX, R_SLOTS, (int32_t)sizeof(Value) * code[offset + 1]);
+            pushValue(as, RAX);
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+            load(as, RAX, R_TOP, -8);
+            store(as, R_SLOTS, (int32_t)sizeof(Value) * code[offset + 1], RAX);
+            if (code[offset] == OP_SET_LOCAL_POP) dropValues(as, 1);
+            break;
+        case OP_GET_GLOBAL:
+            load(as, RAX, R_GLOBALS, (int32_t)sizeof(Value) * readShort(chunk, offset + 1));
+            loadImm(as, RCX, UNDEFINED_VAL);
+            alu(as, ALU_CMP, RAX, RCX);
+            exitTo(as, CC_E, offset);
+            pushValue(as, RAX);
+            break;
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_POP:
+        case OP_DEFINE_GLOBAL:
+            load(as, RAX, R_TOP, -8);
+            store(as, R_GLOBALS, (int32_t)sizeof(Value) * readShort(chunk, offset + 1), RAX);
+            if (code[offset] != OP_SET_GLOBAL) dropValues(as, 1);
+            break;
+        case OP_GET_UPVALUE:
+            upvalueAddress(as, RCX, code[offset + 1]);
+            load(as, RAX, RCX, 0);
+            pushValue(as, RAX);
+            break;
+        case OP_SET_UPVALUE:
+            load(as, RDI, R_FRAME, offsetof(CallFrame, closure));
+            load(as, RDI, RDI, (int32_t)(offsetof(ObjClosure, upvalues) +
+                                         sizeof(ObjUpvalue*) * code[offset + 1]));
+            load(as, RSI, R_TOP, -8);
+            callAbsolute(as, (JitHelper)jitSetUpvalue);
+            break;
+        case OP_INC_LOCAL:
+            increment(as, R_SLOTS, (int32_t)sizeof(Value) * code[offset + 1],
+                      code[offset + 2], offset);
+            break;
+        case OP_INC_GLOBAL:
+            increment(as, R_GLOBALS, (int32_t)sizeof(Value) * readShort(chunk, offset + 1),
+                      code[offset + 3], offset);
+            break;
+
+        case OP_ADD:
+        case OP_ADD_NUM:       arithmetic(as, 0x58, ALU_ADD, offset); break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:  arithmetic(as, 0x5C, ALU_SUB, offset); break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:  arithmetic(as, 0x59, 0xAF, offset); break;
+        case OP_DIVIDE:
+            loadOperands(as);
+            numberOperands(as, offset);
+            sse(as, 0x66, 0x57, XMM2, XMM2);    // xorpd xmm2, xmm2
+            sse(as, 0x66, 0x2E, XMM1, XMM2);    // division by zero (or NaN): interpret
+            exitTo(as, CC_E, offset);
+            sse(as, 0xF2, 0x5E, XMM0, XMM1);
+            fromXmm(as, RAX, XMM0);
+            store(as, R_TOP, -16, RAX);
+            dropValues(as, 1);
+            break;
+        case OP_MODULO:
+            loadOperands(as);
+            numberOperands(as, offset);
+            callAbsolute(as, (JitHelper)fmod);
+            fromXmm(as, RAX, XMM0);
+            store(as, R_TOP, -16, RAX);
+            dropValues(as, 1);
+            break;
+        case OP_NEGATE: {
+            load(as, RAX, R_TOP, -8);
+            int slow = jumpUnlessInt(as, RAX);
+            alu32(as, 0x89, RDX, RAX);
+            neg32(as, RDX);
+            int overflow = jumpIf(as, CC_O);
+            tagInt(as, RDX);
+            store(as, R_TOP, -8, RDX);
+            int done = jump(as);
+            patchHere(as, slow);
+            patchHere(as, overflow);
+            toDouble(as, XMM0, RAX, offset);
+            fromXmm(as, RAX, XMM0);
+            loadImm(as, RCX, SIGN_BIT);
+            alu(as, ALU_XOR, RAX, RCX);
+            store(as, R_TOP, -8, RAX);
+            patchHere(as, done);
+            break;
+        }
+
+        // ucomisd x, y sets "above" when x > y and never on NaN
+        case OP_LESS:
+        case OP_LESS_NUM:            comparison(as, true, CC_A, CC_L, offset); break;
+        case OP_LESS_EQUAL:
+        case OP_LESS_EQUAL_NUM:      comparison(as, true, CC_AE, CC_LE, offset); break;
+        case OP_GREATER:
+        case OP_GREATER_NUM:         comparison(as, false, CC_A, CC_G, offset); break;
+        case OP_GREATER_EQUAL:
+        case OP_GREATER_EQUAL_NUM:   comparison(as, false, CC_AE, CC_GE, offset); break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            load(as, RDI, R_TOP, -16);
+            load(as, RSI, R_TOP, -8);
+            callAbsolute(as, (JitHelper)valuesEqualValue);
+            if (code[offset] == OP_NOT_EQUAL) {
+                emitBytes(as, (const uint8_t[]){0x34, 0x01}, 2); // xor al, 1
+            }
+            emitBytes(as, (const uint8_t[]){0x0F, 0xB6, 0xC0}, 3); // movzx eax, al
+            loadImm(as, RCX, FALSE_VAL);
+            alu(as, ALU_ADD, RAX, RCX);
+            store(as, R_TOP, -16, RAX);
+            dropValues(as, 1);
+            break;
+        case OP_NOT:
+            load(as, RDI, R_TOP, -8);
+            callAbsolute(as, (JitHelper)isFalseyValue);
+            emitBytes(as, (const uint8_t[]){0x0F, 0xB6, 0xC0}, 3);
+            loadImm(as, RCX, FALSE_VAL);
+            alu(as, ALU_ADD, RAX, RCX);
+            store(as, R_TOP, -8, RAX);
+            break;
+
+        case OP_JUMP:
+            jumpTo(as, -1, next + readShort(chunk, offset + 1));
+            break;
+        case OP_LOOP:
+            if (as->safepoints) {
+                // cmp byte [vm + compactPending], 0: when set in the
+                // script's own frame, let run() take the safepoint
+                rex(as, false, 0, R_VM);
+                emitByte(as, 0x80);
+                modrmMem(as, IMM_CMP, R_VM, offsetof(VM, compactPending));
+                emitByte(as, 0);
+                int idle = jumpIf(as, CC_E);
+                move(as, RAX, R_VM);
+                aluImm(as, IMM_ADD, RAX, offsetof(VM, frames));
+                alu(as, ALU_CMP, R_FRAME, RAX);
+                exitTo(as, CC_E, offset);
+                patchHere(as, idle);
+            }
+            jumpTo(as, -1, next - readShort(chunk, offset + 1));
+            break;
+        case OP_JUMP_IF_FALSE:
+            load(as, RAX, R_TOP, -8);
+            branchIfFalsey(as, next + readShort(chunk, offset + 1));
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            load(as, RAX, R_TOP, -8);
+            dropValues(as, 1);
+            branchIfFalsey(as, next + readShort(chunk, offset + 1));
+            break;
+        case OP_LESS_JUMP:
+            loadOperands(as);
+            lessJump(as, 2, next + readShort(chunk, offset + 1), offset);
+            break;
+        case OP_LESS_CONST_JUMP: {
+            Value k = chunk->constants.values[code[offset + 1]];
+            int target = next + readShort(chunk, offset + 2);
+            if (!IS_NUMBER(k)) {
+                exitTo(as, -1, offset);
+                break;
+            }
+            load(as, RAX, R_TOP, -8);
+            int slow = -1, done = -1;
+            if (IS_INT(k)) {
+                slow = jumpUnlessInt(as, RAX);
+                dropValues(as, 1);
+                aluImm32(as, IMM_CMP, RAX, AS_INT(k));
+                jumpTo(as, CC_GE, target);
+                done = jump(as);
+                patchHere(as, slow);
+            }
+            toDouble(as, XMM0, RAX, offset);
+            constantToXmm(as, XMM1, k);
+            dropValues(as, 1);
+            jumpUnlessLess(as, target);
+            if (done >= 0) patchHere(as, done);
+            break;
+        }
+        case OP_LESS_LOCALS_JUMP:
+            load(as, RAX, R_SLOTS, (int32_t)sizeof(Value) * code[offset + 1]);
+            load(as, RCX, R_SLOTS, (int32_t)sizeof(Value) * code[offset + 2]);
+            lessJump(as, 0, next + readShort(chunk, offset + 3), offset);
+            break;
+        case OP_FOR_ITER:
+            move(as, RDI, R_SLOTS);
+            aluImm(as, IMM_ADD, RDI, (int32_t)sizeof(Value) * code[offset + 1]);
+            callAbsolute(as, (JitHelper)jitForIter);
+            emitBytes(as, (const uint8_t[]){0x83, 0xF8, 0x01}, 3); // cmp eax, 1
+            jumpTo(as, CC_E, next + readShort(chunk, offset + 2));
+            emitBytes(as, (const uint8_t[]){0x85, 0xC0}, 2);       // test eax, eax
+            exitTo(as, CC_NE, offset);
+            break;
+
+        case OP_INDEX_GET:
+        case OP_INDEX_SET:
+            move(as, RDI, R_TOP);
+            callAbsolute(as, code[offset] == OP_INDEX_GET ? (JitHelper)jitIndexGet
+                                                         : (JitHelper)jitIndexSet);
+            emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2);       // test al, al
+            exitTo(as, CC_E, offset);
+            dropValues(as, code[offset] == OP_INDEX_GET ? 1 : 2);
+            break;
+
+        case OP_CALL:
+            syncState(as, next);
+            move(as, RDI, R_VM);
+            loadImm32(as, RSI, code[offset + 1]);
+            callAbsolute(as, (JitHelper)vmJitCall);
+            load(as, R_TOP, R_VM, offsetof(VM, stackTop));
+            load(as, R_GLOBALS, R_VM, offsetof(VM, globalValues));
+            emitBytes(as, (const uint8_t[]){0x85, 0xC0}, 2);       // test eax, eax
+            {
+                int at = jumpIf(as, CC_NE);
+                patch32(as, at, as->epilogue - (at + 4));
+            }
+            break;
+
+        case OP_RETURN:
+            syncState(as, offset);
+            returnStatus(as, JIT_RETURN);
+            break;
+
+        default:
+            // Calls that reuse frames, closures, maps, properties, handlers,
+            // intrinsics, ...: the interpreter runs these
+            exitTo(as, -1, offset);
+            break;
+    }
+}
+
+// ---- Compilation ----
+
+static void prologue(Assembler* as) {
+    push(as, RBX);
+    push(as, RBP);
+    push(as, R12);
+    push(as, R13);
+    push(as, R14);
+    push(as, R15);
+    aluImm(as, IMM_SUB, RSP, 8);   // keep rsp 16-byte aligned for helper calls
+
+    move(as, R_VM, RDI);
+    move(as, R_FRAME, RSI);
+    load(as, R_SLOTS, RSI, offsetof(CallFrame, slots));
+    load(as, R_TOP, RDI, offsetof(VM, stackTop));
+    load(as, R_GLOBALS, RDI, offsetof(VM, globalValues));
+    loadImm(as, R_QNAN, QNAN);
+    emitBytes(as, (const uint8_t[]){0xFF, 0xE2}, 2);   // jmp rdx
+
+    as->epilogue = as->count;
+    aluImm(as, IMM_ADD, RSP, 8);
+    pop(as, R15);
+    pop(as, R14);
+    pop(as, R13);
+    pop(as, R12);
+    pop(as, RBP);
+    pop(as, RBX);
+    emitByte(as, 0xC3);            // ret
+}
+
+static void freeAssembler(Assembler* as) {
+    free(as->code);
+    free(as->stubs);
+    free(as->jumps);
+    free(as->exits);
+}
+
+bool jitCompile(VM* vm, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+
+    // 'on failure' handlers unwind frames in run(); keep those functions
+    // interpreted so a raised error always finds its handler
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] == OP_PUSH_HANDLER) return false;
+    }
+
+    Assembler as;
+    memset(&as, 0, sizeof(as));
+    as.chunk = chunk;
+    // Only top-level code (no name) can run in the script's frame
+    as.safepoints = vm->gcCompact && function->name == NULL;
+    as.entries = malloc(sizeof(int32_t) * (chunk->count + 1));
+    as.stubs = malloc(sizeof(int32_t) * (chunk->count + 1));
+    if (as.entries == NULL || as.stubs == NULL) {
+        free(as.entries);
+        freeAssembler(&as);
+        return false;
+    }
+    for (int i = 0; i <= chunk->count; i++) {
+        as.entries[i] = -1;
+        as.stubs[i] = -1;
+    }
+
+    prologue(&as);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        as.entries[offset] = as.count;
+        instruction(&as, offset);
+    }
+    as.entries[chunk->count] = as.count;
+    exitTo(&as, -1, chunk->count); // never reached: chunks end in OP_RETURN
+
+    for (int i = 0; i < as.exitCount && !as.failed; i++) {
+        int offset = as.exits[i].target;
+        if (as.stubs[offset] < 0) {
+            as.stubs[offset] = as.count;
+            syncState(&as, offset);
+            returnStatus(&as, JIT_EXIT);
+        }
+        patch32(&as, as.exits[i].at, as.stubs[offset] - (as.exits[i].at + 4));
+    }
+    for (int i = 0; i < as.jumpCount && !as.failed; i++) {
+        int32_t target = as.entries[as.jumps[i].target];
+        patch32(&as, as.jumps[i].at, target - (as.jumps[i].at + 4));
+    }
+
+    if (as.failed) {
+        free(as.entries);
+        freeAssembler(&as);
+        return false;
+    }
+
+    uint8_t* memory = mmap(NULL, as.count, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    JitCode* jit = malloc(sizeof(JitCode));
+    if (memory == MAP_FAILED || jit == NULL) {
+        if (memory != MAP_FAILED) munmap(memory, as.count);
+        free(jit);
+        free(as.entries);
+        freeAssembler(&as);
+        return false;
+    }
+    memcpy(memory, as.code, as.count);
+    mprotect(memory, as.count, PROT_READ | PROT_EXEC);
+
+    jit->code = memory;
+    jit->size = as.count;
+    jit->entries = as.entries;
+    function->jitCode = jit;
+    freeAssembler(&as);
+    return true;
+}
+
+typedef JitStatus (*JitFunction)(VM* vm, CallFrame* frame, uint8_t* entry);
+
+JitStatus jitEnter(VM* vm, CallFrame* frame, int offset) {
+    JitCode* jit = frame->closure->function->jitCode;
+    JitFunction function = (JitFunction)(uintptr_t)jit->code;
+    return function(vm, frame, jit->code + jit->entries[offset]);
+}
+
+void jitFree(JitCode* jit) {
+    munmap(jit->code, jit->size);
+    free(jit->entries);
+    free(jit);
+}
+
+#else
+
+bool jitCompile(VM* vm, ObjFunction* function) {
+    (void)vm;
+    (void)function;
+    return false;
+}
+
+JitStatus jitEnter(VM* vm, CallFrame* frame, int offset) {
+    (void)vm;
+    (void)frame;
+    (void)offset;
+    return JIT_EXIT;
+}
+
+void jitFree(JitCode* jit) {
+    (void)jit;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef glipt_jit_h
+#define glipt_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// Baseline template JIT (run --jit). A function whose call and loop
+// back-edge count reaches JIT_THRESHOLD is translated opcode by opcode into
+// x86-64 machine code. The code works directly on the VM value stack, so at
+// every instruction boundary the frame looks exactly as the interpreter
+// would leave it: a guard that fails (non-number operand, unsupported
+// opcode, ...) stores ip and stackTop and hands the frame back to run().
+
+#if defined(__x86_64__) && defined(__linux__)
+#define GLIPT_JIT
+#endif
+
+#define JIT_THRESHOLD 1000
+
+typedef enum {
+    JIT_CONTINUE,   // (helpers only) keep running machine code
+    JIT_EXIT,       // interpret on from frame->ip
+    JIT_RETURN,     // frame->ip is at OP_RETURN, result on top of the stack
+    JIT_ERROR,      // a runtime error has been reported
+} JitStatus;
+
+typedef struct JitCode {
+    uint8_t* code;      // mmap'd, read + execute
+    size_t size;
+    int32_t* entries;   // bytecode offset -> machine code offset, -1 mid-instruction
+} JitCode;
+
+// Compile 'function' and attach it as function->jitCode; false if the
+// function cannot be compiled (e.g. it installs 'on failure' handlers)
+bool jitCompile(VM* vm, ObjFunction* function);
+
+// Run the top frame's machine code from bytecode 'offset' (an instruction
+// boundary); frame->ip and the stack must be current
+JitStatus jitEnter(VM* vm, CallFrame* frame, int offset);
+
+void jitFree(JitCode* jit);
+
+// OP_CALL from machine code (vm.c): runs the callee to completion
+JitStatus vmJitCall(VM* vm, int argCount);
+
+#endif
@@ -11,6 +11,7 @@
 #include "debug.h"
 #include "version.h"
 #include "process.h"
+#include "jit.h"
 
 #include <time.h>
 
@@ -152,14 +153,38 @@ static void runRepl(void) {
     freeVM(&vm);
 }
 
+// A byte count with an optional k, m or g suffix ("64m"); 0 if malformed
+static size_t parseSize(const char* text) {
+    char* end;
+    double value = strtod(text, &end);
+    double scale = 1;
+    switch (*end) {
+        case 'k': case 'K': scale = 1024.0; end++; break;
+        case 'm': case 'M': scale = 1024.0 * 1024; end++; break;
+        case 'g': case 'G': scale = 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (end == text || *end != '\0' || value <= 0) return 0;
+    return (size_t)(value * scale);
+}
+
 static void printUsage(void) {
     printf("Usage: glipt <command> [options]\n\n");
     printf("Commands:\n");
     printf("  run <script>       Run a .glipt script\n");
     printf("  run --allow-all    Run with all permissions granted\n");
+    printf("  run --vm=register  Run functions on the register interpreter\n");
+    printf("  run --jit          Compile hot functions and loops to machine code\n");
+    printf("  run --gc-pause-us=N  Limit each GC slice to N microseconds (0: stop the world)\n");
+    printf("  run --gc-threads=N Mark with N threads in full collections\n");
+    printf("  run --gc-compact   Release sparse heap pages by moving their objects\n");
+    printf("  run --gc-initial=SIZE  Heap size of the first full collection (default 1m)\n");
+    printf("  run --gc-growth=F  Collect again when the heap has grown F times (default 2)\n");
+    printf("  run --gc-max-heap=SIZE  Raise an error when the heap outgrows SIZE\n");
+    printf("  run --gc-stats     Print GC pause times on exit\n");
     printf("  repl               Interactive REPL\n");
     printf("  check <script>     Syntax check only\n");
-    printf("  disasm <script>    Show bytecode disassembly\n");
+    printf("  disasm <script>    Show bytecode disassembly (--vm=register: register code)\n");
     printf("  ast <script>       Show AST (debug)\n");
     printf("  tokens <script>    Show token stream (debug)\n");
     printf("  update             Check for updates\n");
@@ -172,6 +197,22 @@ static void printVersion(void) {
     printf("Glue + Script - Process Orchestration Language\n");
 }
 
+// Register code of every function nested in 'function' (disasm --vm=register)
+static void disassembleRegisterCode(ObjFunction* function) {
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (!IS_FUNCTION(constants->values[i])) continue;
+        ObjFunction* inner = AS_FUNCTION(constants->values[i]);
+        const char* name = inner->name != NULL ? inner->name->chars : "<fn>";
+        if (inner->regChunk != NULL) {
+            disassembleRegChunk(inner->regChunk, &inner->chunk, name);
+        } else {
+            printf("== %s (stack code) ==\n", name);
+        }
+        disassembleRegisterCode(inner);
+    }
+}
+
 // ---- Update Checker ----
 
 // Simple semver compare: returns >0 if a > b, 0 if equal, <0 if a < b
@@ -369,12 +410,16 @@ int main(int argc, char* argv[]) {
             fprintf(stderr, "Error: 'disasm' command requires a script path.\n");
             return 1;
         }
+        bool registerMode = argc > 3 && strcmp(argv[3], "--vm=register") == 0;
         char* source = readFile(argv[2]);
         if (source == NULL) return 1;
         VM vm;
         initVM(&vm);
+        vm.registerMode = registerMode;
         ObjFunction* fn = compile(&vm, source);
-        if (fn != NULL) {
+        if (fn != NULL && registerMode) {
+            disassembleRegisterCode(fn);
+        } else if (fn != NULL) {
             disassembleChunk(&fn->chunk, "<script>");
         } else {
             fprintf(stderr, "Compilation failed.\n");
@@ -392,11 +437,54 @@ int main(int argc, char* argv[]) {
 
         // Parse flags
         bool allowAll = false;
+        bool registerMode = false;
+        bool jit = false;
+        bool gcStats = false;
+        bool gcCompact = false;
+        size_t gcInitial = GC_DEFAULT_INITIAL;
+        double gcGrowth = GC_DEFAULT_GROWTH;
+        size_t gcMaxHeap = 0;
+        int gcPauseUs = GC_DEFAULT_PAUSE_US;
+        int gcThreads = 1;
         const char* scriptPath = NULL;
         int scriptArgStart = -1;
         for (int i = 2; i < argc; i++) {
             if (strcmp(argv[i], "--allow-all") == 0) {
                 allowAll = true;
+            } else if (scriptPath == NULL && strcmp(argv[i], "--vm=register") == 0) {
+                registerMode = true;
+            } else if (scriptPath == NULL && strcmp(argv[i], "--vm=stack") == 0) {
+                registerMode = false;
+            } else if (scriptPath == NULL && strcmp(argv[i], "--jit") == 0) {
+                jit = true;
+            } else if (scriptPath == NULL && strncmp(argv[i], "--gc-pause-us=", 14) == 0) {
+                gcPauseUs = atoi(argv[i] + 14);
+            } else if (scriptPath == NULL && strncmp(argv[i], "--gc-threads=", 13) == 0) {
+                gcThreads = atoi(argv[i] + 13);
+                if (gcThreads < 1) gcThreads = 1;
+                if (gcThreads > GC_MAX_THREADS) gcThreads = GC_MAX_THREADS;
+            } else if (scriptPath == NULL && strcmp(argv[i], "--gc-compact") == 0) {
+                gcCompact = true;
+            } else if (scriptPath == NULL && strncmp(argv[i], "--gc-initial=", 13) == 0) {
+                gcInitial = parseSize(argv[i] + 13);
+                if (gcInitial == 0) {
+                    fprintf(stderr, "Error: --gc-initial needs a size, like 4m.\n");
+                    return 1;
+                }
+            } else if (scriptPath == NULL && strncmp(argv[i], "--gc-growth=", 12) == 0) {
+                gcGrowth = atof(argv[i] + 12);
+                if (!(gcGrowth > 1)) {
+                    fprintf(stderr, "Error: --gc-growth must be greater than 1.\n");
+                    return 1;
+                }
+            } else if (scriptPath == NULL && strncmp(argv[i], "--gc-max-heap=", 14) == 0) {
+                gcMaxHeap = parseSize(argv[i] + 14);
+                if (gcMaxHeap == 0) {
+                    fprintf(stderr, "Error: --gc-max-heap needs a size, like 64m.\n");
+                    return 1;
+                }
+            } else if (scriptPath == NULL && strcmp(argv[i], "--gc-stats") == 0) {
+                gcStats = true;
             } else if (scriptPath == NULL) {
                 scriptPath = argv[i];
                 scriptArgStart = i + 1;
@@ -412,6 +500,19 @@ int main(int argc, char* argv[]) {
         VM vm;
         initVM(&vm);
         vm.scriptPath = scriptPath;
+        vm.registerMode = registerMode;
+        vm.jitEnabled = jit;
+        vm.gcPauseUs = gcPauseUs;
+        vm.gcThreads = gcThreads;
+        vm.gcCompact = gcCompact;
+        vm.nextGC = gcInitial;
+        vm.gcGrowth = gcGrowth;
+        vm.maxHeap = gcMaxHeap;
+#ifndef GLIPT_JIT
+        if (jit) {
+            fprintf(stderr, "Warning: --jit is only supported on x86-64 Linux; interpreting.\n");
+        }
+#endif
         if (allowAll) {
             vm.permissions.allowAll = true;
         }
@@ -423,6 +524,7 @@ int main(int argc, char* argv[]) {
         autoCheckInBackground();
 #endif
         InterpretResult result = interpret(&vm, source);
+        if (gcStats) printGCStats(&vm);
         freeVM(&vm);
         free(source);
         switch (result) {
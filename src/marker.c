@@ -0,0 +1,250 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "marker.h"
+#include "vm.h"
+
+_Thread_local GCWorker* currentMarker = NULL;
+
+// ---- Gray deques ----
+//
+// The Chase-Lev deque with the C11 orderings of Le et al. (PPoPP '13).
+// top only grows; the owner moves bottom. A buffer that fills up is
+// replaced by one twice its size, but a thief may still be reading the old
+// one, so it is kept until grayTrim.
+
+#define GRAY_INITIAL_CAPACITY 256
+
+static GrayBuffer* newGrayBuffer(int64_t capacity) {
+    GrayBuffer* buffer = (GrayBuffer*)malloc(sizeof(GrayBuffer) +
+                                             sizeof(Obj*) * (size_t)capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: Out of memory (gray stack).\n");
+        exit(1);
+    }
+    buffer->mask = capacity - 1;
+    buffer->retired = NULL;
+    return buffer;
+}
+
+static GrayBuffer* growGrayBuffer(GrayDeque* deque, GrayBuffer* buffer,
+                                  int64_t top, int64_t bottom) {
+    GrayBuffer* bigger = newGrayBuffer((buffer->mask + 1) * 2);
+    for (int64_t i = top; i < bottom; i++) {
+        bigger->items[i & bigger->mask] = buffer->items[i & buffer->mask];
+    }
+    bigger->retired = buffer;
+    __atomic_store_n(&deque->buffer, bigger, __ATOMIC_RELEASE);
+    return bigger;
+}
+
+void grayPush(GrayDeque* deque, Obj* object) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    GrayBuffer* buffer = deque->buffer;
+    if (buffer == NULL) {
+        buffer = newGrayBuffer(GRAY_INITIAL_CAPACITY);
+        __atomic_store_n(&deque->buffer, buffer, __ATOMIC_RELEASE);
+    } else if (bottom - top > buffer->mask) {
+        buffer = growGrayBuffer(deque, buffer, top, bottom);
+    }
+    __atomic_store_n(&buffer->items[bottom & buffer->mask], object, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+Obj* grayPop(GrayDeque* deque, bool shared) {
+    if (!shared) {
+        if (deque->bottom == deque->top) return NULL;
+        deque->bottom--;
+        return deque->buffer->items[deque->bottom & deque->buffer->mask];
+    }
+
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    GrayBuffer* buffer = deque->buffer;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    Obj* object = NULL;
+    if (top <= bottom) {
+        object = __atomic_load_n(&buffer->items[bottom & buffer->mask], __ATOMIC_RELAXED);
+        if (top == bottom) {
+            // The last item: race the thieves for it
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                object = NULL;
+            }
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return object;
+}
+
+Obj* graySteal(GrayDeque* deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) return NULL;
+
+    GrayBuffer* buffer = __atomic_load_n(&deque->buffer, __ATOMIC_ACQUIRE);
+    Obj* object = __atomic_load_n(&buffer->items[top & buffer->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return object;
+}
+
+bool grayIsEmpty(GrayDeque* deque) {
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) >=
+           __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+void grayTrim(GrayDeque* deque) {
+    if (deque->buffer == NULL) return;
+    GrayBuffer* retired = deque->buffer->retired;
+    deque->buffer->retired = NULL;
+    while (retired != NULL) {
+        GrayBuffer* next = retired->retired;
+        free(retired);
+        retired = next;
+    }
+}
+
+void freeGrayDeque(GrayDeque* deque) {
+    grayTrim(deque);
+    free(deque->buffer);
+    deque->buffer = NULL;
+    deque->top = 0;
+    deque->bottom = 0;
+}
+
+// ---- Marker threads ----
+
+typedef struct MarkerPool {
+    VM* vm;
+    pthread_t threads[GC_MAX_THREADS];
+    int threadCount;            // markers 1 .. threadCount are running
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // a new run, or quit
+    pthread_cond_t done;        // the last helper of a run finished
+    uint64_t run;               // runs started so far
+    int count;                  // markers taking part in the current run
+    int busy;                   // helpers still working on it
+    void (*task)(GCWorker* worker);
+    bool quit;
+} MarkerPool;
+
+typedef struct {
+    MarkerPool* pool;
+    int index;
+    uint64_t run;               // the last run before this thread started
+} MarkerStart;
+
+static void* markerMain(void* arg) {
+    MarkerStart* start = (MarkerStart*)arg;
+    MarkerPool* pool = start->pool;
+    int index = start->index;
+    uint64_t seen = start->run;
+    free(start);
+
+    GCWorker* worker = &pool->vm->gcWorkers[index];
+    currentMarker = worker;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->run == seen && !pool->quit) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->quit) break;
+        seen = pool->run;
+        if (index >= pool->count) continue;
+
+        void (*task)(GCWorker*) = pool->task;
+        pthread_mutex_unlock(&pool->lock);
+        task(worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static MarkerPool* markerPool(VM* vm) {
+    if (vm->markerPool == NULL) {
+        MarkerPool* pool = (MarkerPool*)calloc(1, sizeof(MarkerPool));
+        if (pool == NULL) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        pool->vm = vm;
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->wake, NULL);
+        pthread_cond_init(&pool->done, NULL);
+        vm->markerPool = pool;
+    }
+    return vm->markerPool;
+}
+
+int readyMarkers(VM* vm, int count) {
+    MarkerPool* pool = markerPool(vm);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->threadCount < count - 1) {
+        MarkerStart* start = (MarkerStart*)malloc(sizeof(MarkerStart));
+        if (start == NULL) break;
+        start->pool = pool;
+        start->index = pool->threadCount + 1;
+        start->run = pool->run;
+        if (pthread_create(&pool->threads[pool->threadCount], NULL,
+                           markerMain, start) != 0) {
+            free(start);
+            break;
+        }
+        pool->threadCount++;
+    }
+    if (count > pool->threadCount + 1) count = pool->threadCount + 1;
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+void runMarkers(VM* vm, int count, void (*task)(GCWorker* worker)) {
+    MarkerPool* pool = markerPool(vm);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->count = count;
+    pool->busy = count - 1;
+    pool->task = task;
+    pool->run++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(&vm->gcWorkers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void stopMarkers(VM* vm) {
+    MarkerPool* pool = vm->markerPool;
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+    vm->markerPool = NULL;
+}
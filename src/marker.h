@@ -0,0 +1,58 @@
+#ifndef glipt_marker_h
+#define glipt_marker_h
+
+#include "common.h"
+#include "value.h"
+
+typedef struct VM VM;
+
+// Parallel marking (run --gc-threads=N). Every marker owns a gray deque:
+// it pushes and pops at the bottom, and markers that run dry steal from
+// the top of the others' (a Chase-Lev work-stealing deque). Marker 0 is
+// the VM thread itself; the others are worker threads started on first
+// use. Between runs only the VM thread touches the deques.
+
+#define GC_MAX_THREADS 64
+
+typedef struct GrayBuffer {
+    int64_t mask;               // capacity - 1 (a power of two)
+    struct GrayBuffer* retired; // the smaller buffer this one replaced
+    Obj* items[];
+} GrayBuffer;
+
+typedef struct {
+    int64_t top;                // thieves take from here
+    int64_t bottom;             // the owner pushes and pops here
+    GrayBuffer* buffer;
+} GrayDeque;
+
+typedef struct {
+    _Alignas(64) GrayDeque gray;
+    Obj* scanList;              // a long list being scanned in chunks (see memory.c)
+    int scanIndex;              // next item of scanList to mark
+    uint32_t seed;              // picks the victims to steal from
+} GCWorker;
+
+// The marker running on this thread
+extern _Thread_local GCWorker* currentMarker;
+
+void grayPush(GrayDeque* deque, Obj* object);
+// Owner side; 'shared' while other markers may be stealing. NULL when empty.
+Obj* grayPop(GrayDeque* deque, bool shared);
+// NULL when empty or when another thread won the race for the item
+Obj* graySteal(GrayDeque* deque);
+bool grayIsEmpty(GrayDeque* deque);
+// Free the buffers replaced while markers were stealing
+void grayTrim(GrayDeque* deque);
+void freeGrayDeque(GrayDeque* deque);
+
+// Start worker threads for up to 'count' markers; returns how many there
+// are (fewer if a thread could not be created)
+int readyMarkers(VM* vm, int count);
+// Run 'task' on markers 0 .. count - 1 at once, marker 0 on the calling
+// thread, and return when all of them have
+void runMarkers(VM* vm, int count, void (*task)(GCWorker* worker));
+// Stop the worker threads (freeVM)
+void stopMarkers(VM* vm);
+
+#endif
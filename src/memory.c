@@ -1,33 +1,194 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "memory.h"
 #include "object.h"
+#include "compiler.h"
 #include "vm.h"
 
+// ---- Generations ----
+//
+// New objects are young: their bit is set in their page's young bitmap,
+// and the page is listed in heap.youngPages (large objects go on
+// heap.youngLarge). A minor collection (collectYoung) marks from the roots
+// but stops at old objects, frees the dead young objects and promotes the
+// rest. Old objects that were written to since the last collection may be
+// the only path to a young one: the write barrier records them in
+// vm->remembered, and a minor collection traces them like roots.
+//
+// ---- Incremental full collections ----
+//
+// When the heap has grown by a factor of vm->gcGrowth (2 unless run
+// --gc-growth=F), a full collection starts: it marks the roots and then
+// traces the gray stack in slices of at most vm->gcPauseUs microseconds,
+// one per GC_SLICE_BYTES allocated, while the program keeps running.
+// Stores into an object already marked shade the stored value
+// (incremental update, see writeBarrier), and the roots are marked again
+// before the sweep, so nothing reachable is left white. The sweep is
+// sliced the same way; a list longer than GC_LIST_CHUNK is scanned a
+// chunk per step, so one huge list cannot blow the budget. Minor
+// collections wait while marking, but run during the sweep.
+//
+// Mark bits sit in the page bitmaps and are cleared page by page when a
+// cycle starts. The sweep goes page by page, and allocation sweeps a page
+// itself before taking a slot from it if the sweep has not got there yet.
+// Until its page is swept, every old object that is still white is
+// garbage: promoted objects stay marked, and a dead string that the
+// intern table hands out again is revived rather than freed.
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #ifdef DEBUG_STRESS_GC
 #include <stdio.h>
 #endif
 
+bool gcMarking = false;
+
 // Global VM pointer for GC access during allocation
 // (set by the VM when it starts running)
 static VM* currentVM = NULL;
 
+// Set while collectYoung runs: marking stops at old objects
+static bool markingYoung = false;
+
+// Set while several markers run: mark bits are then set atomically
+static bool markingInParallel = false;
+
 void setCurrentVM(VM* vm) {
     currentVM = vm;
+    currentMarker = vm != NULL ? &vm->gcWorkers[0] : NULL;
 }
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    if (currentVM != NULL) {
-        currentVM->bytesAllocated += newSize - oldSize;
+VM* getCurrentVM(void) {
+    return currentVM;
+}
 
-#ifdef DEBUG_STRESS_GC
-        if (newSize > oldSize) {
-            collectGarbage(currentVM);
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void recordPause(VM* vm, uint64_t start) {
+    uint64_t ns = nowNs() - start;
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us > 0 && bucket < GC_PAUSE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    vm->gcStats.pauses[bucket]++;
+    vm->gcStats.totalPauseNs += ns;
+    if (ns > vm->gcStats.maxPauseNs) vm->gcStats.maxPauseNs = ns;
+}
+
+static void startCollection(VM* vm);
+static bool traceUntil(VM* vm, uint64_t deadline);
+static void collectSlice(VM* vm, uint64_t start);
+
+// Over --gc-max-heap: collect everything, and if the heap is still too
+// big, raise an error the script can catch. The allocation itself goes
+// ahead so the handler has something to run with. The handler is expected
+// to drop what it can: if the heap is still over the limit the next time,
+// it would only raise into the same handler again, so that is fatal.
+// Building the error interns strings, so it waits while the intern table
+// is being resized.
+static void heapLimitReached(VM* vm) {
+    if (vm->hasError || vm->raisingHeapLimit || tableResizing(&vm->strings)) return;
+    uint64_t start = nowNs();
+    collectGarbage(vm);
+    recordPause(vm, start);
+    if (vm->bytesAllocated <= vm->maxHeap) {
+        vm->heapLimitRaised = false;
+        return;
+    }
+    if (vm->heapLimitRaised) {
+        fprintf(stderr, "Error: Out of memory: heap limit of %zu bytes exceeded "
+                "while handling the heap limit error.\n", vm->maxHeap);
+        exit(1);
+    }
+
+    char message[96];
+    snprintf(message, sizeof(message), "Out of memory: heap limit of %zu bytes exceeded",
+             vm->maxHeap);
+    vm->heapLimitRaised = true;
+    vm->raisingHeapLimit = true;
+    vmRaiseError(vm, message, "memory");
+    vm->raisingHeapLimit = false;
+}
+
+static void collectIfNeeded(VM* vm, size_t size) {
+    if (vm->shrinkingStrings) return;
+    if (vm->maxHeap > 0 && vm->bytesAllocated > vm->maxHeap) {
+        heapLimitReached(vm);
+        return;
+    }
+    if (vm->gcPhase != GC_IDLE) {
+        vm->gcDebt += size;
+        if (vm->gcDebt >= GC_SLICE_BYTES) {
+            vm->gcDebt = 0;
+            uint64_t start = nowNs();
+            collectSlice(vm, start);
+            recordPause(vm, start);
+            return;
         }
+        if (vm->gcPhase == GC_MARK) return;
+    }
+
+#ifdef DEBUG_STRESS_GC
+    if (vm->gcPhase != GC_MARK) collectYoung(vm);
 #endif
+    if (vm->gcPhase == GC_IDLE && vm->bytesAllocated > vm->nextGC) {
+        uint64_t start = nowNs();
+        if (vm->gcPauseUs <= 0) {
+            collectGarbage(vm);
+        } else {
+            startCollection(vm);
+            collectSlice(vm, start);
+        }
+        recordPause(vm, start);
+    } else if (vm->youngBytes > vm->nurserySize) {
+        uint64_t start = nowNs();
+        collectYoung(vm);
+        recordPause(vm, start);
+    }
+}
+
+Obj* allocateObjectMemory(VM* vm, size_t size) {
+    size_t bytes = heapObjectSize(size);
+    vm->bytesAllocated += bytes;
+    vm->youngBytes += bytes;
+    vm->gcStats.totalAllocated += bytes;
+    collectIfNeeded(vm, bytes);
+    return heapAllocate(vm, size);
+}
+
+void freeObjectMemory(Obj* object) {
+    size_t bytes = heapFree(object);
+    if (currentVM != NULL) currentVM->bytesAllocated -= bytes;
+}
+
+static void countAllocation(size_t oldSize, size_t newSize) {
+    if (currentVM != NULL) {
+        currentVM->bytesAllocated += newSize - oldSize;
 
-        if (currentVM->bytesAllocated > currentVM->nextGC && newSize > oldSize) {
-            collectGarbage(currentVM);
+        if (newSize > oldSize) {
+            currentVM->youngBytes += newSize - oldSize;
+            currentVM->gcStats.totalAllocated += newSize - oldSize;
+            collectIfNeeded(currentVM, newSize - oldSize);
         }
     }
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    countAllocation(oldSize, newSize);
 
     if (newSize == 0) {
         free(pointer);
@@ -42,8 +203,50 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+void* allocateZeroed(size_t size) {
+    countAllocation(0, size);
+
+    void* result = calloc(1, size);
+    if (result == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    return result;
+}
+
 // ---- Mark Phase ----
 
+static inline bool isMarked(Obj* object) {
+    if (object->isLarge) return LARGE_HEADER(object)->marked;
+    HeapPage* page = HEAP_PAGE_OF(object);
+    int slot = heapSlotIndex(page, object);
+    return (page->marked[slot / 64] >> (slot % 64)) & 1;
+}
+
+// Set the mark bit; false if it was set already
+static inline bool setMarked(Obj* object) {
+    if (object->isLarge) {
+        LargeObject* large = LARGE_HEADER(object);
+        if (!markingInParallel) {
+            if (large->marked) return false;
+            large->marked = true;
+            return true;
+        }
+        return !__atomic_exchange_n(&large->marked, true, __ATOMIC_RELAXED);
+    }
+    HeapPage* page = HEAP_PAGE_OF(object);
+    int slot = heapSlotIndex(page, object);
+    uint64_t bit = 1ull << (slot % 64);
+    uint64_t* word = &page->marked[slot / 64];
+    if (!markingInParallel) {
+        if (*word & bit) return false;
+        *word |= bit;
+        return true;
+    }
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return false;
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+
 static void markValue(Value value) {
     if (IS_OBJ(value)) markObject(AS_OBJ(value));
 }
@@ -56,7 +259,8 @@ static void markArray(ValueArray* array) {
 
 void markObject(Obj* object) {
     if (object == NULL) return;
-    if (object->isMarked) return;
+    if (markingYoung && object->isOld) return;
+    if (!setMarked(object)) return;
 
 #ifdef DEBUG_TRACE
     printf("  mark %p ", (void*)object);
@@ -64,19 +268,66 @@ void markObject(Obj* object) {
     printf("\n");
 #endif
 
-    object->isMarked = true;
+    grayPush(&currentMarker->gray, object);
+}
 
-    if (currentVM->grayCapacity < currentVM->grayCount + 1) {
-        currentVM->grayCapacity = GROW_CAPACITY(currentVM->grayCapacity);
-        currentVM->grayStack = (Obj**)realloc(currentVM->grayStack,
-            sizeof(Obj*) * currentVM->grayCapacity);
-        if (currentVM->grayStack == NULL) {
-            fprintf(stderr, "Error: Out of memory (gray stack).\n");
+void rememberObject(Obj* object) {
+    VM* vm = currentVM;
+    if (vm == NULL || object->isRemembered) return;
+    object->isRemembered = true;
+
+    if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+        vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+        vm->remembered = (Obj**)realloc(vm->remembered,
+            sizeof(Obj*) * vm->rememberedCapacity);
+        if (vm->remembered == NULL) {
+            fprintf(stderr, "Error: Out of memory (remembered set).\n");
             exit(1);
         }
     }
+    vm->remembered[vm->rememberedCount++] = object;
+}
+
+// Incremental update: while marking, a marked object must not gain an
+// unmarked reference the tracer would never see, so the value is shaded
+void writeBarrier(Obj* owner, Obj* value) {
+    if (currentVM == NULL) return;
+    if (gcMarking && isMarked(owner)) markObject(value);
+    if (owner->isOld && !value->isOld) rememberObject(owner);
+}
+
+void listWriteBarrier(ObjList* list, int index, Obj* value) {
+    if (currentVM == NULL) return;
+    if (gcMarking && isMarked(&list->obj)) markObject(value);
+    if (list->obj.isOld && !value->isOld) rememberListRange(list, index, index);
+}
+
+// Reordering items can carry an unscanned one into the part of the list
+// the tracer has already passed, so the scan starts over
+void listPermuted(ObjList* list) {
+    if (list->obj.isRemembered) rememberListRange(list, 0, list->count - 1);
+    if (currentVM == NULL) return;
+    for (int i = 0; i < currentVM->gcThreads; i++) {
+        GCWorker* worker = &currentVM->gcWorkers[i];
+        if (worker->scanList == (Obj*)list) worker->scanIndex = 0;
+    }
+}
+
+void reviveObject(Obj* object) {
+    if (currentVM != NULL && currentVM->gcPhase == GC_SWEEP && object->isOld) {
+        setMarked(object);
+    }
+}
 
-    currentVM->grayStack[currentVM->grayCount++] = object;
+void rememberListRange(ObjList* list, int low, int high) {
+    if (!list->obj.isRemembered) {
+        rememberObject((Obj*)list);
+        list->dirtyLow = low;
+        list->dirtyHigh = high;
+        return;
+    }
+    if (low < list->dirtyLow) list->dirtyLow = low;
+    if (high > list->dirtyHigh) list->dirtyHigh = high;
 }
 
 static void markRoots(VM* vm) {
@@ -97,13 +348,25 @@ static void markRoots(VM* vm) {
     }
 
     // Mark globals
-    markTable(&vm->globals);
+    for (int i = 0; i < vm->globalCount; i++) {
+        markValue(vm->globalValues[i]);
+    }
+    markTable(&vm->globalSlots);
+    for (int i = 0; i < 256; i++) {
+        if (vm->charStrings[i] != NULL) markObject((Obj*)vm->charStrings[i]);
+    }
 
     // Mark module cache (import system)
     markTable(&vm->modules);
 
-    // Mark compiler roots (if compiling)
-    // (This will be called by the compiler when needed)
+    // Pending error map
+    markValue(vm->currentError);
+
+    // Map shapes hold their keys
+    markShapes(vm);
+
+    // Functions still being compiled
+    markCompilerRoots();
 }
 
 // ---- Trace Phase ----
@@ -142,71 +405,609 @@ static void blackenObject(Obj* object) {
         }
         case OBJ_MAP: {
             ObjMap* map = (ObjMap*)object;
+            if (map->shape != NULL) {
+                for (int i = 0; i < map->shape->count; i++) {
+                    markValue(map->values[i]);
+                }
+            }
             markTable(&map->table);
             break;
         }
+        case OBJ_SET:
+            markTable(&((ObjSet*)object)->table);
+            break;
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_RANGE:
             break;
     }
 }
 
 static void traceReferences(VM* vm) {
-    while (vm->grayCount > 0) {
-        Obj* object = vm->grayStack[--vm->grayCount];
+    Obj* object;
+    while ((object = grayPop(&vm->gcWorkers[0].gray, false)) != NULL) {
         blackenObject(object);
     }
 }
 
 // ---- Sweep Phase ----
 
-static void sweep(VM* vm) {
-    Obj* previous = NULL;
-    Obj* object = vm->objects;
-    while (object != NULL) {
-        if (object->isMarked) {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
-        } else {
-            Obj* unreached = object;
-            object = object->next;
-            if (previous != NULL) {
-                previous->next = object;
-            } else {
-                vm->objects = object;
+static void freeDead(VM* vm, Obj* object) {
+    if (object->type == OBJ_STRING) {
+        tableDelete(&vm->strings, OBJ_VAL(object));
+    }
+    freeObject(object);
+}
+
+// Free the unmarked young objects and promote the rest. Survivors keep
+// their mark: a sweep in progress must not free them, and the next cycle
+// clears the bits anyway.
+static void sweepYoung(VM* vm) {
+    Heap* heap = &vm->heap;
+    for (int i = 0; i < heap->youngPageCount; i++) {
+        HeapPage* page = heap->youngPages[i];
+        page->hasYoung = false;
+        int words = (page->slotCount + 63) / 64;
+        for (int word = 0; word < words; word++) {
+            uint64_t young = page->young[word];
+            if (young == 0) continue;
+            page->young[word] = 0;
+
+            uint64_t live = young & page->marked[word];
+            uint64_t dead = young & ~live;
+            for (; live != 0; live &= live - 1) {
+                heapSlot(page, word * 64 + __builtin_ctzll(live))->isOld = true;
+            }
+            for (; dead != 0; dead &= dead - 1) {
+                freeDead(vm, heapSlot(page, word * 64 + __builtin_ctzll(dead)));
             }
-            freeObject(unreached);
         }
     }
+    heap->youngPageCount = 0;
+
+    LargeObject* large = heap->youngLarge;
+    while (large != NULL) {
+        LargeObject* next = large->next;
+        if (large->marked) {
+            LARGE_OBJECT(large)->isOld = true;
+            large->next = heap->oldLarge;
+            heap->oldLarge = large;
+        } else {
+            freeDead(vm, LARGE_OBJECT(large));
+        }
+        large = next;
+    }
+    heap->youngLarge = NULL;
 }
 
-void collectGarbage(VM* vm) {
+void sweepPage(VM* vm, HeapPage* page) {
+    int words = (page->slotCount + 63) / 64;
+    for (int word = 0; word < words; word++) {
+        uint64_t dead = page->allocated[word] & ~page->marked[word] & ~page->young[word];
+        for (; dead != 0; dead &= dead - 1) {
+            freeDead(vm, heapSlot(page, word * 64 + __builtin_ctzll(dead)));
+        }
+    }
+    page->sweptCycle = vm->heap.cycle;
+}
+
+static void forgetRemembered(VM* vm) {
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        vm->remembered[i]->isRemembered = false;
+    }
+    vm->rememberedCount = 0;
+}
+
+void collectYoung(VM* vm) {
 #ifdef DEBUG_TRACE
-    printf("-- gc begin\n");
+    printf("-- minor gc begin\n");
     size_t before = vm->bytesAllocated;
 #endif
 
+    markingYoung = true;
     markRoots(vm);
+    // Remembered objects are old: trace their fields directly
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        Obj* object = vm->remembered[i];
+        if (object->type == OBJ_LIST) {
+            ObjList* list = (ObjList*)object;
+            int high = list->dirtyHigh < list->count ? list->dirtyHigh : list->count - 1;
+            for (int j = list->dirtyLow; j <= high; j++) {
+                markValue(list->items[j]);
+            }
+        } else {
+            blackenObject(object);
+        }
+    }
     traceReferences(vm);
-    tableRemoveWhite(&vm->strings);
-    sweep(vm);
+    markingYoung = false;
+
+    sweepYoung(vm);
+    forgetRemembered(vm);
+    vm->youngBytes = 0;
+    vm->gcStats.minorCollections++;
+
+#ifdef DEBUG_TRACE
+    printf("-- minor gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu)\n",
+           before - vm->bytesAllocated, before, vm->bytesAllocated);
+#endif
+}
 
-    vm->nextGC = vm->bytesAllocated * 2;
+// ---- Full collections ----
+
+static void startCollection(VM* vm) {
+#ifdef DEBUG_TRACE
+    printf("-- gc begin\n");
+#endif
+    Heap* heap = &vm->heap;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+            memset(page->marked, 0, sizeof(page->marked));
+        }
+    }
+    for (LargeObject* large = heap->oldLarge; large != NULL; large = large->next) {
+        large->marked = false;
+    }
+    for (LargeObject* large = heap->youngLarge; large != NULL; large = large->next) {
+        large->marked = false;
+    }
+
+    vm->gcPhase = GC_MARK;
+    gcMarking = true;
+    vm->gcDebt = 0;
+    markRoots(vm);
+}
+
+// Marking is done: catch up with the roots, free the dead young objects
+// and start sweeping the old ones
+static void finishMarking(VM* vm) {
+    markRoots(vm);
+    traceUntil(vm, UINT64_MAX);
+
+    // Every young survivor is promoted, so nothing needs remembering
+    sweepYoung(vm);
+    forgetRemembered(vm);
+    vm->youngBytes = 0;
+
+    gcMarking = false;
+    vm->gcPhase = GC_SWEEP;
+    vm->heap.cycle++;
+    vm->sweepClass = 0;
+    vm->sweepPageLink = &vm->heap.classes[0].pages;
+    vm->sweepLink = &vm->heap.oldLarge;
+}
+
+static void finishSweeping(VM* vm) {
+    vm->gcPhase = GC_IDLE;
+    vm->sweepPageLink = NULL;
+    vm->sweepLink = NULL;
+    // The sweep deleted the dead strings; give back the room they took
+    vm->shrinkingStrings = true;
+    tableShrink(&vm->strings);
+    vm->shrinkingStrings = false;
+    vm->nextGC = (size_t)((double)vm->bytesAllocated * vm->gcGrowth);
+    vm->gcStats.fullCollections++;
+    if (vm->gcCompact) vm->compactPending = true;
 
 #ifdef DEBUG_TRACE
     printf("-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC);
+    printf("   %zu bytes in use, next at %zu\n", vm->bytesAllocated, vm->nextGC);
+#endif
+}
+
+// How many objects to process between clock reads
+#define GC_CLOCK_STRIDE 64
+
+// Shared by the markers of one traceUntil
+static uint64_t markDeadline;
+static int markerCount;
+static int idleMarkers;
+static bool stopMarking;
+
+// Mark the next chunk of the marker's scanList
+static void scanListChunk(GCWorker* worker) {
+    ObjList* list = (ObjList*)worker->scanList;
+    int end = worker->scanIndex + GC_LIST_CHUNK;
+    if (end >= list->count) {
+        end = list->count;
+        worker->scanList = NULL;
+    }
+    for (int i = worker->scanIndex; i < end; i++) {
+        markValue(list->items[i]);
+    }
+    worker->scanIndex = end;
+}
+
+static bool pastDeadline(void) {
+    if (__atomic_load_n(&stopMarking, __ATOMIC_RELAXED)) return true;
+    if (nowNs() < markDeadline) return false;
+    __atomic_store_n(&stopMarking, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+static Obj* stealGray(GCWorker* self) {
+    VM* vm = currentVM;
+    self->seed = self->seed * 1103515245u + 12345u;
+    int first = (int)((self->seed >> 16) % (uint32_t)markerCount);
+    for (int i = 0; i < markerCount; i++) {
+        GCWorker* victim = &vm->gcWorkers[(first + i) % markerCount];
+        if (victim == self) continue;
+        Obj* object = graySteal(&victim->gray);
+        if (object != NULL) return object;
+    }
+    return NULL;
+}
+
+// Out of work: wait until some other marker has gray objects to steal
+// (false), or until every marker is idle or the slice is over (true)
+static bool waitForWork(GCWorker* self) {
+    VM* vm = currentVM;
+    __atomic_add_fetch(&idleMarkers, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if (__atomic_load_n(&idleMarkers, __ATOMIC_SEQ_CST) == markerCount) return true;
+        if (pastDeadline()) return true;
+        for (int i = 0; i < markerCount; i++) {
+            GCWorker* worker = &vm->gcWorkers[i];
+            if (worker != self && !grayIsEmpty(&worker->gray)) {
+                __atomic_sub_fetch(&idleMarkers, 1, __ATOMIC_SEQ_CST);
+                return false;
+            }
+        }
+        sched_yield();
+    }
+}
+
+// One marker's share of traceUntil: drain its own deque, then steal
+static void traceMarker(GCWorker* worker) {
+    int work = 0;
+    for (;;) {
+        if (worker->scanList != NULL) {
+            scanListChunk(worker);
+            if (pastDeadline()) return;
+            continue;
+        }
+
+        Obj* object = grayPop(&worker->gray, markingInParallel);
+        if (object == NULL && markingInParallel) object = stealGray(worker);
+        if (object == NULL) {
+            if (!markingInParallel || waitForWork(worker)) return;
+            continue;
+        }
+
+        if (object->type == OBJ_LIST && ((ObjList*)object)->count > GC_LIST_CHUNK) {
+            worker->scanList = object;
+            worker->scanIndex = 0;
+            continue;
+        }
+        blackenObject(object);
+        if (++work % GC_CLOCK_STRIDE == 0 && pastDeadline()) return;
+    }
+}
+
+// Trace until no gray object is left (true) or the deadline has passed.
+// With --gc-threads=N, N markers share the work.
+static bool traceUntil(VM* vm, uint64_t deadline) {
+    markDeadline = deadline;
+    stopMarking = false;
+
+    int markers = vm->gcThreads > 1 ? readyMarkers(vm, vm->gcThreads) : 1;
+    if (markers > 1) {
+        markerCount = markers;
+        idleMarkers = 0;
+        markingInParallel = true;
+        runMarkers(vm, markers, traceMarker);
+        markingInParallel = false;
+    } else {
+        traceMarker(&vm->gcWorkers[0]);
+    }
+
+    bool done = true;
+    for (int i = 0; i < vm->gcThreads; i++) {
+        GCWorker* worker = &vm->gcWorkers[i];
+        grayTrim(&worker->gray);
+        if (worker->scanList != NULL || !grayIsEmpty(&worker->gray)) done = false;
+    }
+    return done;
+}
+
+// Sweep until every page and large object is done (true) or the deadline
+// has passed. Pages left empty are released.
+static bool sweepUntil(VM* vm, uint64_t deadline) {
+    Heap* heap = &vm->heap;
+    while (vm->sweepClass < HEAP_SIZE_CLASSES) {
+        SizeClass* sizeClass = &heap->classes[vm->sweepClass];
+        HeapPage* page = *vm->sweepPageLink;
+        if (page == NULL) {
+            if (++vm->sweepClass < HEAP_SIZE_CLASSES) {
+                vm->sweepPageLink = &heap->classes[vm->sweepClass].pages;
+            }
+            continue;
+        }
+
+        if (page->sweptCycle != heap->cycle) sweepPage(vm, page);
+        if (page->liveCount == 0 && page != sizeClass->allocPage) {
+            *vm->sweepPageLink = page->next;
+            heapReleasePage(heap, page);
+        } else {
+            vm->sweepPageLink = &page->next;
+        }
+        if (nowNs() >= deadline) return false;
+    }
+
+    int work = 0;
+    while (*vm->sweepLink != NULL) {
+        LargeObject* large = *vm->sweepLink;
+        if (large->marked) {
+            vm->sweepLink = &large->next;
+        } else {
+            *vm->sweepLink = large->next;
+            freeDead(vm, LARGE_OBJECT(large));
+        }
+        if (++work % GC_CLOCK_STRIDE == 0 && nowNs() >= deadline) return false;
+    }
+    return true;
+}
+
+// One bounded step of the current full collection
+static void collectSlice(VM* vm, uint64_t start) {
+    uint64_t deadline = start + (uint64_t)vm->gcPauseUs * 1000;
+    vm->gcStats.slices++;
+
+    if (vm->gcPhase == GC_MARK) {
+        if (!traceUntil(vm, deadline)) return;
+        finishMarking(vm);
+    }
+    if (sweepUntil(vm, deadline)) finishSweeping(vm);
+}
+
+static void finishCollection(VM* vm) {
+    if (vm->gcPhase == GC_MARK) {
+        traceUntil(vm, UINT64_MAX);
+        finishMarking(vm);
+    }
+    sweepUntil(vm, UINT64_MAX);
+    finishSweeping(vm);
+}
+
+void collectGarbage(VM* vm) {
+    // A cycle already under way keeps everything that was live when it
+    // began: finish it, then run a whole one so all that is dead now goes
+    if (vm->gcPhase != GC_IDLE) finishCollection(vm);
+    startCollection(vm);
+    finishCollection(vm);
+}
+
+// ---- Compaction ----
+//
+// Sweeping frees slots but releases only pages left empty, so a daemon
+// whose live data shifts around can hold on to many nearly empty pages.
+// With --gc-compact, each full collection requests a compaction, done at
+// the next safepoint: a loop back-edge of the outermost run(), where no C
+// caller holds a raw object pointer. The objects of sparse pages are
+// copied out (heapEvacuate), every reference the roots and the heap hold
+// is rewritten to the copy, and the emptied pages are released.
+
+static inline void forwardValue(Value* value) {
+    if (IS_OBJ(*value)) *value = OBJ_VAL(forwardObject(AS_OBJ(*value)));
+}
+
+#define FORWARD(type, field) ((field) = (type*)forwardObject((Obj*)(field)))
+
+static void forwardArray(ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        forwardValue(&array->values[i]);
+    }
+}
+
+// Keys other than strings are hashed by address, so a table where one of
+// them moved is reindexed
+static void forwardTable(Table* table) {
+    bool moved = false;
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableNext(table, &cursor)) != NULL) {
+        if (IS_OBJ(entry->key)) {
+            Obj* key = forwardObject(AS_OBJ(entry->key));
+            if (key != AS_OBJ(entry->key) && key->type != OBJ_STRING) moved = true;
+            entry->key = OBJ_VAL(key);
+        }
+        forwardValue(&entry->value);
+    }
+    if (moved) tableReindex(table);
+}
+
+static void forwardFields(VM* vm, Obj* object) {
+    switch (object->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            FORWARD(ObjFunction, closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                FORWARD(ObjUpvalue, closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            FORWARD(ObjString, function->name);
+            forwardArray(&function->chunk.constants);
+            forwardTable(&function->chunk.constantIndex);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            forwardValue(&upvalue->closed);
+            FORWARD(ObjUpvalue, upvalue->next);
+            // A closed upvalue points into itself, wherever it now is
+            if (upvalue->location < vm->stack || upvalue->location >= vm->stack + STACK_MAX) {
+                upvalue->location = &upvalue->closed;
+            }
+            break;
+        }
+        case OBJ_LIST: {
+            ObjList* list = (ObjList*)object;
+            for (int i = 0; i < list->count; i++) {
+                forwardValue(&list->items[i]);
+            }
+            break;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            if (map->shape != NULL) {
+                for (int i = 0; i < map->shape->count; i++) {
+                    forwardValue(&map->values[i]);
+                }
+            }
+            forwardTable(&map->table);
+            break;
+        }
+        case OBJ_SET:
+            forwardTable(&((ObjSet*)object)->table);
+            break;
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+        case OBJ_RANGE:
+            break;
+    }
+}
+
+// Everything markRoots marks, plus the weak intern table and the
+// remembered set
+static void forwardRoots(VM* vm) {
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        forwardValue(slot);
+    }
+    for (int i = 0; i < vm->frameCount; i++) {
+        FORWARD(ObjClosure, vm->frames[i].closure);
+    }
+    FORWARD(ObjUpvalue, vm->openUpvalues);
+
+    for (int i = 0; i < vm->globalCount; i++) {
+        forwardValue(&vm->globalValues[i]);
+        FORWARD(ObjString, vm->globalNames[i]);
+    }
+    forwardTable(&vm->globalSlots);
+    forwardTable(&vm->strings);
+    for (int i = 0; i < 256; i++) {
+        FORWARD(ObjString, vm->charStrings[i]);
+    }
+    forwardTable(&vm->modules);
+    forwardValue(&vm->currentError);
+
+    for (Shape* shape = vm->shapes; shape != NULL; shape = shape->next) {
+        for (int i = 0; i < shape->count; i++) {
+            FORWARD(ObjString, shape->keys[i]);
+        }
+    }
+    for (int i = 0; i < vm->rememberedCount; i++) {
+        vm->remembered[i] = forwardObject(vm->remembered[i]);
+    }
+}
+
+static void forwardHeap(VM* vm) {
+    Heap* heap = &vm->heap;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+            if (page->evacuating) continue;
+            int words = (page->slotCount + 63) / 64;
+            for (int word = 0; word < words; word++) {
+                for (uint64_t bits = page->allocated[word]; bits != 0; bits &= bits - 1) {
+                    forwardFields(vm, heapSlot(page, word * 64 + __builtin_ctzll(bits)));
+                }
+            }
+        }
+    }
+    for (LargeObject* large = heap->youngLarge; large != NULL; large = large->next) {
+        forwardFields(vm, LARGE_OBJECT(large));
+    }
+    for (LargeObject* large = heap->oldLarge; large != NULL; large = large->next) {
+        forwardFields(vm, LARGE_OBJECT(large));
+    }
+}
+
+void compactHeap(VM* vm) {
+    vm->compactPending = false;
+    if (vm->gcPhase != GC_IDLE) return;
+
+    uint64_t start = nowNs();
+    size_t pages = vm->heap.pageCount;
+    if (heapPlanEvacuation(&vm->heap)) {
+        heapEvacuate(&vm->heap);
+        forwardRoots(vm);
+        forwardHeap(vm);
+        heapReleaseEvacuated(&vm->heap);
+        vm->gcStats.compactions++;
+        vm->gcStats.pagesReleased += pages - vm->heap.pageCount;
+#ifdef __GLIBC__
+        // The arrays of the objects freed by the sweep are scattered
+        // through malloc's arena too: hand its free pages back as well
+        malloc_trim(0);
 #endif
+    }
+    recordPause(vm, start);
+}
+
+// ---- Statistics ----
+
+void printGCStats(VM* vm) {
+    GCStats* stats = &vm->gcStats;
+    fprintf(stderr, "gc: %llu minor, %llu full collections (%llu slices of <= %d us)\n",
+            (unsigned long long)stats->minorCollections,
+            (unsigned long long)stats->fullCollections,
+            (unsigned long long)stats->slices, vm->gcPauseUs);
+    fprintf(stderr, "gc: pauses total %.3f ms, max %.3f ms\n",
+            stats->totalPauseNs / 1e6, stats->maxPauseNs / 1e6);
+    fprintf(stderr, "gc: %llu bytes allocated, %llu freed, %zu in use\n",
+            (unsigned long long)stats->totalAllocated,
+            (unsigned long long)(stats->totalAllocated - vm->bytesAllocated),
+            vm->bytesAllocated);
+    if (vm->gcCompact) {
+        fprintf(stderr, "gc: %llu compactions released %llu pages\n",
+                (unsigned long long)stats->compactions,
+                (unsigned long long)stats->pagesReleased);
+    }
+    fprintf(stderr, "  pause (us)        count\n");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (stats->pauses[i] == 0) continue;
+        if (i == 0) {
+            fprintf(stderr, "  < 1           %9llu\n", (unsigned long long)stats->pauses[i]);
+        } else if (i == GC_PAUSE_BUCKETS - 1) {
+            fprintf(stderr, "  >= %-10llu %9llu\n", 1ull << (i - 1),
+                    (unsigned long long)stats->pauses[i]);
+        } else {
+            fprintf(stderr, "  %6llu-%-6llu %9llu\n", 1ull << (i - 1), (1ull << i) - 1,
+                    (unsigned long long)stats->pauses[i]);
+        }
+    }
+}
+
+static void freeLargeObjects(LargeObject* large) {
+    while (large != NULL) {
+        LargeObject* next = large->next;
+        freeObject(LARGE_OBJECT(large));
+        large = next;
+    }
 }
 
 void freeObjects(VM* vm) {
-    Obj* object = vm->objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
+    Heap* heap = &vm->heap;
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        for (HeapPage* page = heap->classes[i].pages; page != NULL; page = page->next) {
+            int words = (page->slotCount + 63) / 64;
+            for (int word = 0; word < words; word++) {
+                for (uint64_t bits = page->allocated[word]; bits != 0; bits &= bits - 1) {
+                    freeObject(heapSlot(page, word * 64 + __builtin_ctzll(bits)));
+                }
+            }
+        }
+    }
+    freeLargeObjects(heap->youngLarge);
+    freeLargeObjects(heap->oldLarge);
+    heap->youngLarge = NULL;
+    heap->oldLarge = NULL;
+    freeHeap(heap);
+    for (int i = 0; i < GC_MAX_THREADS; i++) {
+        freeGrayDeque(&vm->gcWorkers[i].gray);
     }
-    free(vm->grayStack);
+    free(vm->remembered);
 }
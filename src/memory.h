@@ -7,14 +7,79 @@
 // Forward declaration
 typedef struct VM VM;
 
+#include "heap.h"
+
+// Minor collections run whenever this many bytes have been allocated
+// since the last collection; full ones when the heap has grown by
+// GC_DEFAULT_GROWTH (or run --gc-growth=F)
+#define GC_NURSERY_SIZE (256 * 1024)
+#define GC_DEFAULT_GROWTH 2.0
+#define GC_DEFAULT_INITIAL (1024 * 1024)   // first full collection (run --gc-initial=SIZE)
+
+// A full collection marks and sweeps incrementally: one slice of at most
+// vm->gcPauseUs microseconds per GC_SLICE_BYTES allocated. Lists longer
+// than GC_LIST_CHUNK are scanned a chunk at a time.
+#define GC_SLICE_BYTES (64 * 1024)
+#define GC_DEFAULT_PAUSE_US 1000
+#define GC_LIST_CHUNK 1024
+
+typedef enum {
+    GC_IDLE,
+    GC_MARK,    // full collection: tracing from the gray stack
+    GC_SWEEP,   // full collection: freeing the unmarked old objects
+} GCPhase;
+
+// Pause times, bucketed by powers of two: bucket 0 counts pauses under
+// 1 us, bucket i those in [2^(i-1), 2^i) us, the last one everything longer
+#define GC_PAUSE_BUCKETS 18
+
+typedef struct {
+    uint64_t minorCollections;
+    uint64_t fullCollections;
+    uint64_t slices;
+    uint64_t pauses[GC_PAUSE_BUCKETS];
+    uint64_t maxPauseNs;
+    uint64_t totalPauseNs;
+    uint64_t totalAllocated;    // bytes ever allocated (freed: this - bytesAllocated)
+    uint64_t compactions;
+    uint64_t pagesReleased;     // by compaction
+} GCStats;
+
+// Set while a full collection is marking (tested by the write barriers)
+extern bool gcMarking;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
-void collectGarbage(VM* vm);
+// Like reallocate(NULL, 0, size), but zeroed; large blocks come straight
+// from the system, and their pages are not touched until they are used
+void* allocateZeroed(size_t size);
+// Object memory (see heap.h), counted in bytesAllocated
+Obj* allocateObjectMemory(VM* vm, size_t size);
+void freeObjectMemory(Obj* object);
+void collectGarbage(VM* vm);    // full: every object, after finishing any cycle in progress
+void collectYoung(VM* vm);      // minor: objects allocated since the last collection
+// Move objects out of sparse pages and release them (run --gc-compact).
+// Only at a safepoint: every object reference must be reachable from the VM.
+void compactHeap(VM* vm);
 void freeObjects(VM* vm);
+void printGCStats(VM* vm);      // pause histogram (run --gc-stats)
+// Free the dead old objects of one page (the sweep, or allocation reaching
+// a page the sweep has not)
+void sweepPage(VM* vm, HeapPage* page);
+
+// Write barrier slow paths (see WRITE_BARRIER in object.h)
+void writeBarrier(Obj* owner, Obj* value);
+void rememberObject(Obj* object);
+// An object found again through a weak reference (the intern table):
+// keeps a sweep in progress from freeing it
+void reviveObject(Obj* object);
 
 // Convenience macros
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
+#define ALLOCATE_ZEROED(type, count) \
+    (type*)allocateZeroed(sizeof(type) * (count))
+
 #define FREE(type, pointer) \
     reallocate(pointer, sizeof(type), 0)
 
@@ -8,53 +8,59 @@
 
 #include <stdint.h>
 
+// Operands as 32-bit words; tagged ints skip the double conversion
+static uint32_t toWord(Value value) {
+    if (IS_INT(value)) return (uint32_t)AS_INT(value);
+    return (uint32_t)(int64_t)AS_NUMBER(value);
+}
+
 static Value bitAndNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    uint32_t b = (uint32_t)AS_NUMBER(args[1]);
-    return NUMBER_VAL((double)(a & b));
+    uint32_t a = toWord(args[0]);
+    uint32_t b = toWord(args[1]);
+    return intValue(a & b);
 }
 
 static Value bitOrNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    uint32_t b = (uint32_t)AS_NUMBER(args[1]);
-    return NUMBER_VAL((double)(a | b));
+    uint32_t a = toWord(args[0]);
+    uint32_t b = toWord(args[1]);
+    return intValue(a | b);
 }
 
 static Value bitXorNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    uint32_t b = (uint32_t)AS_NUMBER(args[1]);
-    return NUMBER_VAL((double)(a ^ b));
+    uint32_t a = toWord(args[0]);
+    uint32_t b = toWord(args[1]);
+    return intValue(a ^ b);
 }
 
 static Value bitNotNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    return NUMBER_VAL((double)(~a));
+    uint32_t a = toWord(args[0]);
+    return intValue(~a);
 }
 
 static Value bitLshiftNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    int n = (int)AS_NUMBER(args[1]);
-    if (n < 0 || n >= 32) return NUMBER_VAL(0);
-    return NUMBER_VAL((double)(a << n));
+    uint32_t a = toWord(args[0]);
+    int n = asInt(args[1]);
+    if (n < 0 || n >= 32) return INT_VAL(0);
+    return intValue(a << n);
 }
 
 static Value bitRshiftNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
-    uint32_t a = (uint32_t)AS_NUMBER(args[0]);
-    int n = (int)AS_NUMBER(args[1]);
-    if (n < 0 || n >= 32) return NUMBER_VAL(0);
-    return NUMBER_VAL((double)(a >> n));
+    uint32_t a = toWord(args[0]);
+    int n = asInt(args[1]);
+    if (n < 0 || n >= 32) return INT_VAL(0);
+    return intValue(a >> n);
 }
 
 void registerBitModule(VM* vm) {
@@ -69,6 +75,6 @@ void registerBitModule(VM* vm) {
     defineModuleNative(vm, bitMod, "rshift", bitRshiftNative, 2);
 
     ObjString* modName = copyString(vm, "bit", 3);
-    tableSet(&vm->globals, modName, OBJ_VAL(bitMod));
+    vmDefineGlobal(vm, modName, OBJ_VAL(bitMod));
     vmPop(vm);
 }
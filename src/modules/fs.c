@@ -14,7 +14,7 @@ void registerFsModule(VM* vm) {
     ObjMap* fs = newMap(vm);
     vmPush(vm, OBJ_VAL(fs));
     ObjString* name = copyString(vm, "fs", 2);
-    tableSet(&vm->globals, name, OBJ_VAL(fs));
+    vmDefineGlobal(vm, name, OBJ_VAL(fs));
     vmPop(vm);
 }
 
@@ -128,15 +128,15 @@ static Value fsStatNative(VM* vm, int argCount, Value* args) {
     ObjMap* map = newMap(vm);
     vmPush(vm, OBJ_VAL(map));
 
-    tableSet(&map->table,
+    mapSet(vm, map,
         copyString(vm, "size", 4), NUMBER_VAL((double)st.st_size));
-    tableSet(&map->table,
+    mapSet(vm, map,
         copyString(vm, "mtime", 5), NUMBER_VAL((double)st.st_mtime));
-    tableSet(&map->table,
+    mapSet(vm, map,
         copyString(vm, "mode", 4), NUMBER_VAL((double)st.st_mode));
-    tableSet(&map->table,
+    mapSet(vm, map,
         copyString(vm, "isFile", 6), BOOL_VAL(S_ISREG(st.st_mode)));
-    tableSet(&map->table,
+    mapSet(vm, map,
         copyString(vm, "isDir", 5), BOOL_VAL(S_ISDIR(st.st_mode)));
 
     vmPop(vm);
@@ -318,7 +318,7 @@ void registerFsModule(VM* vm) {
 
     // Register as global
     ObjString* name = copyString(vm, "fs", 2);
-    tableSet(&vm->globals, name, OBJ_VAL(fs));
+    vmDefineGlobal(vm, name, OBJ_VAL(fs));
     vmPop(vm);
 }
 
@@ -0,0 +1,100 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "gc_module.h"
+#include "../object.h"
+#include "../table.h"
+
+#include <string.h>
+
+// ---- Collector introspection ----
+
+static void setNumber(VM* vm, ObjMap* map, const char* key, double value) {
+    mapSet(vm, map, copyString(vm, key, (int)strlen(key)), NUMBER_VAL(value));
+}
+
+// Run a full collection now; returns the bytes it freed
+static Value gcCollectNative(VM* vm, int argCount, Value* args) {
+    (void)argCount; (void)args;
+    size_t before = vm->bytesAllocated;
+    collectGarbage(vm);
+    return NUMBER_VAL(before > vm->bytesAllocated ? (double)(before - vm->bytesAllocated) : 0);
+}
+
+static Value gcStatsNative(VM* vm, int argCount, Value* args) {
+    (void)argCount; (void)args;
+    // Read everything first: building the map allocates, which can collect
+    GCStats snapshot = vm->gcStats;
+    GCStats* stats = &snapshot;
+    size_t heap = vm->bytesAllocated;
+    size_t nextGC = vm->nextGC;
+    size_t pages = vm->heap.pageCount;
+    int interned = vm->strings.count;
+    int shapes = vm->shapeCount;
+    ObjMap* map = newMap(vm);
+    vmPush(vm, OBJ_VAL(map));
+
+    setNumber(vm, map, "collections", (double)(stats->minorCollections + stats->fullCollections));
+    setNumber(vm, map, "minor", (double)stats->minorCollections);
+    setNumber(vm, map, "full", (double)stats->fullCollections);
+    setNumber(vm, map, "slices", (double)stats->slices);
+    setNumber(vm, map, "pause_total_ms", (double)stats->totalPauseNs / 1e6);
+    setNumber(vm, map, "pause_max_ms", (double)stats->maxPauseNs / 1e6);
+    setNumber(vm, map, "allocated", (double)stats->totalAllocated);
+    setNumber(vm, map, "freed", (double)(stats->totalAllocated - heap));
+    setNumber(vm, map, "heap", (double)heap);
+    setNumber(vm, map, "next_gc", (double)nextGC);
+    setNumber(vm, map, "max_heap", (double)vm->maxHeap);
+    setNumber(vm, map, "pause_us", vm->gcPauseUs);
+    mapSet(vm, map, copyString(vm, "compact", 7), BOOL_VAL(vm->gcCompact));
+    setNumber(vm, map, "pages", (double)pages);
+    setNumber(vm, map, "compactions", (double)stats->compactions);
+    setNumber(vm, map, "interned", interned);
+    setNumber(vm, map, "shapes", shapes);
+
+    vmPop(vm);
+    return OBJ_VAL(map);
+}
+
+// Objects in the heap by type. Garbage not collected yet is counted too;
+// after gc.collect() these are the live objects.
+static Value gcObjectsNative(VM* vm, int argCount, Value* args) {
+    (void)argCount; (void)args;
+    static const char* typeNames[OBJ_TYPE_COUNT] = {
+        [OBJ_STRING] = "string",
+        [OBJ_FUNCTION] = "function",
+        [OBJ_CLOSURE] = "closure",
+        [OBJ_UPVALUE] = "upvalue",
+        [OBJ_NATIVE] = "native",
+        [OBJ_LIST] = "list",
+        [OBJ_MAP] = "map",
+        [OBJ_RANGE] = "range",
+        [OBJ_SET] = "set",
+    };
+    size_t counts[OBJ_TYPE_COUNT] = {0};
+    heapCountObjects(&vm->heap, counts);
+
+    ObjMap* map = newMap(vm);
+    vmPush(vm, OBJ_VAL(map));
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        setNumber(vm, map, typeNames[type], (double)counts[type]);
+    }
+    vmPop(vm);
+    return OBJ_VAL(map);
+}
+
+// ---- Module Registration ----
+
+void registerGcModule(VM* vm) {
+    ObjMap* gc = newMap(vm);
+    vmPush(vm, OBJ_VAL(gc));
+
+    defineModuleNative(vm, gc, "collect", gcCollectNative, 0);
+    defineModuleNative(vm, gc, "stats", gcStatsNative, 0);
+    defineModuleNative(vm, gc, "objects", gcObjectsNative, 0);
+
+    ObjString* name = copyString(vm, "gc", 2);
+    vmDefineGlobal(vm, name, OBJ_VAL(gc));
+    vmPop(vm);
+}
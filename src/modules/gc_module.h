@@ -0,0 +1,8 @@
+#ifndef glipt_module_gc_h
+#define glipt_module_gc_h
+
+#include "../vm.h"
+
+void registerGcModule(VM* vm);
+
+#endif
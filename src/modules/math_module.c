@@ -12,7 +12,7 @@ void registerMathModule(VM* vm) {
     ObjMap* mathMod = newMap(vm);
     vmPush(vm, OBJ_VAL(mathMod));
     ObjString* name = copyString(vm, "math", 4);
-    tableSet(&vm->globals, name, OBJ_VAL(mathMod));
+    vmDefineGlobal(vm, name, OBJ_VAL(mathMod));
     vmPop(vm);
 }
 
@@ -27,19 +27,19 @@ void registerMathModule(VM* vm) {
 static Value mathFloorNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(floor(AS_NUMBER(args[0])));
+    return numberValue(floor(AS_NUMBER(args[0])));
 }
 
 static Value mathCeilNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(ceil(AS_NUMBER(args[0])));
+    return numberValue(ceil(AS_NUMBER(args[0])));
 }
 
 static Value mathRoundNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(round(AS_NUMBER(args[0])));
+    return numberValue(round(AS_NUMBER(args[0])));
 }
 
 static Value mathAbsNative(VM* vm, int argCount, Value* args) {
@@ -87,7 +87,7 @@ static Value mathLog2Native(VM* vm, int argCount, Value* args) {
 static Value mathTruncNative(VM* vm, int argCount, Value* args) {
     (void)vm; (void)argCount;
     if (!IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(trunc(AS_NUMBER(args[0])));
+    return numberValue(trunc(AS_NUMBER(args[0])));
 }
 
 static Value mathSignNative(VM* vm, int argCount, Value* args) {
@@ -180,7 +180,7 @@ static Value mathRandIntNative(VM* vm, int argCount, Value* args) {
     int min = (int)AS_NUMBER(args[0]);
     int max = (int)AS_NUMBER(args[1]);
     if (max < min) return NIL_VAL;
-    return NUMBER_VAL((double)(min + rand() % (max - min + 1)));
+    return intValue(min + rand() % (max - min + 1));
 }
 
 // ---- Module Registration ----
@@ -224,19 +224,19 @@ void registerMathModule(VM* vm) {
 
     // Constants
     ObjString* piKey = copyString(vm, "PI", 2);
-    tableSet(&mathMod->table, piKey, NUMBER_VAL(3.14159265358979323846));
+    mapSet(vm, mathMod, piKey, NUMBER_VAL(3.14159265358979323846));
 
     ObjString* eKey = copyString(vm, "E", 1);
-    tableSet(&mathMod->table, eKey, NUMBER_VAL(2.71828182845904523536));
+    mapSet(vm, mathMod, eKey, NUMBER_VAL(2.71828182845904523536));
 
     ObjString* infKey = copyString(vm, "INF", 3);
-    tableSet(&mathMod->table, infKey, NUMBER_VAL(INFINITY));
+    mapSet(vm, mathMod, infKey, NUMBER_VAL(INFINITY));
 
     ObjString* nanKey = copyString(vm, "NAN", 3);
-    tableSet(&mathMod->table, nanKey, NUMBER_VAL(NAN));
+    mapSet(vm, mathMod, nanKey, NUMBER_VAL(NAN));
 
     ObjString* modName = copyString(vm, "math", 4);
-    tableSet(&vm->globals, modName, OBJ_VAL(mathMod));
+    vmDefineGlobal(vm, modName, OBJ_VAL(mathMod));
     vmPop(vm);
 }
 
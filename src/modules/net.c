@@ -13,7 +13,7 @@ void registerNetModule(VM* vm) {
     ObjMap* net = newMap(vm);
     vmPush(vm, OBJ_VAL(net));
     ObjString* name = copyString(vm, "net", 3);
-    tableSet(&vm->globals, name, OBJ_VAL(net));
+    vmDefineGlobal(vm, name, OBJ_VAL(net));
     vmPop(vm);
 }
 
@@ -152,11 +152,9 @@ static Value doHttpViaCurl(VM* vm, const char* method, const char* url,
     ObjMap* result = newMap(vm);
     vmPush(vm, OBJ_VAL(result));
 
-    tableSet(&result->table,
+    mapSet(vm, result,
         copyString(vm, "status", 6), NUMBER_VAL(status));
-    tableSet(&result->table,
-        copyString(vm, "body", 4),
-        OBJ_VAL(copyString(vm, bodyEnd, bLen)));
+    mapSetString(vm, result, "body", bodyEnd, bLen);
 
     processResultFree(&proc);
     vmPop(vm);
@@ -304,18 +302,14 @@ static Value doHttpRequest(VM* vm, const char* method, const char* url,
     ObjMap* result = newMap(vm);
     vmPush(vm, OBJ_VAL(result));
 
-    tableSet(&result->table,
+    mapSet(vm, result,
         copyString(vm, "status", 6), NUMBER_VAL(status));
 
     if (bodyStart) {
         int bLen = responseLen - (int)(bodyStart - response);
-        tableSet(&result->table,
-            copyString(vm, "body", 4),
-            OBJ_VAL(copyString(vm, bodyStart, bLen)));
+        mapSetString(vm, result, "body", bodyStart, bLen);
     } else {
-        tableSet(&result->table,
-            copyString(vm, "body", 4),
-            OBJ_VAL(copyString(vm, response, responseLen)));
+        mapSetString(vm, result, "body", response, responseLen);
     }
 
     free(response);
@@ -404,7 +398,7 @@ void registerNetModule(VM* vm) {
     defineModuleNative(vm, net, "resolve", netResolveNative, 1);
 
     ObjString* name = copyString(vm, "net", 3);
-    tableSet(&vm->globals, name, OBJ_VAL(net));
+    vmDefineGlobal(vm, name, OBJ_VAL(net));
     vmPop(vm);
 }
 
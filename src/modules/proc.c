@@ -14,7 +14,7 @@ void registerProcModule(VM* vm) {
     ObjMap* proc = newMap(vm);
     vmPush(vm, OBJ_VAL(proc));
     ObjString* name = copyString(vm, "proc", 4);
-    tableSet(&vm->globals, name, OBJ_VAL(proc));
+    vmDefineGlobal(vm, name, OBJ_VAL(proc));
     vmPop(vm);
 }
 
@@ -55,35 +55,26 @@ static Value procExecNative(VM* vm, int argCount, Value* args) {
     ObjMap* result = newMap(vm);
     vmPush(vm, OBJ_VAL(result));
 
-    tableSet(&result->table,
+    mapSet(vm, result,
         copyString(vm, "code", 4), NUMBER_VAL(pr.exitCode));
 
     if (pr.stdoutData) {
-        tableSet(&result->table,
-            copyString(vm, "stdout", 6),
-            OBJ_VAL(copyString(vm, pr.stdoutData, (int)strlen(pr.stdoutData))));
+        mapSetString(vm, result, "stdout", pr.stdoutData, (int)strlen(pr.stdoutData));
 
         // Trimmed output
         char* trimmed = pr.stdoutData;
         int len = (int)strlen(trimmed);
         while (len > 0 && (trimmed[len-1] == '\n' || trimmed[len-1] == '\r')) len--;
-        tableSet(&result->table,
-            copyString(vm, "output", 6),
-            OBJ_VAL(copyString(vm, trimmed, len)));
+        mapSetString(vm, result, "output", trimmed, len);
     } else {
-        tableSet(&result->table,
-            copyString(vm, "stdout", 6), OBJ_VAL(copyString(vm, "", 0)));
-        tableSet(&result->table,
-            copyString(vm, "output", 6), OBJ_VAL(copyString(vm, "", 0)));
+        mapSetString(vm, result, "stdout", "", 0);
+        mapSetString(vm, result, "output", "", 0);
     }
 
     if (pr.stderrData) {
-        tableSet(&result->table,
-            copyString(vm, "stderr", 6),
-            OBJ_VAL(copyString(vm, pr.stderrData, (int)strlen(pr.stderrData))));
+        mapSetString(vm, result, "stderr", pr.stderrData, (int)strlen(pr.stderrData));
     } else {
-        tableSet(&result->table,
-            copyString(vm, "stderr", 6), OBJ_VAL(copyString(vm, "", 0)));
+        mapSetString(vm, result, "stderr", "", 0);
     }
 
     free(pr.stdoutData);
@@ -212,7 +203,7 @@ void registerProcModule(VM* vm) {
     defineModuleNative(vm, proc, "sleep", procSleepNative, 1);
 
     ObjString* name = copyString(vm, "proc", 4);
-    tableSet(&vm->globals, name, OBJ_VAL(proc));
+    vmDefineGlobal(vm, name, OBJ_VAL(proc));
     vmPop(vm);
 }
 
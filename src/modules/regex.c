@@ -12,7 +12,7 @@ void registerRegexModule(VM* vm) {
     ObjMap* re = newMap(vm);
     vmPush(vm, OBJ_VAL(re));
     ObjString* name = copyString(vm, "re", 2);
-    tableSet(&vm->globals, name, OBJ_VAL(re));
+    vmDefineGlobal(vm, name, OBJ_VAL(re));
     vmPop(vm);
 }
 
@@ -74,15 +74,13 @@ static Value reSearchNative(VM* vm, int argCount, Value* args) {
     ObjMap* result = newMap(vm);
     vmPush(vm, OBJ_VAL(result));
 
-    ObjString* matchedKey = copyString(vm, "matched", 7);
-    ObjString* matchedVal = copyString(vm, str + start, end - start);
-    tableSet(&result->table, matchedKey, OBJ_VAL(matchedVal));
+    mapSetString(vm, result, "matched", str + start, end - start);
 
     ObjString* startKey = copyString(vm, "start", 5);
-    tableSet(&result->table, startKey, NUMBER_VAL((double)start));
+    mapSet(vm, result, startKey, NUMBER_VAL((double)start));
 
     ObjString* endKey = copyString(vm, "end", 3);
-    tableSet(&result->table, endKey, NUMBER_VAL((double)end));
+    mapSet(vm, result, endKey, NUMBER_VAL((double)end));
 
     // Build capture groups list
     if (reg.re_nsub > 0) {
@@ -100,9 +98,9 @@ static Value reSearchNative(VM* vm, int argCount, Value* args) {
             }
         }
 
-        vmPop(vm); // groups
         ObjString* groupsKey = copyString(vm, "groups", 6);
-        tableSet(&result->table, groupsKey, OBJ_VAL(groups));
+        mapSet(vm, result, groupsKey, OBJ_VAL(groups));
+        vmPop(vm); // groups
     }
 
     free(matches);
@@ -295,7 +293,7 @@ void registerRegexModule(VM* vm) {
     defineModuleNative(vm, re, "split", reSplitNative, 2);
 
     ObjString* name = copyString(vm, "re", 2);
-    tableSet(&vm->globals, name, OBJ_VAL(re));
+    vmDefineGlobal(vm, name, OBJ_VAL(re));
     vmPop(vm);
 }
 
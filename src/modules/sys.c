@@ -12,7 +12,7 @@ void registerSysModule(VM* vm) {
     ObjMap* sys = newMap(vm);
     vmPush(vm, OBJ_VAL(sys));
     ObjString* name = copyString(vm, "sys", 3);
-    tableSet(&vm->globals, name, OBJ_VAL(sys));
+    vmDefineGlobal(vm, name, OBJ_VAL(sys));
     vmPop(vm);
 }
 
@@ -156,7 +156,7 @@ void registerSysModule(VM* vm) {
     defineModuleNative(vm, sys, "args", sysArgsNative, 0);
 
     ObjString* name = copyString(vm, "sys", 3);
-    tableSet(&vm->globals, name, OBJ_VAL(sys));
+    vmDefineGlobal(vm, name, OBJ_VAL(sys));
     vmPop(vm);
 }
 
@@ -1,14 +1,15 @@
 #include "object.h"
 #include "memory.h"
 #include "table.h"
+#include "shape.h"
 #include "vm.h"
+#include "jit.h"
 
 static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = allocateObjectMemory(vm, size);
     object->type = type;
-    object->isMarked = false;
-    object->next = vm->objects;
-    vm->objects = object;
+    object->isOld = false;
+    object->isRemembered = false;
     return object;
 }
 
@@ -37,23 +38,49 @@ static ObjString* allocateString(VM* vm, const char* chars, int length,
 
     // Protect from GC during intern table resize
     vmPush(vm, OBJ_VAL(string));
-    tableSet(&vm->strings, string, NIL_VAL);
+    tableSet(&vm->strings, OBJ_VAL(string), NIL_VAL);
     vmPop(vm);
 
     return string;
 }
 
+static ObjString* findInterned(VM* vm, const char* chars, int length,
+                               uint32_t hash) {
+    ObjString* string = tableFindString(&vm->strings, chars, length, hash);
+    if (string != NULL) reviveObject((Obj*)string);
+    return string;
+}
+
+static ObjString* charString(VM* vm, char c) {
+    ObjString* string = vm->charStrings[(uint8_t)c];
+    if (string == NULL) {
+        uint32_t hash = hashString(&c, 1);
+        string = findInterned(vm, &c, 1, hash);
+        if (string == NULL) string = allocateString(vm, &c, 1, hash);
+        vm->charStrings[(uint8_t)c] = string;
+    }
+    return string;
+}
+
 ObjString* copyString(VM* vm, const char* chars, int length) {
+    if (length == 1) return charString(vm, chars[0]);
+
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
     if (interned != NULL) return interned;
 
     return allocateString(vm, chars, length, hash);
 }
 
 ObjString* takeString(VM* vm, char* chars, int length) {
+    if (length == 1) {
+        ObjString* string = charString(vm, chars[0]);
+        FREE_ARRAY(char, chars, length + 1);
+        return string;
+    }
+
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+    ObjString* interned = findInterned(vm, chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
@@ -71,6 +98,9 @@ ObjFunction* newFunction(VM* vm) {
     function->arity = 0;
     function->upvalueCount = 0;
     function->name = NULL;
+    function->regChunk = NULL;
+    function->hotness = 0;
+    function->jitCode = NULL;
     initChunk(&function->chunk);
     return function;
 }
@@ -88,15 +118,13 @@ ObjUpvalue* newUpvalue(VM* vm, Value* slot) {
 // ---- Closure ----
 
 ObjClosure* newClosure(VM* vm, ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = NULL;
-    }
-
-    ObjClosure* closure = ALLOCATE_OBJ(vm, ObjClosure, OBJ_CLOSURE);
+    ObjClosure* closure = (ObjClosure*)allocateObject(vm,
+        sizeof(ObjClosure) + sizeof(ObjUpvalue*) * function->upvalueCount, OBJ_CLOSURE);
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
+    for (int i = 0; i < function->upvalueCount; i++) {
+        closure->upvalues[i] = NULL;
+    }
     return closure;
 }
 
@@ -117,28 +145,206 @@ ObjList* newList(VM* vm) {
     list->count = 0;
     list->capacity = 0;
     list->items = NULL;
+    list->dirtyLow = 0;
+    list->dirtyHigh = 0;
     return list;
 }
 
 void listAppend(VM* vm, ObjList* list, Value value) {
-    (void)vm; // Will be used for GC coordination
     if (list->capacity < list->count + 1) {
         int oldCapacity = list->capacity;
         list->capacity = GROW_CAPACITY(oldCapacity);
+        // Protect the new item from GC while the array grows
+        vmPush(vm, value);
         list->items = GROW_ARRAY(Value, list->items, oldCapacity, list->capacity);
+        vmPop(vm);
     }
     list->items[list->count] = value;
     list->count++;
+    LIST_WRITE_BARRIER(list, list->count - 1, value);
 }
 
 // ---- Map ----
 
 ObjMap* newMap(VM* vm) {
     ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    map->shape = vm->rootShape;
+    map->values = NULL;
+    map->valueCapacity = 0;
     initTable(&map->table);
     return map;
 }
 
+static void mapToDictionary(ObjMap* map) {
+    Shape* shape = map->shape;
+    for (int i = 0; i < shape->count; i++) {
+        tableSet(&map->table, OBJ_VAL(shape->keys[i]), map->values[i]);
+    }
+    FREE_ARRAY(Value, map->values, map->valueCapacity);
+    map->values = NULL;
+    map->valueCapacity = 0;
+    map->shape = NULL;
+}
+
+bool mapGet(ObjMap* map, ObjString* key, Value* value) {
+    if (map->shape != NULL) {
+        int slot = shapeFind(map->shape, key);
+        if (slot < 0) return false;
+        *value = map->values[slot];
+        return true;
+    }
+    return tableGet(&map->table, OBJ_VAL(key), value);
+}
+
+// Add a new key (the map has no entry for it yet)
+static void mapAdd(VM* vm, ObjMap* map, ObjString* key, Value value) {
+    if (map->shape != NULL) {
+        Shape* next = shapeAddKey(vm, map->shape, key);
+        if (next != NULL) {
+            if (map->valueCapacity < next->count) {
+                int oldCapacity = map->valueCapacity;
+                map->valueCapacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+                map->values = GROW_ARRAY(Value, map->values,
+                    oldCapacity, map->valueCapacity);
+            }
+            map->values[next->count - 1] = value;
+            map->shape = next;
+            return;
+        }
+        mapToDictionary(map);
+    }
+    tableSet(&map->table, OBJ_VAL(key), value);
+}
+
+void mapSet(VM* vm, ObjMap* map, ObjString* key, Value value) {
+    if (map->shape != NULL) {
+        int slot = shapeFind(map->shape, key);
+        if (slot >= 0) {
+            map->values[slot] = value;
+            WRITE_BARRIER(map, value);
+            return;
+        }
+    }
+
+    // Protect the key and value from GC while the shape or table grows
+    vmPush(vm, OBJ_VAL(key));
+    vmPush(vm, value);
+    mapAdd(vm, map, key, value);
+    vmPop(vm);
+    vmPop(vm);
+    // After the store: a collection during it may have promoted the map
+    WRITE_BARRIER(map, OBJ_VAL(key));
+    WRITE_BARRIER(map, value);
+}
+
+void mapSetString(VM* vm, ObjMap* map, const char* key,
+                  const char* chars, int length) {
+    vmPush(vm, OBJ_VAL(copyString(vm, chars, length)));
+    mapSet(vm, map, copyString(vm, key, (int)strlen(key)), vm->stackTop[-1]);
+    vmPop(vm);
+}
+
+bool mapDelete(ObjMap* map, ObjString* key) {
+    if (map->shape != NULL) {
+        if (shapeFind(map->shape, key) < 0) return false;
+        mapToDictionary(map);
+    }
+    return tableDelete(&map->table, OBJ_VAL(key));
+}
+
+bool mapGetKey(ObjMap* map, Value key, Value* value) {
+    if (IS_STRING(key)) return mapGet(map, AS_STRING(key), value);
+    // Shape mode only has string keys
+    if (map->shape != NULL) return false;
+    return tableGet(&map->table, key, value);
+}
+
+void mapSetKey(VM* vm, ObjMap* map, Value key, Value value) {
+    if (IS_STRING(key)) {
+        mapSet(vm, map, AS_STRING(key), value);
+        return;
+    }
+
+    vmPush(vm, key);
+    vmPush(vm, value);
+    if (map->shape != NULL) mapToDictionary(map);
+    tableSet(&map->table, key, value);
+    vmPop(vm);
+    vmPop(vm);
+    WRITE_BARRIER(map, key);
+    WRITE_BARRIER(map, value);
+}
+
+bool mapDeleteKey(ObjMap* map, Value key) {
+    if (IS_STRING(key)) return mapDelete(map, AS_STRING(key));
+    if (map->shape != NULL) return false;
+    return tableDelete(&map->table, key);
+}
+
+int mapCount(ObjMap* map) {
+    if (map->shape != NULL) return map->shape->count;
+    return map->table.count;
+}
+
+bool mapNext(ObjMap* map, int* cursor, Value* key, Value* value) {
+    if (map->shape != NULL) {
+        if (*cursor >= map->shape->count) return false;
+        *key = OBJ_VAL(map->shape->keys[*cursor]);
+        *value = map->values[*cursor];
+        (*cursor)++;
+        return true;
+    }
+    Entry* entry = tableNext(&map->table, cursor);
+    if (entry == NULL) return false;
+    *key = entry->key;
+    *value = entry->value;
+    return true;
+}
+
+// ---- Range ----
+
+ObjRange* newRange(VM* vm, double start, double end, double step) {
+    ObjRange* range = ALLOCATE_OBJ(vm, ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->end = end;
+    range->step = step;
+    range->next = start;
+    return range;
+}
+
+// ---- Set ----
+
+ObjSet* newSet(VM* vm) {
+    ObjSet* set = ALLOCATE_OBJ(vm, ObjSet, OBJ_SET);
+    initTable(&set->table);
+    return set;
+}
+
+bool setAdd(VM* vm, ObjSet* set, Value value) {
+    vmPush(vm, value);
+    bool added = tableSet(&set->table, value, NIL_VAL);
+    vmPop(vm);
+    // After the store: a collection during it may have promoted the set
+    WRITE_BARRIER(set, value);
+    return added;
+}
+
+bool setHas(ObjSet* set, Value value) {
+    Value unused;
+    return tableGet(&set->table, value, &unused);
+}
+
+bool setRemove(ObjSet* set, Value value) {
+    return tableDelete(&set->table, value);
+}
+
+bool setNext(ObjSet* set, int* cursor, Value* value) {
+    Entry* entry = tableNext(&set->table, cursor);
+    if (entry == NULL) return false;
+    *value = entry->key;
+    return true;
+}
+
 // ---- Print ----
 
 void printObject(Value value) {
@@ -186,6 +392,23 @@ void printObject(Value value) {
             printf("{...}");
             break;
         }
+        case OBJ_RANGE: {
+            ObjRange* range = AS_RANGE(value);
+            printf("<range %g..%g>", range->start, range->end);
+            break;
+        }
+        case OBJ_SET: {
+            ObjSet* set = AS_SET(value);
+            printf("set([");
+            int cursor = 0;
+            Value member;
+            for (bool first = true; setNext(set, &cursor, &member); first = false) {
+                if (!first) printf(", ");
+                printValue(member);
+            }
+            printf("])");
+            break;
+        }
     }
 }
 
@@ -193,40 +416,35 @@ void printObject(Value value) {
 
 void freeObject(Obj* object) {
     switch (object->type) {
-        case OBJ_STRING: {
-            ObjString* string = (ObjString*)object;
-            reallocate(object, sizeof(ObjString) + string->length + 1, 0);
-            break;
-        }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-            FREE(ObjFunction, object);
-            break;
-        }
-        case OBJ_CLOSURE: {
-            ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+            if (function->regChunk != NULL) {
+                freeRegChunk(function->regChunk);
+                FREE(RegChunk, function->regChunk);
+            }
+            if (function->jitCode != NULL) jitFree(function->jitCode);
             break;
         }
-        case OBJ_UPVALUE:
-            FREE(ObjUpvalue, object);
-            break;
-        case OBJ_NATIVE:
-            FREE(ObjNative, object);
-            break;
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
             FREE_ARRAY(Value, list->items, list->capacity);
-            FREE(ObjList, object);
             break;
         }
         case OBJ_MAP: {
             ObjMap* map = (ObjMap*)object;
+            FREE_ARRAY(Value, map->values, map->valueCapacity);
             freeTable(&map->table);
-            FREE(ObjMap, object);
             break;
         }
+        case OBJ_SET:
+            freeTable(&((ObjSet*)object)->table);
+            break;
+        case OBJ_STRING:
+        case OBJ_UPVALUE:
+        case OBJ_NATIVE:
+        case OBJ_RANGE:
+            break;
     }
+    freeObjectMemory(object);
 }
@@ -5,6 +5,7 @@
 #include "value.h"
 #include "chunk.h"
 #include "table.h"
+#include "memory.h"
 
 typedef enum {
     OBJ_STRING,
@@ -14,14 +15,68 @@ typedef enum {
     OBJ_NATIVE,
     OBJ_LIST,
     OBJ_MAP,
+    OBJ_RANGE,
+    OBJ_SET,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_SET + 1)
+
+// Mark bits live in the object's heap page (see heap.h)
 struct Obj {
-    ObjType type;
-    bool isMarked;
-    struct Obj* next;
+    uint8_t type;       // ObjType
+    bool isLarge;       // behind a LargeObject header rather than in a page
+    bool isOld;         // survived a collection
+    bool isRemembered;  // in vm->remembered
 };
 
+// The slot of an object moved by compaction holds its new address
+typedef struct {
+    Obj obj;
+    Obj* to;
+} ObjForward;
+
+// Where an object is now: its copy if compaction moved it, else itself
+static inline Obj* forwardObject(Obj* object) {
+    if (object == NULL || object->isLarge || !HEAP_PAGE_OF(object)->evacuating) {
+        return object;
+    }
+    return ((ObjForward*)object)->to;
+}
+
+// Write barrier: use after storing 'value' into 'owner'. An old object
+// that now references a young one is remembered, so the next minor
+// collection traces it; while a full collection is marking, a marked
+// owner shades the value (see memory.c).
+#define WRITE_BARRIER(owner, value) \
+    do { \
+        Obj* owner_ = (Obj*)(owner); \
+        Value value_ = (value); \
+        if (UNLIKELY(owner_->isOld || gcMarking) && IS_OBJ(value_)) { \
+            writeBarrier(owner_, AS_OBJ(value_)); \
+        } \
+    } while (false)
+
+// Lists use their own barrier: a remembered list also records which items
+// were written, so a minor collection rescans only that range rather than
+// the whole (possibly huge) list. Natives that move items around in place
+// call LIST_PERMUTED instead.
+#define LIST_WRITE_BARRIER(list, index, value) \
+    do { \
+        ObjList* list_ = (list); \
+        Value value_ = (value); \
+        if (UNLIKELY(list_->obj.isOld || gcMarking) && IS_OBJ(value_)) { \
+            listWriteBarrier(list_, (index), AS_OBJ(value_)); \
+        } \
+    } while (false)
+
+#define LIST_PERMUTED(list) \
+    do { \
+        ObjList* list_ = (list); \
+        if (list_->obj.isRemembered || gcMarking) { \
+            listPermuted(list_); \
+        } \
+    } while (false)
+
 // Type checks
 #define OBJ_TYPE(value)       (AS_OBJ(value)->type)
 #define IS_STRING(value)      isObjType(value, OBJ_STRING)
@@ -30,6 +85,8 @@ struct Obj {
 #define IS_NATIVE(value)      isObjType(value, OBJ_NATIVE)
 #define IS_LIST(value)        isObjType(value, OBJ_LIST)
 #define IS_MAP(value)         isObjType(value, OBJ_MAP)
+#define IS_RANGE(value)       isObjType(value, OBJ_RANGE)
+#define IS_SET(value)         isObjType(value, OBJ_SET)
 
 // Unwrap
 #define AS_STRING(value)      ((ObjString*)AS_OBJ(value))
@@ -39,6 +96,8 @@ struct Obj {
 #define AS_NATIVE(value)      ((ObjNative*)AS_OBJ(value))
 #define AS_LIST(value)        ((ObjList*)AS_OBJ(value))
 #define AS_MAP(value)         ((ObjMap*)AS_OBJ(value))
+#define AS_RANGE(value)       ((ObjRange*)AS_OBJ(value))
+#define AS_SET(value)         ((ObjSet*)AS_OBJ(value))
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -58,6 +117,9 @@ typedef struct {
     int arity;
     int upvalueCount;
     Chunk chunk;
+    RegChunk* regChunk;     // register-mode translation (--vm=register), or NULL
+    uint32_t hotness;       // calls + loop back-edges (--jit)
+    struct JitCode* jitCode; // machine code (--jit), or NULL
     ObjString* name;
 } ObjFunction;
 
@@ -72,9 +134,9 @@ typedef struct ObjUpvalue {
 // ---- Closure ----
 typedef struct {
     Obj obj;
-    ObjFunction* function;
-    ObjUpvalue** upvalues;
     int upvalueCount;
+    ObjFunction* function;
+    ObjUpvalue* upvalues[];     // flexible array member
 } ObjClosure;
 
 // ---- Native Function ----
@@ -94,14 +156,44 @@ typedef struct {
     int count;
     int capacity;
     Value* items;
+    int dirtyLow;       // items written since the last GC, while remembered
+    int dirtyHigh;
 } ObjList;
 
 // ---- Map ----
+// A map starts in shape mode: its key set is a shared Shape and its values sit
+// in a dense array indexed by slot. Deleting a key, growing past
+// SHAPE_MAX_KEYS or a key that is not a string moves it to dictionary mode
+// (shape == NULL, entries in table).
 typedef struct {
     Obj obj;
+    int valueCapacity;
+    struct Shape* shape;
+    Value* values;
     Table table;
 } ObjMap;
 
+// ---- Range ----
+// Lazy numeric sequence start, start+step, ... up to (not including) end.
+// Only created for `for x in range(...)`; range() itself still returns a list.
+// Each loop gets its own range and moves 'next' along by adding step, as
+// range() does, so both give the same values.
+typedef struct {
+    Obj obj;
+    double start;
+    double end;
+    double step;
+    double next;
+} ObjRange;
+
+// ---- Set ----
+// The members are the keys of a table (whose values are nil), so they hash
+// and compare as map keys do and come back in the order they were added.
+typedef struct {
+    Obj obj;
+    Table table;
+} ObjSet;
+
 // ---- Constructors ----
 ObjString* copyString(VM* vm, const char* chars, int length);
 ObjString* takeString(VM* vm, char* chars, int length);
@@ -111,9 +203,35 @@ ObjClosure* newClosure(VM* vm, ObjFunction* function);
 ObjNative* newNative(VM* vm, NativeFn function, const char* name, int arity);
 ObjList* newList(VM* vm);
 ObjMap* newMap(VM* vm);
+ObjRange* newRange(VM* vm, double start, double end, double step);
+ObjSet* newSet(VM* vm);
 
 // ---- Operations ----
 void listAppend(VM* vm, ObjList* list, Value value);
+// Remember an old list and widen its dirty range (see LIST_WRITE_BARRIER)
+void rememberListRange(ObjList* list, int low, int high);
+void listWriteBarrier(ObjList* list, int index, Obj* value);
+void listPermuted(ObjList* list);
+bool mapGet(ObjMap* map, ObjString* key, Value* value);
+void mapSet(VM* vm, ObjMap* map, ObjString* key, Value value);
+// map[key] = a new string copied from chars (GC-safe for natives)
+void mapSetString(VM* vm, ObjMap* map, const char* key,
+                  const char* chars, int length);
+bool mapDelete(ObjMap* map, ObjString* key);
+// The same for a key of any type (map[key] in scripts)
+bool mapGetKey(ObjMap* map, Value key, Value* value);
+void mapSetKey(VM* vm, ObjMap* map, Value key, Value value);
+bool mapDeleteKey(ObjMap* map, Value key);
+int mapCount(ObjMap* map);
+// Iterate entries in insertion order: start with *cursor = 0, call until it
+// returns false.
+bool mapNext(ObjMap* map, int* cursor, Value* key, Value* value);
+// Add a member; false if it was one already
+bool setAdd(VM* vm, ObjSet* set, Value value);
+bool setHas(ObjSet* set, Value value);
+bool setRemove(ObjSet* set, Value value);
+// Iterate members in insertion order, as mapNext
+bool setNext(ObjSet* set, int* cursor, Value* value);
 void printObject(Value value);
 void freeObject(Obj* object);
 void markObject(Obj* object);
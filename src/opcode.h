@@ -30,7 +30,7 @@ typedef enum {
     // Variables
     OP_GET_LOCAL,       // 1-byte slot index
     OP_SET_LOCAL,
-    OP_GET_GLOBAL,      // 1-byte constant index (name)
+    OP_GET_GLOBAL,      // 2-byte global slot
     OP_SET_GLOBAL,
     OP_DEFINE_GLOBAL,
     OP_GET_UPVALUE,
@@ -43,6 +43,7 @@ typedef enum {
 
     // Functions
     OP_CALL,            // 1-byte arg count
+    OP_TAIL_CALL,       // 1-byte arg count; 'return f(...)': reuse the caller's frame
     OP_CLOSURE,         // 1-byte constant index + upvalue descriptors
     OP_RETURN,
     OP_CLOSE_UPVALUE,
@@ -52,8 +53,8 @@ typedef enum {
     OP_BUILD_MAP,       // 1-byte entry count (pairs)
     OP_INDEX_GET,
     OP_INDEX_SET,
-    OP_GET_PROPERTY,    // 1-byte constant index (property name)
-    OP_SET_PROPERTY,    // 1-byte constant index (property name)
+    OP_GET_PROPERTY,    // 1-byte constant index (property name) + 1-byte IC slot
+    OP_SET_PROPERTY,    // 1-byte constant index (property name) + 1-byte IC slot
 
     // Utility
     OP_PRINT,
@@ -65,6 +66,37 @@ typedef enum {
     OP_POP_HANDLER,
     OP_THROW,
     OP_IMPORT,          // 1-byte path constant + 1-byte name constant
+
+    // Iteration
+    OP_RANGE,           // 1-byte arg count; precedes OP_CALL: builtin range() -> lazy ObjRange
+    OP_FOR_ITER,        // 1-byte slot + 2-byte exit jump: advance iterator in slots [slot..slot+2]
+
+    // Intrinsic calls to built-ins; 2-byte global slot of the name, checked
+    // at run time so a rebound name falls back to an ordinary call
+    OP_LEN,             // len(x)
+    OP_TYPE,            // type(x)
+    OP_STR,             // str(x)
+    OP_APPEND,          // append(list, x)
+    OP_CONTAINS,        // contains(xs, x)
+
+    // Superinstructions (emitted only by the peephole pass)
+    OP_SET_LOCAL_POP,       // SET_LOCAL + POP
+    OP_SET_GLOBAL_POP,      // SET_GLOBAL + POP
+    OP_INC_LOCAL,           // local = local + constant; 1-byte slot + 1-byte constant
+    OP_INC_GLOBAL,          // global = global + constant; 2-byte slot + 1-byte constant
+    OP_POP_JUMP_IF_FALSE,   // pop condition, 2-byte forward jump if falsey
+    OP_LESS_JUMP,           // pop two, 2-byte forward jump unless a < b
+    OP_LESS_CONST_JUMP,     // 1-byte constant + 2-byte jump: pop a, jump unless a < k
+    OP_LESS_LOCALS_JUMP,    // 1-byte slot a + 1-byte slot b + 2-byte jump unless a < b
+
+    // Quickened forms (written over the generic opcode at run time, never emitted)
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_GREATER_NUM,
+    OP_GREATER_EQUAL_NUM,
+    OP_LESS_NUM,
+    OP_LESS_EQUAL_NUM,
 } OpCode;
 
 #endif
@@ -59,21 +59,17 @@ Value parallelExec(VM* vm, int argCount, Value* args) {
         ObjMap* map = newMap(vm);
         *vm->stackTop++ = OBJ_VAL(map); // GC protect
 
-        ObjString* outKey = copyString(vm, "output", 6);
         int outLen = tasks[i].result.stdoutLength;
         if (outLen > 0 && tasks[i].result.stdoutData[outLen - 1] == '\n') outLen--;
-        ObjString* outVal = copyString(vm,
+        mapSetString(vm, map, "output",
             tasks[i].result.stdoutData ? tasks[i].result.stdoutData : "", outLen);
-        tableSet(&map->table, outKey, OBJ_VAL(outVal));
 
         ObjString* exitKey = copyString(vm, "exitCode", 8);
-        tableSet(&map->table, exitKey, NUMBER_VAL(tasks[i].result.exitCode));
+        mapSet(vm, map, exitKey, NUMBER_VAL(tasks[i].result.exitCode));
 
-        ObjString* stderrKey = copyString(vm, "stderr", 6);
-        ObjString* stderrVal = copyString(vm,
+        mapSetString(vm, map, "stderr",
             tasks[i].result.stderrData ? tasks[i].result.stderrData : "",
             tasks[i].result.stderrLength);
-        tableSet(&map->table, stderrKey, OBJ_VAL(stderrVal));
 
         vm->stackTop--; // unprotect map
         listAppend(vm, results, OBJ_VAL(map));
@@ -378,7 +378,8 @@ static AstNode* parseMap(Parser* parser) {
             skipNewlines(parser);
             if (check(parser, TOKEN_RIGHT_BRACE)) break; // trailing comma
 
-            // Key: string or identifier
+            // Key: string, identifier, or any other expression ({1: x},
+            // {(name): x})
             AstNode* key;
             if (matchToken(parser, TOKEN_STRING)) {
                 key = parseString(parser);
@@ -388,8 +389,8 @@ static AstNode* parseMap(Parser* parser) {
                     parser->previous.start, parser->previous.length, false,
                     parser->previous.line, parser->previous.column);
             } else {
-                errorAtCurrent(parser, "Expected string or identifier as map key.");
-                return NULL;
+                key = parseExpression(parser);
+                if (key == NULL) return NULL;
             }
             nodeListAdd(&keys, key);
 
@@ -0,0 +1,82 @@
+#ifndef glipt_regcode_h
+#define glipt_regcode_h
+
+#include "common.h"
+
+// Register-mode bytecode (run with --vm=register). Each instruction is one
+// 32-bit word: opcode in the low byte, then operands A, B, C (8 bits each)
+// or A and a 16-bit Bx / signed sBx. Registers are frame slots: R[0] is the
+// callee, parameters follow, then locals and temporaries.
+//
+// Compare-and-jump instructions are followed by a second word holding a
+// signed jump offset. All offsets are relative to the next instruction.
+
+typedef enum {
+    ROP_MOVE,           // R[A] = R[B]
+    ROP_LOADK,          // R[A] = K[Bx]
+    ROP_LOADNIL,        // R[A] = nil
+    ROP_LOADBOOL,       // R[A] = (B != 0)
+    ROP_GET_GLOBAL,     // R[A] = globals[Bx]
+    ROP_SET_GLOBAL,     // globals[Bx] = R[A]
+
+    ROP_ADD,            // R[A] = R[B] + R[C]
+    ROP_SUBTRACT,       // R[A] = R[B] - R[C]
+    ROP_MULTIPLY,       // R[A] = R[B] * R[C]
+    ROP_DIVIDE,         // R[A] = R[B] / R[C]
+    ROP_MODULO,         // R[A] = R[B] % R[C]
+    ROP_ADDK,           // R[A] = R[B] + K[C] (K[C] is a number)
+    ROP_SUBTRACTK,      // R[A] = R[B] - K[C] (K[C] is a number)
+
+    ROP_EQUAL,          // R[A] = R[B] == R[C]
+    ROP_NOT_EQUAL,      // R[A] = R[B] != R[C]
+    ROP_LESS,           // R[A] = R[B] < R[C]
+    ROP_LESS_EQUAL,     // R[A] = R[B] <= R[C]
+    ROP_GREATER,        // R[A] = R[B] > R[C]
+    ROP_GREATER_EQUAL,  // R[A] = R[B] >= R[C]
+    ROP_NOT,            // R[A] = not R[B]
+    ROP_NEGATE,         // R[A] = -R[B]
+
+    ROP_JUMP,           // pc += sBx
+    ROP_JUMP_IF_FALSE,  // if R[A] is falsey: pc += sBx
+    ROP_JUMP_IF_TRUE,   // if R[A] is truthy: pc += sBx
+    ROP_JUMP_UNLESS_LESS,       // if !(R[A] < R[B]): pc += next word
+    ROP_JUMP_UNLESS_LESS_EQUAL, // if !(R[A] <= R[B]): pc += next word
+
+    ROP_FOR_PREP,       // for R[A] in R[A]..R[A+1]: if done pc += sBx, else R[A+2] = R[A]
+    ROP_FOR_LOOP,       // R[A] += 1; if R[A] < R[A+1]: R[A+2] = R[A], pc += sBx
+
+    ROP_INDEX_GET,      // R[A] = R[B][R[C]]
+    ROP_INDEX_SET,      // R[A][R[B]] = R[C]
+    ROP_BUILD_LIST,     // R[A] = [R[B] .. R[B+C-1]]
+
+    ROP_CALL,           // R[A] = R[A](R[A+1] .. R[A+B])
+    ROP_TAIL_CALL,      // as ROP_CALL, a register callee reusing this frame
+    ROP_RETURN,         // return R[A]
+    ROP_RETURN_NIL,
+} RegOpCode;
+
+#define REG_ABC(op, a, b, c) \
+    ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 24))
+#define REG_ABX(op, a, bx) \
+    ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(uint16_t)(bx) << 16))
+
+#define REG_OP(i)  ((uint8_t)((i) & 0xff))
+#define REG_A(i)   ((uint8_t)(((i) >> 8) & 0xff))
+#define REG_B(i)   ((uint8_t)(((i) >> 16) & 0xff))
+#define REG_C(i)   ((uint8_t)((i) >> 24))
+#define REG_BX(i)  ((uint16_t)((i) >> 16))
+#define REG_SBX(i) ((int16_t)((i) >> 16))
+
+typedef struct {
+    int count;
+    int capacity;
+    uint32_t* code;
+    int* lines;         // source line for each word
+    int maxRegisters;   // frame size: parameters + locals + temporaries
+} RegChunk;
+
+void initRegChunk(RegChunk* chunk);
+void freeRegChunk(RegChunk* chunk);
+void writeRegChunk(RegChunk* chunk, uint32_t instruction, int line);
+
+#endif
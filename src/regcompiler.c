@@ -0,0 +1,653 @@
+#include "regcompiler.h"
+#include "memory.h"
+
+// Register backend. Runs after the stack compiler has finished a function
+// and walks the same AST again. Locals live in fixed registers (local i is
+// R[i], matching the stack VM's slot layout), temporaries are allocated
+// above them and released at the end of each expression statement.
+//
+// Anything not handled here makes the whole function fall back to its stack
+// code, so the backend can grow one construct at a time.
+
+typedef struct {
+    const char* name;
+    int length;
+    int depth;
+} RegLocal;
+
+typedef struct {
+    int breakJumps[256];
+    int breakCount;
+    int continueJumps[256];
+    int continueCount;
+} RegLoop;
+
+typedef struct {
+    VM* vm;
+    ObjFunction* function;
+    RegChunk chunk;
+
+    RegLocal locals[UINT8_COUNT];
+    int localCount;
+    int scopeDepth;
+    int freeReg;        // first register not holding a local or live temporary
+
+    RegLoop* loop;
+    bool failed;        // unsupported construct: keep the stack code
+} RegCompiler;
+
+static void statement(RegCompiler* rc, AstNode* node);
+static void expression(RegCompiler* rc, AstNode* node, int target);
+
+// ---- Emitting ----
+
+static int emit(RegCompiler* rc, uint32_t instruction, int line) {
+    writeRegChunk(&rc->chunk, instruction, line);
+    return rc->chunk.count - 1;
+}
+
+static bool isCompareJump(uint32_t instruction) {
+    return REG_OP(instruction) == ROP_JUMP_UNLESS_LESS ||
+           REG_OP(instruction) == ROP_JUMP_UNLESS_LESS_EQUAL;
+}
+
+// Point the jump at 'index' to 'target'. Compare-jumps keep their offset in
+// the following word; the rest use the 16-bit sBx field.
+static void patchJumpTo(RegCompiler* rc, int index, int target) {
+    uint32_t* code = rc->chunk.code;
+    if (isCompareJump(code[index])) {
+        code[index + 1] = (uint32_t)(int32_t)(target - (index + 2));
+        return;
+    }
+    int offset = target - (index + 1);
+    if (offset < INT16_MIN || offset > INT16_MAX) {
+        rc->failed = true;
+        return;
+    }
+    code[index] = REG_ABX(REG_OP(code[index]), REG_A(code[index]), (int16_t)offset);
+}
+
+static void patchJump(RegCompiler* rc, int index) {
+    patchJumpTo(rc, index, rc->chunk.count);
+}
+
+static int constant(RegCompiler* rc, Value value) {
+    vmPush(rc->vm, value);
+    int index = addConstant(&rc->function->chunk, value);
+    WRITE_BARRIER(rc->function, value);
+    vmPop(rc->vm);
+    if (index > UINT16_MAX) rc->failed = true;
+    return index;
+}
+
+static int globalSlot(RegCompiler* rc, const char* name, int length) {
+    int slot = vmGlobalSlot(rc->vm, copyString(rc->vm, name, length));
+    if (slot > UINT16_MAX) rc->failed = true;
+    return slot;
+}
+
+// ---- Registers and scopes ----
+
+static int reserve(RegCompiler* rc) {
+    if (rc->freeReg >= UINT8_MAX) {
+        rc->failed = true;
+        return 0;
+    }
+    int reg = rc->freeReg++;
+    if (rc->freeReg > rc->chunk.maxRegisters) rc->chunk.maxRegisters = rc->freeReg;
+    return reg;
+}
+
+static bool isTemporary(RegCompiler* rc, int reg) {
+    return reg >= rc->localCount;
+}
+
+// The next free register becomes a named local
+static void addLocal(RegCompiler* rc, const char* name, int length) {
+    RegLocal* local = &rc->locals[rc->localCount++];
+    local->name = name;
+    local->length = length;
+    local->depth = rc->scopeDepth;
+}
+
+static int resolveLocal(RegCompiler* rc, const char* name, int length) {
+    for (int i = rc->localCount - 1; i >= 0; i--) {
+        if (rc->locals[i].length == length &&
+            memcmp(rc->locals[i].name, name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void beginScope(RegCompiler* rc) {
+    rc->scopeDepth++;
+}
+
+static void endScope(RegCompiler* rc) {
+    rc->scopeDepth--;
+    while (rc->localCount > 0 &&
+           rc->locals[rc->localCount - 1].depth > rc->scopeDepth) {
+        rc->localCount--;
+    }
+    rc->freeReg = rc->localCount;
+}
+
+// ---- Expressions ----
+
+// Register holding the value of 'node': a local's own register, or a new
+// temporary the expression is compiled into
+static int anyRegister(RegCompiler* rc, AstNode* node) {
+    if (node->type == NODE_VARIABLE) {
+        int local = resolveLocal(rc, node->as.variable.name, node->as.variable.length);
+        if (local != -1) return local;
+    }
+    int reg = reserve(rc);
+    expression(rc, node, reg);
+    return reg;
+}
+
+static RegOpCode binaryOp(TokenType op) {
+    switch (op) {
+        case TOKEN_PLUS:          return ROP_ADD;
+        case TOKEN_MINUS:         return ROP_SUBTRACT;
+        case TOKEN_STAR:          return ROP_MULTIPLY;
+        case TOKEN_SLASH:         return ROP_DIVIDE;
+        case TOKEN_PERCENT:       return ROP_MODULO;
+        case TOKEN_EQUAL_EQUAL:   return ROP_EQUAL;
+        case TOKEN_BANG_EQUAL:    return ROP_NOT_EQUAL;
+        case TOKEN_LESS:          return ROP_LESS;
+        case TOKEN_LESS_EQUAL:    return ROP_LESS_EQUAL;
+        case TOKEN_GREATER:       return ROP_GREATER;
+        case TOKEN_GREATER_EQUAL: return ROP_GREATER_EQUAL;
+        default:                  return ROP_RETURN_NIL; // not a binary operator
+    }
+}
+
+// R[target] = R[left] op right, using the K forms for '+ number' / '- number'
+static void arithmetic(RegCompiler* rc, RegOpCode op, int target, int left,
+                       AstNode* right, int line) {
+    if ((op == ROP_ADD || op == ROP_SUBTRACT) && right->type == NODE_LITERAL &&
+        right->as.literal.value.type == LIT_NUMBER) {
+        int k = constant(rc, numberValue(right->as.literal.value.as.number));
+        if (k <= UINT8_MAX) {
+            emit(rc, REG_ABC(op == ROP_ADD ? ROP_ADDK : ROP_SUBTRACTK, target, left, k), line);
+            return;
+        }
+    }
+    int mark = rc->freeReg;
+    int r = anyRegister(rc, right);
+    emit(rc, REG_ABC(op, target, left, r), line);
+    rc->freeReg = mark;
+}
+
+static void binary(RegCompiler* rc, AstNode* node, int target) {
+    int line = node->line;
+    TokenType op = node->as.binary.op;
+
+    if (op == TOKEN_AND || op == TOKEN_AMP_AMP || op == TOKEN_OR || op == TOKEN_PIPE_PIPE) {
+        // The left value is the result when it decides; evaluate into a
+        // temporary if the target is a local the right side might read
+        int reg = isTemporary(rc, target) ? target : reserve(rc);
+        expression(rc, node->as.binary.left, reg);
+        bool isAnd = op == TOKEN_AND || op == TOKEN_AMP_AMP;
+        int skip = emit(rc, REG_ABX(isAnd ? ROP_JUMP_IF_FALSE : ROP_JUMP_IF_TRUE, reg, 0), line);
+        expression(rc, node->as.binary.right, reg);
+        patchJump(rc, skip);
+        if (reg != target) {
+            emit(rc, REG_ABC(ROP_MOVE, target, reg, 0), line);
+            rc->freeReg = reg;
+        }
+        return;
+    }
+
+    RegOpCode rop = binaryOp(op);
+    if (rop == ROP_RETURN_NIL) {
+        rc->failed = true;
+        return;
+    }
+    int mark = rc->freeReg;
+    int left = anyRegister(rc, node->as.binary.left);
+    arithmetic(rc, rop, target, left, node->as.binary.right, line);
+    rc->freeReg = mark;
+}
+
+static void call(RegCompiler* rc, AstNode* node, int target, RegOpCode op) {
+    int line = node->line;
+    int argCount = node->as.call.argCount;
+    if (argCount > UINT8_MAX) {
+        rc->failed = true;
+        return;
+    }
+
+    // Callee and arguments go in consecutive registers; a fresh temporary
+    // target can serve as the base itself
+    int mark = rc->freeReg;
+    int base = (isTemporary(rc, target) && target == rc->freeReg - 1) ? target : reserve(rc);
+    expression(rc, node->as.call.callee, base);
+    for (int i = 0; i < argCount; i++) {
+        expression(rc, node->as.call.args[i], reserve(rc));
+    }
+    emit(rc, REG_ABC(op, base, argCount, 0), line);
+    if (base != target) {
+        emit(rc, REG_ABC(ROP_MOVE, target, base, 0), line);
+    }
+    rc->freeReg = mark;
+}
+
+static void expression(RegCompiler* rc, AstNode* node, int target) {
+    if (rc->failed) return;
+    int line = node->line;
+    int mark = rc->freeReg;
+
+    switch (node->type) {
+        case NODE_LITERAL: {
+            LiteralValue* lit = &node->as.literal.value;
+            switch (lit->type) {
+                case LIT_NUMBER:
+                    emit(rc, REG_ABX(ROP_LOADK, target,
+                                     constant(rc, numberValue(lit->as.number))), line);
+                    break;
+                case LIT_STRING: {
+                    ObjString* string = copyString(rc->vm, lit->as.string.chars,
+                                                   lit->as.string.length);
+                    emit(rc, REG_ABX(ROP_LOADK, target, constant(rc, OBJ_VAL(string))), line);
+                    break;
+                }
+                case LIT_BOOL:
+                    emit(rc, REG_ABC(ROP_LOADBOOL, target, lit->as.boolean ? 1 : 0, 0), line);
+                    break;
+                case LIT_NIL:
+                    emit(rc, REG_ABC(ROP_LOADNIL, target, 0, 0), line);
+                    break;
+            }
+            break;
+        }
+
+        case NODE_VARIABLE: {
+            const char* name = node->as.variable.name;
+            int length = node->as.variable.length;
+            int local = resolveLocal(rc, name, length);
+            if (local == -1) {
+                emit(rc, REG_ABX(ROP_GET_GLOBAL, target, globalSlot(rc, name, length)), line);
+            } else if (local != target) {
+                emit(rc, REG_ABC(ROP_MOVE, target, local, 0), line);
+            }
+            break;
+        }
+
+        case NODE_UNARY: {
+            TokenType op = node->as.unary.op;
+            if (op != TOKEN_MINUS && op != TOKEN_BANG && op != TOKEN_NOT) {
+                rc->failed = true;
+                break;
+            }
+            int operand = anyRegister(rc, node->as.unary.operand);
+            emit(rc, REG_ABC(op == TOKEN_MINUS ? ROP_NEGATE : ROP_NOT, target, operand, 0), line);
+            break;
+        }
+
+        case NODE_BINARY:
+            binary(rc, node, target);
+            break;
+
+        case NODE_CALL:
+            call(rc, node, target, ROP_CALL);
+            break;
+
+        case NODE_INDEX: {
+            int object = anyRegister(rc, node->as.index.object);
+            int index = anyRegister(rc, node->as.index.index);
+            emit(rc, REG_ABC(ROP_INDEX_GET, target, object, index), line);
+            break;
+        }
+
+        case NODE_INDEX_SET: {
+            int object = anyRegister(rc, node->as.indexSet.object);
+            int index = anyRegister(rc, node->as.indexSet.index);
+            int value = anyRegister(rc, node->as.indexSet.value);
+            emit(rc, REG_ABC(ROP_INDEX_SET, object, index, value), line);
+            if (value != target) emit(rc, REG_ABC(ROP_MOVE, target, value, 0), line);
+            break;
+        }
+
+        case NODE_LIST: {
+            int count = node->as.list.count;
+            if (count > UINT8_MAX) {
+                rc->failed = true;
+                break;
+            }
+            int base = rc->freeReg;
+            for (int i = 0; i < count; i++) {
+                expression(rc, node->as.list.elements[i], reserve(rc));
+            }
+            emit(rc, REG_ABC(ROP_BUILD_LIST, target, base, count), line);
+            break;
+        }
+
+        default:
+            // Closures, maps, properties, pipes, exec, match, assignment
+            // inside expressions, ...: stay on the stack VM
+            rc->failed = true;
+            break;
+    }
+
+    rc->freeReg = mark;
+}
+
+// Store the value of 'node' into a local's register. and/or write their
+// left operand first, so they go through a temporary.
+static void assignLocal(RegCompiler* rc, AstNode* node, int local) {
+    if (node->type == NODE_BINARY) {
+        TokenType op = node->as.binary.op;
+        if (op == TOKEN_AND || op == TOKEN_AMP_AMP || op == TOKEN_OR || op == TOKEN_PIPE_PIPE) {
+            int mark = rc->freeReg;
+            int reg = reserve(rc);
+            expression(rc, node, reg);
+            emit(rc, REG_ABC(ROP_MOVE, local, reg, 0), node->line);
+            rc->freeReg = mark;
+            return;
+        }
+    }
+    expression(rc, node, local);
+}
+
+static void assignGlobal(RegCompiler* rc, const char* name, int length,
+                         AstNode* value, int line) {
+    int mark = rc->freeReg;
+    int reg = anyRegister(rc, value);
+    emit(rc, REG_ABX(ROP_SET_GLOBAL, reg, globalSlot(rc, name, length)), line);
+    rc->freeReg = mark;
+}
+
+// ---- Statements ----
+
+// Jump taken when 'condition' is false. Comparisons fuse into a
+// compare-and-jump; everything else tests a register.
+static int conditionJump(RegCompiler* rc, AstNode* condition) {
+    int line = condition->line;
+    int mark = rc->freeReg;
+    int jump;
+
+    TokenType op = condition->type == NODE_BINARY ? condition->as.binary.op : TOKEN_EOF;
+    if (op == TOKEN_LESS || op == TOKEN_LESS_EQUAL ||
+        op == TOKEN_GREATER || op == TOKEN_GREATER_EQUAL) {
+        int left = anyRegister(rc, condition->as.binary.left);
+        int right = anyRegister(rc, condition->as.binary.right);
+        // a > b is b < a, a >= b is b <= a
+        bool swap = op == TOKEN_GREATER || op == TOKEN_GREATER_EQUAL;
+        RegOpCode rop = (op == TOKEN_LESS || op == TOKEN_GREATER)
+            ? ROP_JUMP_UNLESS_LESS : ROP_JUMP_UNLESS_LESS_EQUAL;
+        jump = emit(rc, REG_ABC(rop, swap ? right : left, swap ? left : right, 0), line);
+        emit(rc, 0, line); // offset word
+    } else {
+        int reg = anyRegister(rc, condition);
+        jump = emit(rc, REG_ABX(ROP_JUMP_IF_FALSE, reg, 0), line);
+    }
+
+    rc->freeReg = mark;
+    return jump;
+}
+
+static void block(RegCompiler* rc, AstNode* node) {
+    if (node->type != NODE_BLOCK) {
+        statement(rc, node);
+        return;
+    }
+    beginScope(rc);
+    for (int i = 0; i < node->as.block.count && !rc->failed; i++) {
+        statement(rc, node->as.block.statements[i]);
+    }
+    endScope(rc);
+}
+
+static void whileStatement(RegCompiler* rc, AstNode* node) {
+    int line = node->line;
+    RegLoop loop;
+    loop.breakCount = 0;
+    loop.continueCount = 0;
+    RegLoop* enclosing = rc->loop;
+    rc->loop = &loop;
+
+    int loopStart = rc->chunk.count;
+    int exitJump = conditionJump(rc, node->as.whileStmt.condition);
+    block(rc, node->as.whileStmt.body);
+    int back = emit(rc, REG_ABX(ROP_JUMP, 0, 0), line);
+    patchJumpTo(rc, back, loopStart);
+    patchJump(rc, exitJump);
+
+    for (int i = 0; i < loop.continueCount; i++) patchJumpTo(rc, loop.continueJumps[i], loopStart);
+    for (int i = 0; i < loop.breakCount; i++) patchJump(rc, loop.breakJumps[i]);
+    rc->loop = enclosing;
+}
+
+// for i in a..b: R[base] counts, R[base + 1] is the end and R[base + 2] the
+// loop variable. One FOR_LOOP per iteration steps, tests and copies.
+static void forStatement(RegCompiler* rc, AstNode* node) {
+    int line = node->line;
+    AstNode* range = node->as.forStmt.iterable;
+    if (range->type != NODE_RANGE) {
+        rc->failed = true;
+        return;
+    }
+
+    RegLoop loop;
+    loop.breakCount = 0;
+    loop.continueCount = 0;
+    RegLoop* enclosing = rc->loop;
+    rc->loop = &loop;
+
+    beginScope(rc);
+    int base = reserve(rc);
+    expression(rc, range->as.range.start, base);
+    addLocal(rc, " index", 6);
+    expression(rc, range->as.range.end, reserve(rc));
+    addLocal(rc, " end", 4);
+    reserve(rc);
+    addLocal(rc, node->as.forStmt.varName, node->as.forStmt.varNameLength);
+
+    int prep = emit(rc, REG_ABX(ROP_FOR_PREP, base, 0), line);
+    int bodyStart = rc->chunk.count;
+    block(rc, node->as.forStmt.body);
+
+    for (int i = 0; i < loop.continueCount; i++) patchJump(rc, loop.continueJumps[i]);
+    int step = emit(rc, REG_ABX(ROP_FOR_LOOP, base, 0), line);
+    patchJumpTo(rc, step, bodyStart);
+    patchJump(rc, prep);
+    for (int i = 0; i < loop.breakCount; i++) patchJump(rc, loop.breakJumps[i]);
+
+    endScope(rc);
+    rc->loop = enclosing;
+}
+
+static void compoundAssign(RegCompiler* rc, AstNode* node) {
+    int line = node->line;
+    RegOpCode op;
+    switch (node->as.compoundAssign.op) {
+        case TOKEN_PLUS_EQUAL:  op = ROP_ADD; break;
+        case TOKEN_MINUS_EQUAL: op = ROP_SUBTRACT; break;
+        case TOKEN_STAR_EQUAL:  op = ROP_MULTIPLY; break;
+        case TOKEN_SLASH_EQUAL: op = ROP_DIVIDE; break;
+        default:
+            rc->failed = true;
+            return;
+    }
+
+    const char* name = node->as.compoundAssign.name;
+    int length = node->as.compoundAssign.length;
+    int local = resolveLocal(rc, name, length);
+    if (local != -1) {
+        arithmetic(rc, op, local, local, node->as.compoundAssign.value, line);
+        return;
+    }
+
+    int mark = rc->freeReg;
+    int slot = globalSlot(rc, name, length);
+    int reg = reserve(rc);
+    emit(rc, REG_ABX(ROP_GET_GLOBAL, reg, slot), line);
+    arithmetic(rc, op, reg, reg, node->as.compoundAssign.value, line);
+    emit(rc, REG_ABX(ROP_SET_GLOBAL, reg, slot), line);
+    rc->freeReg = mark;
+}
+
+static void statement(RegCompiler* rc, AstNode* node) {
+    if (rc->failed) return;
+    int line = node->line;
+
+    switch (node->type) {
+        case NODE_EXPRESSION_STMT: {
+            AstNode* expr = node->as.exprStmt.expression;
+            if (expr->type == NODE_ASSIGN) {
+                const char* name = expr->as.assign.name;
+                int length = expr->as.assign.length;
+                int local = resolveLocal(rc, name, length);
+                if (local != -1) {
+                    assignLocal(rc, expr->as.assign.value, local);
+                } else {
+                    assignGlobal(rc, name, length, expr->as.assign.value, line);
+                }
+            } else if (expr->type != NODE_VARIABLE) {
+                int mark = rc->freeReg;
+                expression(rc, expr, reserve(rc));
+                rc->freeReg = mark;
+            } else if (resolveLocal(rc, expr->as.variable.name, expr->as.variable.length) == -1) {
+                // A bare global still raises "Undefined variable"
+                int mark = rc->freeReg;
+                expression(rc, expr, reserve(rc));
+                rc->freeReg = mark;
+            }
+            break;
+        }
+
+        case NODE_VAR_DECL: {
+            const char* name = node->as.varDecl.name;
+            int length = node->as.varDecl.length;
+            int local = resolveLocal(rc, name, length);
+            if (local != -1) {
+                assignLocal(rc, node->as.varDecl.initializer, local);
+            } else {
+                // Same rule as the stack compiler: a new local in this scope
+                int reg = reserve(rc);
+                expression(rc, node->as.varDecl.initializer, reg);
+                addLocal(rc, name, length);
+            }
+            break;
+        }
+
+        case NODE_COMPOUND_ASSIGN:
+            compoundAssign(rc, node);
+            break;
+
+        case NODE_BLOCK:
+            block(rc, node);
+            break;
+
+        case NODE_IF: {
+            int thenJump = conditionJump(rc, node->as.ifStmt.condition);
+            block(rc, node->as.ifStmt.thenBranch);
+            if (node->as.ifStmt.elseBranch != NULL) {
+                int elseJump = emit(rc, REG_ABX(ROP_JUMP, 0, 0), line);
+                patchJump(rc, thenJump);
+                block(rc, node->as.ifStmt.elseBranch);
+                patchJump(rc, elseJump);
+            } else {
+                patchJump(rc, thenJump);
+            }
+            break;
+        }
+
+        case NODE_WHILE:
+            whileStatement(rc, node);
+            break;
+
+        case NODE_FOR:
+            forStatement(rc, node);
+            break;
+
+        case NODE_RETURN: {
+            AstNode* value = node->as.returnStmt.value;
+            if (value == NULL) {
+                emit(rc, REG_ABC(ROP_RETURN_NIL, 0, 0, 0), line);
+            } else if (value->type == NODE_CALL) {
+                // Tail position: a register callee takes over this frame.
+                // Anything else is called as usual, and the ROP_RETURN
+                // hands its result back.
+                int mark = rc->freeReg;
+                int base = reserve(rc);
+                call(rc, value, base, ROP_TAIL_CALL);
+                emit(rc, REG_ABC(ROP_RETURN, base, 0, 0), line);
+                rc->freeReg = mark;
+            } else {
+                int mark = rc->freeReg;
+                int reg = anyRegister(rc, value);
+                emit(rc, REG_ABC(ROP_RETURN, reg, 0, 0), line);
+                rc->freeReg = mark;
+            }
+            break;
+        }
+
+        case NODE_BREAK:
+        case NODE_CONTINUE: {
+            RegLoop* loop = rc->loop;
+            bool isBreak = node->type == NODE_BREAK;
+            if (loop == NULL || (isBreak ? loop->breakCount : loop->continueCount) >= 256) {
+                rc->failed = true;
+                break;
+            }
+            int jump = emit(rc, REG_ABX(ROP_JUMP, 0, 0), line);
+            if (isBreak) {
+                loop->breakJumps[loop->breakCount++] = jump;
+            } else {
+                loop->continueJumps[loop->continueCount++] = jump;
+            }
+            break;
+        }
+
+        default:
+            rc->failed = true;
+            break;
+    }
+}
+
+bool compileRegisterFunction(VM* vm, ObjFunction* function, AstNode* node) {
+    // Captured variables need the stack VM's upvalues
+    if (function->upvalueCount > 0) return false;
+
+    RegCompiler rc;
+    rc.vm = vm;
+    rc.function = function;
+    initRegChunk(&rc.chunk);
+    rc.localCount = 0;
+    rc.scopeDepth = 0;
+    rc.freeReg = 0;
+    rc.loop = NULL;
+    rc.failed = false;
+
+    // R[0] is the callee, parameters follow
+    reserve(&rc);
+    addLocal(&rc, "", 0);
+    beginScope(&rc);
+    for (int i = 0; i < node->as.function.paramCount; i++) {
+        reserve(&rc);
+        addLocal(&rc, node->as.function.params[i], node->as.function.paramLengths[i]);
+    }
+
+    AstNode* body = node->as.function.body;
+    if (body->type == NODE_BLOCK) {
+        for (int i = 0; i < body->as.block.count && !rc.failed; i++) {
+            statement(&rc, body->as.block.statements[i]);
+        }
+    } else {
+        statement(&rc, body);
+    }
+    emit(&rc, REG_ABC(ROP_RETURN_NIL, 0, 0, 0), node->line);
+
+    if (rc.failed) {
+        freeRegChunk(&rc.chunk);
+        return false;
+    }
+
+    function->regChunk = ALLOCATE(RegChunk, 1);
+    *function->regChunk = rc.chunk;
+    return true;
+}
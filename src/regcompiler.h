@@ -0,0 +1,14 @@
+#ifndef glipt_regcompiler_h
+#define glipt_regcompiler_h
+
+#include "ast.h"
+#include "object.h"
+#include "vm.h"
+
+// Translate a compiled function's body to register code (see regcode.h).
+// Functions that use constructs the register backend does not cover
+// (closures, upvalues, on failure, ...) are left on the stack VM; returns
+// whether function->regChunk was attached.
+bool compileRegisterFunction(VM* vm, ObjFunction* function, AstNode* node);
+
+#endif
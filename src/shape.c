@@ -0,0 +1,93 @@
+#include "shape.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+static Shape* newShape(VM* vm, Shape* parent, ObjString* key) {
+    Shape* shape = ALLOCATE(Shape, 1);
+    shape->count = parent != NULL ? parent->count + 1 : 0;
+    shape->keys = NULL;
+    if (shape->count > 0) {
+        shape->keys = ALLOCATE(ObjString*, shape->count);
+        for (int i = 0; i < parent->count; i++) shape->keys[i] = parent->keys[i];
+        shape->keys[parent->count] = key;
+    }
+    shape->transitions = NULL;
+    shape->transitionCount = 0;
+    shape->transitionCapacity = 0;
+
+    shape->next = vm->shapes;
+    vm->shapes = shape;
+    vm->shapeCount++;
+    return shape;
+}
+
+void initShapes(VM* vm) {
+    vm->shapes = NULL;
+    vm->shapeCount = 0;
+    vm->rootShape = newShape(vm, NULL, NULL);
+}
+
+void freeShapes(VM* vm) {
+    Shape* shape = vm->shapes;
+    while (shape != NULL) {
+        Shape* next = shape->next;
+        FREE_ARRAY(ObjString*, shape->keys, shape->count);
+        FREE_ARRAY(Shape*, shape->transitions, shape->transitionCapacity);
+        FREE(Shape, shape);
+        shape = next;
+    }
+    vm->shapes = NULL;
+    vm->rootShape = NULL;
+    vm->shapeCount = 0;
+}
+
+void markShapes(VM* vm) {
+    // Every key is the last key of some shape, so marking that one suffices.
+    for (Shape* shape = vm->shapes; shape != NULL; shape = shape->next) {
+        if (shape->count > 0) markObject((Obj*)shape->keys[shape->count - 1]);
+    }
+}
+
+static inline ObjString* lastKey(Shape* shape) {
+    return shape->keys[shape->count - 1];
+}
+
+static void addTransition(Shape* shape, Shape* child) {
+    uint32_t mask = (uint32_t)shape->transitionCapacity - 1;
+    uint32_t i = lastKey(child)->hash & mask;
+    while (shape->transitions[i] != NULL) i = (i + 1) & mask;
+    shape->transitions[i] = child;
+}
+
+Shape* shapeAddKey(VM* vm, Shape* shape, ObjString* key) {
+    if (shape->transitionCount > 0) {
+        uint32_t mask = (uint32_t)shape->transitionCapacity - 1;
+        for (uint32_t i = key->hash & mask; shape->transitions[i] != NULL;
+             i = (i + 1) & mask) {
+            if (lastKey(shape->transitions[i]) == key) return shape->transitions[i];
+        }
+    }
+
+    if (shape->count >= SHAPE_MAX_KEYS ||
+        shape->transitionCount >= SHAPE_MAX_TRANSITIONS ||
+        vm->shapeCount >= SHAPE_LIMIT) {
+        return NULL;
+    }
+
+    // Kept at most half full
+    if (shape->transitionCapacity < (shape->transitionCount + 1) * 2) {
+        Shape** old = shape->transitions;
+        int oldCapacity = shape->transitionCapacity;
+        shape->transitionCapacity = GROW_CAPACITY(oldCapacity);
+        shape->transitions = ALLOCATE_ZEROED(Shape*, shape->transitionCapacity);
+        for (int i = 0; i < oldCapacity; i++) {
+            if (old[i] != NULL) addTransition(shape, old[i]);
+        }
+        FREE_ARRAY(Shape*, old, oldCapacity);
+    }
+    Shape* child = newShape(vm, shape, key);
+    addTransition(shape, child);
+    shape->transitionCount++;
+    return child;
+}
@@ -0,0 +1,49 @@
+#ifndef glipt_shape_h
+#define glipt_shape_h
+
+#include "common.h"
+#include "value.h"
+
+// ---- Shapes (hidden classes) ----
+// A shape describes the ordered key set of a record-like map: key i lives in
+// value slot i. Shapes form a tree rooted at the empty shape; adding a key
+// follows (or creates) a transition to a child shape, so maps built with the
+// same keys in the same order share one shape. Shapes are owned by the VM and
+// live until it is freed.
+//
+// A shape's transitions are hashed by the key they add. A shape that already
+// has SHAPE_MAX_TRANSITIONS refuses new ones, so maps keyed by data (word
+// counts, ids) go to dictionary mode at once and do not use up SHAPE_LIMIT
+// for the record-like maps elsewhere in the program.
+
+#define SHAPE_MAX_KEYS 16          // maps with more keys fall back to a Table
+#define SHAPE_MAX_TRANSITIONS 64   // child shapes per shape
+#define SHAPE_LIMIT    4096        // total shapes before new transitions are refused
+
+typedef struct VM VM;
+
+typedef struct Shape {
+    ObjString** keys;           // keys[i] is stored in value slot i
+    int count;
+    struct Shape** transitions; // child shapes by added key, NULL slots empty
+    int transitionCount;
+    int transitionCapacity;     // 0 or a power of two
+    struct Shape* next;         // VM-wide list of all shapes
+} Shape;
+
+void initShapes(VM* vm);
+void freeShapes(VM* vm);
+void markShapes(VM* vm);
+
+// Shape reached by appending key, or NULL if the tree is full.
+Shape* shapeAddKey(VM* vm, Shape* shape, ObjString* key);
+
+// Slot holding key, or -1 if the shape does not have it.
+static inline int shapeFind(Shape* shape, ObjString* key) {
+    for (int i = 0; i < shape->count; i++) {
+        if (shape->keys[i] == key) return i;
+    }
+    return -1;
+}
+
+#endif
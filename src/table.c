@@ -2,118 +2,419 @@
 #include "memory.h"
 #include "object.h"
 
-#define TABLE_MAX_LOAD 0.75
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Room for as many entries as 7/8 of the index slots: every entry handed
+// out fills or deletes at most one slot, so probes always reach an empty one
+#define ENTRY_CAPACITY(capacity) ((capacity) - (capacity) / 8)
+
+// A hole in the entries: the bits of the number 0.0, which as a key is
+// always the int 0 (see tableKey)
+#define NO_KEY ((Value)0)
+
+// The hash picks the first group with its high bits and tags the slot
+// with its low 7
+#define HASH_GROUP(hash) ((hash) >> 7)
+#define HASH_TAG(hash) ((uint8_t)(0x80 | ((hash) & 0x7F)))
+
+// Where an incremental rebuild keeps the block it is moving out of: at the
+// end of the new block, which has room for it if it is large enough to be
+// rebuilt that way. The old entries are moved in order, and the first
+// 'reserved' new ones are set aside for them, so the order is kept.
+typedef struct {
+    Entry* entries;
+    int used;           // of the old entries
+    int next;           // old entries before this one have been moved
+    int moved;          // new entries taken by them so far
+    int reserved;
+} TableRehash;
+
+// A block: the entries, then a control byte and an entry number per index
+// slot, as wide as the largest entry number needs
+typedef struct {
+    Entry* entries;
+    uint8_t* control;
+    uint8_t* index;
+    int capacity;
+} Block;
+
+static inline size_t indexWidth(int capacity) {
+    return capacity <= 256 ? 1 : capacity <= 65536 ? 2 : 4;
+}
+
+static size_t tableBytes(int capacity) {
+    size_t bytes = sizeof(Entry) * (size_t)ENTRY_CAPACITY(capacity) +
+                   (1 + indexWidth(capacity)) * (size_t)capacity;
+    if (capacity >= TABLE_REHASH_MIN) bytes += sizeof(TableRehash);
+    return bytes;
+}
+
+static inline Block blockOf(Entry* entries, int capacity) {
+    Block block;
+    block.entries = entries;
+    block.control = (uint8_t*)(entries + ENTRY_CAPACITY(capacity));
+    block.index = block.control + capacity;
+    block.capacity = capacity;
+    return block;
+}
+
+static inline Entry* slotEntry(const Block* block, int slot) {
+    uint32_t number;
+    if (block->capacity <= 256) {
+        number = block->index[slot];
+    } else if (block->capacity <= 65536) {
+        number = ((const uint16_t*)block->index)[slot];
+    } else {
+        number = ((const uint32_t*)block->index)[slot];
+    }
+    return &block->entries[number];
+}
+
+static inline void setSlotEntry(Block* block, int slot, int number) {
+    if (block->capacity <= 256) {
+        block->index[slot] = (uint8_t)number;
+    } else if (block->capacity <= 65536) {
+        ((uint16_t*)block->index)[slot] = (uint16_t)number;
+    } else {
+        ((uint32_t*)block->index)[slot] = (uint32_t)number;
+    }
+}
+
+// Keys are compared by their bits, so each number has one form: a double
+// with an int value is the int, as it would be from arithmetic
+static inline Value tableKey(Value key) {
+    if (IS_DOUBLE(key)) return numberValue(valueToNum(key));
+    return key;
+}
+
+// Strings carry their hash. Anything else is hashed by its bits, objects
+// by their address (compaction reindexes what it moves, see tableReindex):
+// the top half of the product by 2^64 / phi depends on every bit of them.
+static inline uint32_t hashKey(Value key) {
+    if (IS_OBJ(key) && AS_OBJ(key)->type == OBJ_STRING) return AS_STRING(key)->hash;
+    return (uint32_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static inline TableRehash* tableRehash(Table* table) {
+    return (TableRehash*)(blockOf(table->entries, table->capacity).index +
+                          indexWidth(table->capacity) * (size_t)table->capacity);
+}
 
 void initTable(Table* table) {
     table->count = 0;
     table->capacity = 0;
+    table->used = 0;
+    table->oldCapacity = 0;
     table->entries = NULL;
 }
 
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    if (table->oldCapacity > 0) {
+        FREE_ARRAY(char, tableRehash(table)->entries, tableBytes(table->oldCapacity));
+    }
+    FREE_ARRAY(char, table->entries, tableBytes(table->capacity));
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash & (capacity - 1);
-    Entry* tombstone = NULL;
+// Bit i set for each slot i of the group whose control byte is 'tag'
+static inline uint32_t groupMatch(const uint8_t* group, uint8_t tag) {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < TABLE_GROUP; i++) {
+        if (group[i] == tag) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
 
-    for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            // Found the key
-            return entry;
+// Bit i set for each empty or deleted slot (the control bytes with the
+// top bit clear)
+static inline uint32_t groupMatchFree(const uint8_t* group) {
+#if defined(__SSE2__)
+    return ~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group)) & 0xFFFF;
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < TABLE_GROUP; i++) {
+        if (!(group[i] & 0x80)) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
+
+// Groups are probed in triangular steps (1, 2, 3, ... groups further on),
+// which visits every group of a power-of-two table once
+#define FOR_EACH_GROUP(capacity, hash, base)                                   \
+    for (uint32_t groupMask_ = (uint32_t)((capacity) / TABLE_GROUP - 1),      \
+                  group_ = HASH_GROUP(hash) & groupMask_, step_ = 1,          \
+                  base = group_ * TABLE_GROUP;                                \
+         ; group_ = (group_ + step_++) & groupMask_, base = group_ * TABLE_GROUP)
+
+// The index slot holding 'key', or -1
+static int findSlot(const Block* block, Value key, uint32_t hash) {
+    uint8_t tag = HASH_TAG(hash);
+    FOR_EACH_GROUP(block->capacity, hash, base) {
+        const uint8_t* group = block->control + base;
+        for (uint32_t bits = groupMatch(group, tag); bits != 0; bits &= bits - 1) {
+            int slot = (int)(base + __builtin_ctz(bits));
+            if (slotEntry(block, slot)->key == key) return slot;
         }
+        if (groupMatch(group, TABLE_EMPTY) != 0) return -1;
+    }
+}
+
+static Entry* findEntry(Table* table, Value key, uint32_t hash) {
+    Block block = blockOf(table->entries, table->capacity);
+    int slot = findSlot(&block, key, hash);
+    if (slot >= 0) return slotEntry(&block, slot);
+    if (table->oldCapacity == 0) return NULL;
+
+    block = blockOf(tableRehash(table)->entries, table->oldCapacity);
+    slot = findSlot(&block, key, hash);
+    return slot >= 0 ? slotEntry(&block, slot) : NULL;
+}
+
+// Index entry 'number', whose key is not in the block yet, under 'hash'
+static void placeEntry(Block* block, uint32_t hash, int number) {
+    FOR_EACH_GROUP(block->capacity, hash, base) {
+        uint32_t bits = groupMatchFree(block->control + base);
+        if (bits != 0) {
+            int slot = (int)(base + __builtin_ctz(bits));
+            block->control[slot] = HASH_TAG(hash);
+            setSlotEntry(block, slot, number);
+            return;
+        }
+    }
+}
 
-        index = (index + 1) & (capacity - 1);
+// Empty an index slot and leave a hole where its entry was. In a group that
+// still has an empty slot no probe goes on past it, so it can be empty
+// again; elsewhere it must keep the probes going.
+static void clearSlot(Block* block, int slot) {
+    Entry* entry = slotEntry(block, slot);
+    entry->key = NO_KEY;
+    entry->value = NIL_VAL;
+    if (groupMatch(block->control + (slot & ~(TABLE_GROUP - 1)), TABLE_EMPTY) != 0) {
+        block->control[slot] = TABLE_EMPTY;
+    } else {
+        block->control[slot] = TABLE_DELETED;
     }
 }
 
-bool tableGet(Table* table, ObjString* key, Value* value) {
+bool tableGet(Table* table, Value key, Value* value) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    key = tableKey(key);
+    Entry* entry = findEntry(table, key, hashKey(key));
+    if (entry == NULL) return false;
 
     *value = entry->value;
     return true;
 }
 
-bool tableGetEntry(Table* table, ObjString* key, Entry** entryOut) {
+bool tableGetEntry(Table* table, Value key, Entry** entryOut) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    key = tableKey(key);
+    Entry* entry = findEntry(table, key, hashKey(key));
+    if (entry == NULL) return false;
 
     if (entryOut != NULL) *entryOut = entry;
     return true;
 }
 
-static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
-    }
+// Move up to 'count' more old entries into the new block, and free the old
+// block once it is empty. The old index is left as it is; the holes left
+// behind stop lookups from finding the entries there.
+static void rehashStep(Table* table, int count) {
+    TableRehash* rehash = tableRehash(table);
+    Block block = blockOf(table->entries, table->capacity);
+    int end = rehash->next + count;
+    if (end > rehash->used) end = rehash->used;
 
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+    for (int i = rehash->next; i < end; i++) {
+        Entry* entry = &rehash->entries[i];
+        if (entry->key == NO_KEY) continue;
+        block.entries[rehash->moved] = *entry;
+        placeEntry(&block, hashKey(entry->key), rehash->moved++);
+        entry->key = NO_KEY;
+    }
+    rehash->next = end;
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+    if (end == rehash->used) {
+        FREE_ARRAY(char, rehash->entries, tableBytes(table->oldCapacity));
+        table->oldCapacity = 0;
     }
+}
+
+// The table whose new block is being allocated. That can run a collection,
+// which must not shrink the table meanwhile.
+static Table* resizingTable = NULL;
+
+// Move the entries to a new block with 'capacity' index slots, closing up
+// the holes: incrementally for a large table, unless it shrinks
+static void adjustCapacity(Table* table, int capacity) {
+    // Before the allocation, which can collect and so delete interned strings
+    if (table->oldCapacity > 0) rehashStep(table, tableRehash(table)->used);
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    // Zeroed, so that a large block's pages are touched as entries arrive
+    Table* outer = resizingTable;
+    resizingTable = table;
+    Entry* entries = (Entry*)ALLOCATE_ZEROED(char, tableBytes(capacity));
+    resizingTable = outer;
+
+    Entry* oldEntries = table->entries;
+    int oldCapacity = table->capacity;
+    int oldUsed = table->used;
     table->entries = entries;
     table->capacity = capacity;
+    // The first entries are set aside for the ones still to move
+    table->used = table->count;
+    if (oldCapacity == 0) return;
+
+    if (capacity >= TABLE_REHASH_MIN && capacity >= oldCapacity) {
+        TableRehash* rehash = tableRehash(table);
+        rehash->entries = oldEntries;
+        rehash->used = oldUsed;
+        rehash->next = 0;
+        rehash->moved = 0;
+        rehash->reserved = table->count;
+        table->oldCapacity = oldCapacity;
+        rehashStep(table, TABLE_REHASH_STEP);
+        return;
+    }
+
+    Block block = blockOf(entries, capacity);
+    int moved = 0;
+    for (int i = 0; i < oldUsed; i++) {
+        if (oldEntries[i].key == NO_KEY) continue;
+        entries[moved] = oldEntries[i];
+        placeEntry(&block, hashKey(oldEntries[i].key), moved++);
+    }
+    FREE_ARRAY(char, oldEntries, tableBytes(oldCapacity));
 }
 
-bool tableSet(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
+bool tableSet(Table* table, Value key, Value value) {
+    key = tableKey(key);
+    uint32_t hash = hashKey(key);
+    if (table->count > 0) {
+        Entry* entry = findEntry(table, key, hash);
+        if (entry != NULL) {
+            entry->value = value;
+            return false;
+        }
+    }
+
+    if (table->oldCapacity > 0) rehashStep(table, TABLE_REHASH_STEP);
+    if (table->used == ENTRY_CAPACITY(table->capacity)) {
+        // Double, unless closing up the holes frees half the room
+        int capacity = table->capacity;
+        if (capacity == 0) {
+            capacity = TABLE_GROUP;
+        } else if (table->count >= ENTRY_CAPACITY(capacity) / 2) {
+            capacity *= 2;
+        }
         adjustCapacity(table, capacity);
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    Block block = blockOf(table->entries, table->capacity);
+    int number = table->used++;
+    block.entries[number].key = key;
+    block.entries[number].value = value;
+    placeEntry(&block, hash, number);
+    table->count++;
+    return true;
+}
+
+bool tableResizing(Table* table) {
+    return table == resizingTable;
+}
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+void tableShrink(Table* table) {
+    if (tableResizing(table)) return;
+    int capacity = table->capacity;
+    while (capacity > TABLE_GROUP && table->count < ENTRY_CAPACITY(capacity) / 4) {
+        capacity /= 2;
+    }
+    if (capacity < table->capacity) adjustCapacity(table, capacity);
 }
 
-bool tableDelete(Table* table, ObjString* key) {
+bool tableDelete(Table* table, Value key) {
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    key = tableKey(key);
+    uint32_t hash = hashKey(key);
+    Block block = blockOf(table->entries, table->capacity);
+    int slot = findSlot(&block, key, hash);
+    if (slot < 0) {
+        if (table->oldCapacity == 0) return false;
+        block = blockOf(tableRehash(table)->entries, table->oldCapacity);
+        slot = findSlot(&block, key, hash);
+        if (slot < 0) return false;
+    }
 
-    // Place a tombstone
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    clearSlot(&block, slot);
+    table->count--;
     return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
-    for (int i = 0; i < from->capacity; i++) {
-        Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableNext(from, &cursor)) != NULL) {
+        tableSet(to, entry->key, entry->value);
+    }
+}
+
+// While a rebuild is under way the order is: the new entries set aside for
+// the old ones (those moved so far), the old entries not moved yet, then
+// the entries added since
+Entry* tableNext(Table* table, int* cursor) {
+    if (table->oldCapacity == 0) {
+        while (*cursor < table->used) {
+            Entry* entry = &table->entries[(*cursor)++];
+            if (entry->key != NO_KEY) return entry;
+        }
+        return NULL;
+    }
+
+    TableRehash* rehash = tableRehash(table);
+    while (*cursor < table->used + rehash->used) {
+        int i = (*cursor)++;
+        Entry* entry;
+        if (i < rehash->reserved) {
+            entry = &table->entries[i];
+        } else if (i < rehash->reserved + rehash->used) {
+            entry = &rehash->entries[i - rehash->reserved];
+        } else {
+            entry = &table->entries[i - rehash->used];
+        }
+        if (entry->key != NO_KEY) return entry;
+    }
+    return NULL;
+}
+
+// Entries moved out of an old block are still indexed there, as holes.
+// Only the intern table is searched this way, so every key is a string.
+static ObjString* findStringIn(const Block* block, const char* chars,
+                               int length, uint32_t hash) {
+    uint8_t tag = HASH_TAG(hash);
+    FOR_EACH_GROUP(block->capacity, hash, base) {
+        const uint8_t* group = block->control + base;
+        for (uint32_t bits = groupMatch(group, tag); bits != 0; bits &= bits - 1) {
+            Value entryKey = slotEntry(block, (int)(base + __builtin_ctz(bits)))->key;
+            if (entryKey == NO_KEY) continue;
+            ObjString* key = AS_STRING(entryKey);
+            if (key->hash == hash && key->length == length &&
+                memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
         }
+        if (groupMatch(group, TABLE_EMPTY) != 0) return NULL;
     }
 }
 
@@ -121,38 +422,37 @@ ObjString* tableFindString(Table* table, const char* chars, int length,
                             uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash & (table->capacity - 1);
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find a non-tombstone empty entry
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-                   entry->key->hash == hash &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            return entry->key;
-        }
-
-        index = (index + 1) & (table->capacity - 1);
+    Block block = blockOf(table->entries, table->capacity);
+    ObjString* key = findStringIn(&block, chars, length, hash);
+    if (key == NULL && table->oldCapacity > 0) {
+        block = blockOf(tableRehash(table)->entries, table->oldCapacity);
+        key = findStringIn(&block, chars, length, hash);
     }
+    return key;
 }
 
-void markTable(Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
-        markObject((Obj*)entry->key);
-        if (IS_OBJ(entry->value)) {
-            markObject(AS_OBJ(entry->value));
+void tableReindex(Table* table) {
+    if (table->capacity == 0) return;
+    if (table->oldCapacity > 0) rehashStep(table, tableRehash(table)->used);
+
+    Block block = blockOf(table->entries, table->capacity);
+    memset(block.control, TABLE_EMPTY, (size_t)table->capacity);
+    for (int i = 0; i < table->used; i++) {
+        if (block.entries[i].key != NO_KEY) {
+            placeEntry(&block, hashKey(block.entries[i].key), i);
         }
     }
 }
 
-void tableRemoveWhite(Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+void markTable(Table* table) {
+    int cursor = 0;
+    Entry* entry;
+    while ((entry = tableNext(table, &cursor)) != NULL) {
+        if (IS_OBJ(entry->key)) {
+            markObject(AS_OBJ(entry->key));
+        }
+        if (IS_OBJ(entry->value)) {
+            markObject(AS_OBJ(entry->value));
         }
     }
 }
@@ -7,26 +7,71 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+// Keys are any value: strings and other objects by identity (strings are
+// interned), numbers by value, whether stored as an int or a double.
+//
+// Compact and insertion ordered, in the manner of CPython's dicts: the
+// entries sit densely in the order their keys were added, and a separate
+// index of 1, 2 or 4 byte entry numbers (by capacity) is hashed into.
+// Deleting leaves a hole (a NULL key) in the entries, squeezed out the next
+// time the table is rebuilt, which it is when the entries run out.
+//
+// The index is open addressed in the style of Swiss tables, with one
+// control byte per slot: the top bit and the low 7 bits of the key's hash
+// when the slot is full, or TABLE_EMPTY / TABLE_DELETED. A lookup compares
+// a whole group of TABLE_GROUP control bytes at once (one SSE2 compare
+// where available) and only looks at the entries whose bytes match; a
+// group with an empty slot ends the probe. A block of zeros is an empty
+// table.
+//
+// Tables of TABLE_REHASH_MIN slots or more are rebuilt (but not shrunk)
+// incrementally, so that no single insert pays for moving millions of
+// entries: the old block stays beside the new one, and each insert of a
+// new key moves the next TABLE_REHASH_STEP old entries across. Until all
+// have moved, a lookup that misses in the new block goes on to the old
+// one. Lookups move nothing, so a map can be read while it is being
+// iterated.
+
+#define TABLE_GROUP 16
+#define TABLE_EMPTY ((uint8_t)0x00)
+#define TABLE_DELETED ((uint8_t)0x01)
+#define TABLE_REHASH_MIN 8192
+#define TABLE_REHASH_STEP 64
+
 typedef struct {
-    ObjString* key;
+    Value key;
     Value value;
 } Entry;
 
 typedef struct Table {
-    int count;
-    int capacity;
-    Entry* entries;
+    int count;          // live entries, those still in the old block included
+    int capacity;       // index slots: 0 or a power of two, at least TABLE_GROUP
+    int used;           // entries handed out, holes included
+    int oldCapacity;    // index slots of the block being moved out of, or 0
+    Entry* entries;     // followed by the control bytes and the index (and
+                        // for large tables a TableRehash, see table.c)
 } Table;
 
 void initTable(Table* table);
 void freeTable(Table* table);
-bool tableGet(Table* table, ObjString* key, Value* value);
-bool tableGetEntry(Table* table, ObjString* key, Entry** entryOut);
-bool tableSet(Table* table, ObjString* key, Value value);
-bool tableDelete(Table* table, ObjString* key);
+bool tableGet(Table* table, Value key, Value* value);
+bool tableGetEntry(Table* table, Value key, Entry** entryOut);
+bool tableSet(Table* table, Value key, Value value);
+bool tableDelete(Table* table, Value key);
 void tableAddAll(Table* from, Table* to);
+// Move to a smaller block if deletions left the table less than a quarter
+// full. Tables only grow otherwise.
+void tableShrink(Table* table);
+// Whether the table is waiting on the allocation of its new block. That can
+// run a collection, which must not add to the table or shrink it.
+bool tableResizing(Table* table);
+// The next live entry from *cursor on (start at 0) in insertion order, or
+// NULL at the end
+Entry* tableNext(Table* table, int* cursor);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+// Rebuild the index in place (no allocation), for when objects that are
+// keys have moved: other than strings, they are hashed by their address
+void tableReindex(Table* table);
 void markTable(Table* table);
-void tableRemoveWhite(Table* table);
 
 #endif
@@ -30,6 +30,8 @@ void printValue(Value value) {
         printf(AS_BOOL(value) ? "true" : "false");
     } else if (IS_NIL(value)) {
         printf("nil");
+    } else if (IS_INT(value)) {
+        printf("%d", AS_INT(value));
     } else if (IS_NUMBER(value)) {
         double num = AS_NUMBER(value);
         if (num == (int)num) {
@@ -45,6 +47,7 @@ void printValue(Value value) {
 bool valuesEqual(Value a, Value b) {
     // With NaN boxing, bit equality works for nil, bool, and interned strings.
     // Special case: NaN != NaN per IEEE 754.
+    if (IS_INT2(a, b)) return a == b;
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
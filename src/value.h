@@ -9,6 +9,9 @@ typedef struct ObjString ObjString;
 // ---- NaN Boxing ----
 // Values are encoded in 64 bits using IEEE 754 NaN bit patterns.
 // Regular doubles are stored as-is. Other types use quiet NaN + tag bits.
+// Integers that fit in 32 bits are tagged too (QNAN | TAG_INT | low word),
+// so counters and indices skip the double round trip; both kinds are
+// "number" to the language and compare by value.
 
 typedef uint64_t Value;
 
@@ -18,24 +21,37 @@ typedef uint64_t Value;
 #define TAG_NIL   1
 #define TAG_FALSE 2
 #define TAG_TRUE  3
+#define TAG_UNDEFINED 4 // internal: marks an unassigned global slot, never user-visible
+#define TAG_INT   ((uint64_t)0x0001000000000000) // first bit below the quiet-NaN mask
 
 // Wrap
 #define NIL_VAL         ((Value)(QNAN | TAG_NIL))
 #define TRUE_VAL        ((Value)(QNAN | TAG_TRUE))
 #define FALSE_VAL       ((Value)(QNAN | TAG_FALSE))
+#define UNDEFINED_VAL   ((Value)(QNAN | TAG_UNDEFINED))
 #define BOOL_VAL(b)     ((b) ? TRUE_VAL : FALSE_VAL)
 #define NUMBER_VAL(num) numToValue(num)
+#define INT_VAL(i)      ((Value)(QNAN | TAG_INT | (uint32_t)(int32_t)(i)))
 #define OBJ_VAL(obj)    (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
 // Type checks
 #define IS_NIL(v)    ((v) == NIL_VAL)
+#define IS_UNDEFINED(v) ((v) == UNDEFINED_VAL)
 #define IS_BOOL(v)   (((v) == TRUE_VAL) || ((v) == FALSE_VAL))
-#define IS_NUMBER(v) (((v) & QNAN) != QNAN)
+#define IS_DOUBLE(v) (((v) & QNAN) != QNAN)
+#define IS_INT(v)    (((v) >> 32) == ((QNAN | TAG_INT) >> 32))
+// Doubles and ints in one test: every other tag (and every 47-bit object
+// pointer) leaves the TAG_INT bit clear under the quiet-NaN mask
+#define IS_NUMBER(v) (((v) & (QNAN | TAG_INT)) != QNAN)
 #define IS_OBJ(v)    (((v) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+// Both operands are numbers: one combined test instead of two branches
+#define IS_NUMBER2(a, b) (IS_NUMBER(a) & IS_NUMBER(b))
+#define IS_INT2(a, b)    (IS_INT(a) & IS_INT(b))
 
 // Unwrap
 #define AS_BOOL(v)   ((v) == TRUE_VAL)
-#define AS_NUMBER(v) valueToNum(v)
+#define AS_NUMBER(v) asNumber(v)
+#define AS_INT(v)    ((int32_t)(uint32_t)(v))
 #define AS_OBJ(v)    ((Obj*)(uintptr_t)((v) & ~(SIGN_BIT | QNAN)))
 
 // Double <-> uint64 conversion via memcpy (no UB, optimizer sees through it)
@@ -51,11 +67,44 @@ static inline double valueToNum(Value v) {
     return num;
 }
 
+// Any number as a double
+static inline double asNumber(Value v) {
+    return IS_INT(v) ? (double)AS_INT(v) : valueToNum(v);
+}
+
+// Any number truncated to an int (indices, counts)
+static inline int asInt(Value v) {
+    return IS_INT(v) ? AS_INT(v) : (int)valueToNum(v);
+}
+
+// Integer result: tagged if it fits in 32 bits, else promoted to a double
+static inline Value intValue(int64_t n) {
+    if (n >= INT32_MIN && n <= INT32_MAX) return INT_VAL(n);
+    return NUMBER_VAL((double)n);
+}
+
+// Number result that is often integral (literals, range elements)
+static inline Value numberValue(double num) {
+    if (num >= INT32_MIN && num <= INT32_MAX && num == (double)(int32_t)num) {
+        return INT_VAL((int32_t)num);
+    }
+    return NUMBER_VAL(num);
+}
+
+// Arithmetic and comparison on two numbers: int op int stays integral
+// (computed in 64 bits, so overflow is promoted rather than wrapped)
+#define NUMBER_ARITH(a, b, op) \
+    (IS_INT2(a, b) ? intValue((int64_t)AS_INT(a) op (int64_t)AS_INT(b)) \
+                   : NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b)))
+#define NUMBER_COMPARE(a, b, op) \
+    (IS_INT2(a, b) ? AS_INT(a) op AS_INT(b) : AS_NUMBER(a) op AS_NUMBER(b))
+
 // Inline falsey check (hot path: JUMP_IF_FALSE)
 static inline bool isFalsey(Value value) {
     if (IS_NIL(value)) return true;
     if (IS_BOOL(value)) return value == FALSE_VAL;
-    if (IS_NUMBER(value)) return AS_NUMBER(value) == 0;
+    if (IS_INT(value)) return AS_INT(value) == 0;
+    if (IS_DOUBLE(value)) return valueToNum(value) == 0;
     return false;
 }
 
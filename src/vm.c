@@ -7,6 +7,7 @@
 #include "debug.h"
 #include "memory.h"
 #include "object.h"
+#include "jit.h"
 
 #include "process.h"
 #include "dataformat.h"
@@ -19,6 +20,7 @@
 #include "modules/math_module.h"
 #include "modules/regex.h"
 #include "modules/bit_module.h"
+#include "modules/gc_module.h"
 
 #include <stdarg.h>
 #include <math.h>
@@ -34,6 +36,9 @@
 // Forward declarations for calling closures from native functions
 static bool callClosure(VM* vm, ObjClosure* closure, int argCount);
 static InterpretResult run(VM* vm);
+static bool runRegister(VM* vm);
+static bool runJit(VM* vm);
+static int frameLine(CallFrame* frame);
 
 // Forward declarations
 static inline void push(VM* vm, Value value);
@@ -54,10 +59,13 @@ static Value lenNative(VM* vm, int argCount, Value* args) {
     if (argCount != 1) return NIL_VAL;
 
     if (IS_STRING(args[0])) {
-        return NUMBER_VAL(AS_STRING(args[0])->length);
+        return INT_VAL(AS_STRING(args[0])->length);
     }
     if (IS_LIST(args[0])) {
-        return NUMBER_VAL(AS_LIST(args[0])->count);
+        return INT_VAL(AS_LIST(args[0])->count);
+    }
+    if (IS_SET(args[0])) {
+        return INT_VAL(AS_SET(args[0])->table.count);
     }
     return NIL_VAL;
 }
@@ -78,6 +86,8 @@ static Value typeNative(VM* vm, int argCount, Value* args) {
             case OBJ_NATIVE:   name = "function"; break;
             case OBJ_LIST:     name = "list"; break;
             case OBJ_MAP:      name = "map"; break;
+            case OBJ_RANGE:    name = "range"; break;
+            case OBJ_SET:      name = "set"; break;
             default:           name = "object"; break;
         }
     } else {
@@ -94,7 +104,9 @@ static Value strNative(VM* vm, int argCount, Value* args) {
 
     char buf[64];
     int len;
-    if (IS_NUMBER(val)) {
+    if (IS_INT(val)) {
+        len = snprintf(buf, sizeof(buf), "%d", AS_INT(val));
+    } else if (IS_NUMBER(val)) {
         double num = AS_NUMBER(val);
         if (num == (int)num) {
             len = snprintf(buf, sizeof(buf), "%d", (int)num);
@@ -171,27 +183,37 @@ static Value keysNative(VM* vm, int argCount, Value* args) {
     if (argCount != 1 || !IS_MAP(args[0])) return NIL_VAL;
     ObjMap* map = AS_MAP(args[0]);
     ObjList* list = newList(vm);
+    vmPush(vm, OBJ_VAL(list)); // GC protect
 
-    for (int i = 0; i < map->table.capacity; i++) {
-        Entry* entry = &map->table.entries[i];
-        if (entry->key != NULL) {
-            listAppend(vm, list, OBJ_VAL(entry->key));
-        }
+    int cursor = 0;
+    Value key;
+    Value value;
+    while (mapNext(map, &cursor, &key, &value)) {
+        listAppend(vm, list, key);
     }
+    vmPop(vm);
     return OBJ_VAL(list);
 }
 
+// The values of a map, or the members of a set
 static Value valuesNative(VM* vm, int argCount, Value* args) {
-    if (argCount != 1 || !IS_MAP(args[0])) return NIL_VAL;
-    ObjMap* map = AS_MAP(args[0]);
+    if (argCount != 1 || !(IS_MAP(args[0]) || IS_SET(args[0]))) return NIL_VAL;
     ObjList* list = newList(vm);
-
-    for (int i = 0; i < map->table.capacity; i++) {
-        Entry* entry = &map->table.entries[i];
-        if (entry->key != NULL) {
-            listAppend(vm, list, entry->value);
+    vmPush(vm, OBJ_VAL(list)); // GC protect
+
+    int cursor = 0;
+    Value key;
+    Value value;
+    if (IS_SET(args[0])) {
+        while (setNext(AS_SET(args[0]), &cursor, &value)) {
+            listAppend(vm, list, value);
+        }
+    } else {
+        while (mapNext(AS_MAP(args[0]), &cursor, &key, &value)) {
+            listAppend(vm, list, value);
         }
     }
+    vmPop(vm);
     return OBJ_VAL(list);
 }
 
@@ -209,9 +231,12 @@ static Value containsNative(VM* vm, int argCount, Value* args) {
     if (IS_STRING(args[0]) && IS_STRING(args[1])) {
         return BOOL_VAL(strstr(AS_CSTRING(args[0]), AS_CSTRING(args[1])) != NULL);
     }
-    if (IS_MAP(args[0]) && IS_STRING(args[1])) {
+    if (IS_MAP(args[0])) {
         Value dummy;
-        return BOOL_VAL(tableGet(&AS_MAP(args[0])->table, AS_STRING(args[1]), &dummy));
+        return BOOL_VAL(mapGetKey(AS_MAP(args[0]), args[1], &dummy));
+    }
+    if (IS_SET(args[0])) {
+        return BOOL_VAL(setHas(AS_SET(args[0]), args[1]));
     }
     return BOOL_VAL(false);
 }
@@ -225,15 +250,17 @@ static Value rangeNative(VM* vm, int argCount, Value* args) {
     if (step == 0) return NIL_VAL;
 
     ObjList* list = newList(vm);
+    vmPush(vm, OBJ_VAL(list)); // GC protect
     if (step > 0) {
         for (double i = start; i < end; i += step) {
-            listAppend(vm, list, NUMBER_VAL(i));
+            listAppend(vm, list, numberValue(i));
         }
     } else {
         for (double i = start; i > end; i += step) {
-            listAppend(vm, list, NUMBER_VAL(i));
+            listAppend(vm, list, numberValue(i));
         }
     }
+    vmPop(vm);
     return OBJ_VAL(list);
 }
 
@@ -320,25 +347,19 @@ static Value execNative(VM* vm, int argCount, Value* args) {
     Value mapVal = OBJ_VAL(map);
     *vm->stackTop++ = mapVal;
 
-    ObjString* stdoutKey = copyString(vm, "stdout", 6);
-    ObjString* stdoutVal = copyString(vm, result.stdoutData ? result.stdoutData : "",
-                                       result.stdoutLength);
-    tableSet(&map->table, stdoutKey, OBJ_VAL(stdoutVal));
+    mapSetString(vm, map, "stdout",
+        result.stdoutData ? result.stdoutData : "", result.stdoutLength);
 
-    ObjString* stderrKey = copyString(vm, "stderr", 6);
-    ObjString* stderrVal = copyString(vm, result.stderrData ? result.stderrData : "",
-                                       result.stderrLength);
-    tableSet(&map->table, stderrKey, OBJ_VAL(stderrVal));
+    mapSetString(vm, map, "stderr",
+        result.stderrData ? result.stderrData : "", result.stderrLength);
 
     ObjString* exitCodeKey = copyString(vm, "exitCode", 8);
-    tableSet(&map->table, exitCodeKey, NUMBER_VAL(result.exitCode));
+    mapSet(vm, map, exitCodeKey, NUMBER_VAL(result.exitCode));
 
     // Strip trailing newline from stdout for convenience
-    ObjString* outputKey = copyString(vm, "output", 6);
     int outLen = result.stdoutLength;
     if (outLen > 0 && result.stdoutData[outLen - 1] == '\n') outLen--;
-    ObjString* outputVal = copyString(vm, result.stdoutData ? result.stdoutData : "", outLen);
-    tableSet(&map->table, outputKey, OBJ_VAL(outputVal));
+    mapSetString(vm, map, "output", result.stdoutData ? result.stdoutData : "", outLen);
 
     vm->stackTop--; // unprotect map
 
@@ -679,6 +700,7 @@ static Value reverseNative(VM* vm, int argCount, Value* args) {
             list->items[i] = list->items[j];
             list->items[j] = tmp;
         }
+        LIST_PERMUTED(list);
         return args[0];
     }
     return NIL_VAL;
@@ -816,11 +838,28 @@ static Value sumNative(VM* vm, int argCount, Value* args) {
     return NUMBER_VAL(total);
 }
 
+// Lists up to this long are deduplicated by comparing each item with those
+// kept so far; longer ones through a table of the items seen
+#define UNIQUE_SCAN_MAX 16
+
 static Value uniqueNative(VM* vm, int argCount, Value* args) {
     if (argCount != 1 || !IS_LIST(args[0])) return NIL_VAL;
     ObjList* src = AS_LIST(args[0]);
     ObjList* result = newList(vm);
     *vm->stackTop++ = OBJ_VAL(result); // GC protect
+    if (src->count > UNIQUE_SCAN_MAX) {
+        // The items are kept alive by the list
+        Table seen;
+        initTable(&seen);
+        for (int i = 0; i < src->count; i++) {
+            if (tableSet(&seen, src->items[i], NIL_VAL)) {
+                listAppend(vm, result, src->items[i]);
+            }
+        }
+        freeTable(&seen);
+        vm->stackTop--;
+        return OBJ_VAL(result);
+    }
     for (int i = 0; i < src->count; i++) {
         bool found = false;
         for (int j = 0; j < result->count; j++) {
@@ -835,6 +874,82 @@ static Value uniqueNative(VM* vm, int argCount, Value* args) {
     return OBJ_VAL(result);
 }
 
+// set(), or set(items) with the items of a list, the members of a set or
+// the keys of a map
+static Value setNative(VM* vm, int argCount, Value* args) {
+    if (argCount > 1) return NIL_VAL;
+    ObjSet* set = newSet(vm);
+    vmPush(vm, OBJ_VAL(set)); // GC protect
+
+    if (argCount == 1) {
+        int cursor = 0;
+        Value key;
+        Value value;
+        if (IS_LIST(args[0])) {
+            ObjList* list = AS_LIST(args[0]);
+            for (int i = 0; i < list->count; i++) setAdd(vm, set, list->items[i]);
+        } else if (IS_SET(args[0])) {
+            while (setNext(AS_SET(args[0]), &cursor, &value)) setAdd(vm, set, value);
+        } else if (IS_MAP(args[0])) {
+            while (mapNext(AS_MAP(args[0]), &cursor, &key, &value)) setAdd(vm, set, key);
+        } else {
+            vmPop(vm);
+            return NIL_VAL;
+        }
+    }
+    vmPop(vm);
+    return OBJ_VAL(set);
+}
+
+static Value addNative(VM* vm, int argCount, Value* args) {
+    if (argCount != 2 || !IS_SET(args[0])) return NIL_VAL;
+    setAdd(vm, AS_SET(args[0]), args[1]);
+    return args[0];
+}
+
+static Value hasNative(VM* vm, int argCount, Value* args) {
+    (void)vm;
+    if (argCount != 2 || !IS_SET(args[0])) return BOOL_VAL(false);
+    return BOOL_VAL(setHas(AS_SET(args[0]), args[1]));
+}
+
+typedef enum { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE } SetOperation;
+
+// A new set, in the order of a's members and then (for a union) b's
+static Value setOperation(VM* vm, int argCount, Value* args, SetOperation op) {
+    if (argCount != 2 || !IS_SET(args[0]) || !IS_SET(args[1])) return NIL_VAL;
+    ObjSet* a = AS_SET(args[0]);
+    ObjSet* b = AS_SET(args[1]);
+    ObjSet* result = newSet(vm);
+    vmPush(vm, OBJ_VAL(result)); // GC protect
+
+    int cursor = 0;
+    Value member;
+    while (setNext(a, &cursor, &member)) {
+        if (op == SET_UNION || setHas(b, member) == (op == SET_INTERSECTION)) {
+            setAdd(vm, result, member);
+        }
+    }
+    if (op == SET_UNION) {
+        cursor = 0;
+        while (setNext(b, &cursor, &member)) setAdd(vm, result, member);
+    }
+    vmPop(vm);
+    return OBJ_VAL(result);
+}
+
+static Value unionNative(VM* vm, int argCount, Value* args) {
+    return setOperation(vm, argCount, args, SET_UNION);
+}
+
+static Value intersectionNative(VM* vm, int argCount, Value* args) {
+    return setOperation(vm, argCount, args, SET_INTERSECTION);
+}
+
+static Value differenceNative(VM* vm, int argCount, Value* args) {
+    return setOperation(vm, argCount, args, SET_DIFFERENCE);
+}
+
 static Value sliceNative(VM* vm, int argCount, Value* args) {
     if (argCount < 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
     ObjList* list = AS_LIST(args[0]);
@@ -871,6 +986,8 @@ static Value insertNative(VM* vm, int argCount, Value* args) {
         list->items[i] = list->items[i - 1];
     }
     list->items[index] = args[2];
+    LIST_PERMUTED(list);
+    LIST_WRITE_BARRIER(list, index, args[2]);
     return args[0];
 }
 
@@ -886,6 +1003,16 @@ static Value findNative(VM* vm, int argCount, Value* args) {
 
 static Value removeNative(VM* vm, int argCount, Value* args) {
     (void)vm;
+    if (argCount == 2 && IS_MAP(args[0])) {
+        ObjMap* map = AS_MAP(args[0]);
+        Value removed;
+        if (!mapGetKey(map, args[1], &removed)) return NIL_VAL;
+        mapDeleteKey(map, args[1]);
+        return removed;
+    }
+    if (argCount == 2 && IS_SET(args[0])) {
+        return BOOL_VAL(setRemove(AS_SET(args[0]), args[1]));
+    }
     if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
     ObjList* list = AS_LIST(args[0]);
     int index = (int)AS_NUMBER(args[1]);
@@ -897,6 +1024,7 @@ static Value removeNative(VM* vm, int argCount, Value* args) {
         list->items[i] = list->items[i + 1];
     }
     list->count--;
+    LIST_PERMUTED(list);
     return removed;
 }
 
@@ -938,6 +1066,7 @@ static Value sortNative(VM* vm, int argCount, Value* args) {
                 Value tmp = list->items[j];
                 list->items[j] = list->items[j+1];
                 list->items[j+1] = tmp;
+                LIST_PERMUTED(list);
             }
         }
     }
@@ -957,10 +1086,15 @@ static Value vmCallFunction(VM* vm, Value callee, int argCount) {
 
     if (IS_CLOSURE(callee)) {
         ObjClosure* closure = AS_CLOSURE(callee);
+        int frames = vm->frameCount;
         if (!callClosure(vm, closure, argCount)) {
-            vm->stackTop -= argCount + 1;
+            // runtimeError has already reset the stack
             return NIL_VAL;
         }
+        if (vm->frameCount == frames) {
+            // Register code ran to completion inside callClosure
+            return pop(vm);
+        }
         int savedBase = vm->baseFrameCount;
         vm->baseFrameCount = vm->frameCount - 1;
         InterpretResult result = run(vm);
@@ -1126,23 +1260,56 @@ void initVM(VM* vm) {
     vm->stackTop = vm->stack;
     vm->frameCount = 0;
 
-    initTable(&vm->globals);
+    initTable(&vm->globalSlots);
+    vm->globalValues = NULL;
+    vm->globalNames = NULL;
+    vm->globalCount = 0;
+    vm->globalCapacity = 0;
     initTable(&vm->strings);
+    memset(vm->charStrings, 0, sizeof(vm->charStrings));
 
     vm->openUpvalues = NULL;
-    vm->objects = NULL;
-    vm->grayCount = 0;
-    vm->grayCapacity = 0;
-    vm->grayStack = NULL;
+    initHeap(&vm->heap);
+    memset(vm->gcWorkers, 0, sizeof(vm->gcWorkers));
+    for (int i = 0; i < GC_MAX_THREADS; i++) {
+        vm->gcWorkers[i].seed = (uint32_t)i * 2654435761u + 1;
+    }
+    vm->gcThreads = 1;
+    vm->markerPool = NULL;
+    vm->remembered = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
     vm->bytesAllocated = 0;
-    vm->nextGC = 1024 * 1024; // 1 MB initial threshold
+    vm->nextGC = GC_DEFAULT_INITIAL;
+    vm->gcGrowth = GC_DEFAULT_GROWTH;
+    vm->maxHeap = 0;
+    vm->heapLimitRaised = false;
+    vm->raisingHeapLimit = false;
+    vm->shrinkingStrings = false;
+    vm->youngBytes = 0;
+    vm->nurserySize = GC_NURSERY_SIZE;
+    vm->gcPhase = GC_IDLE;
+    vm->sweepClass = 0;
+    vm->sweepPageLink = NULL;
+    vm->sweepLink = NULL;
+    vm->gcDebt = 0;
+    vm->gcPauseUs = GC_DEFAULT_PAUSE_US;
+    vm->gcCompact = false;
+    vm->compactPending = false;
+    memset(&vm->gcStats, 0, sizeof(vm->gcStats));
 
     initPermissions(&vm->permissions);
     vm->handlerCount = 0;
     vm->hasError = false;
     vm->currentError = NIL_VAL;
-    memset(vm->globalIC, 0, sizeof(vm->globalIC));
+    initShapes(vm);
+#ifdef DEBUG_IC_STATS
+    vm->propertyICHits = 0;
+    vm->propertyICMisses = 0;
+#endif
 
+    vm->registerMode = false;
+    vm->jitEnabled = false;
     vm->baseFrameCount = 0;
     vm->scriptArgc = 0;
     vm->scriptArgv = NULL;
@@ -1213,6 +1380,12 @@ void initVM(VM* vm) {
     defineNative(vm, "remove", removeNative, 2);
     defineNative(vm, "sum", sumNative, 1);
     defineNative(vm, "unique", uniqueNative, 1);
+    defineNative(vm, "set", setNative, -1);
+    defineNative(vm, "add", addNative, 2);
+    defineNative(vm, "has", hasNative, 2);
+    defineNative(vm, "union", unionNative, 2);
+    defineNative(vm, "intersection", intersectionNative, 2);
+    defineNative(vm, "difference", differenceNative, 2);
 
     // Type conversions
     defineNative(vm, "num", numNative, 1);
@@ -1222,7 +1395,7 @@ void initVM(VM* vm) {
     defineNative(vm, "debug", debugNative, -1);
     defineNative(vm, "parallel_exec", parallelExec, 1);
 
-    // Standard library modules (registered as global maps: fs, net, proc, sys, math, re)
+    // Standard library modules (registered as global maps: fs, net, proc, sys, math, re, bit, gc)
     registerFsModule(vm);
     registerProcModule(vm);
     registerNetModule(vm);
@@ -1230,23 +1403,35 @@ void initVM(VM* vm) {
     registerMathModule(vm);
     registerRegexModule(vm);
     registerBitModule(vm);
+    registerGcModule(vm);
 }
 
 void freeVM(VM* vm) {
-    freeTable(&vm->globals);
+#ifdef DEBUG_IC_STATS
+    uint64_t lookups = vm->propertyICHits + vm->propertyICMisses;
+    fprintf(stderr, "[IC] property: %llu hits, %llu misses (%.1f%% hit rate)\n",
+        (unsigned long long)vm->propertyICHits,
+        (unsigned long long)vm->propertyICMisses,
+        lookups ? 100.0 * (double)vm->propertyICHits / (double)lookups : 0.0);
+#endif
+    freeTable(&vm->globalSlots);
+    FREE_ARRAY(Value, vm->globalValues, vm->globalCapacity);
+    FREE_ARRAY(ObjString*, vm->globalNames, vm->globalCapacity);
     freeTable(&vm->strings);
     freeTable(&vm->modules);
     freePermissions(&vm->permissions);
+    stopMarkers(vm);
     freeObjects(vm);
+    freeShapes(vm);
     setCurrentVM(NULL);
 }
 
 void defineNative(VM* vm, const char* name, NativeFn function, int arity) {
     ObjString* nameStr = copyString(vm, name, (int)strlen(name));
-    // Push both objects to protect from GC during tableSet
+    // Push both objects to protect from GC while the global is defined
     *vm->stackTop++ = OBJ_VAL(nameStr);
     *vm->stackTop++ = OBJ_VAL(newNative(vm, function, name, arity));
-    tableSet(&vm->globals, AS_STRING(vm->stack[0]), vm->stack[1]);
+    vmDefineGlobal(vm, AS_STRING(vm->stackTop[-2]), vm->stackTop[-1]);
     vm->stackTop -= 2;
 }
 
@@ -1255,10 +1440,49 @@ void defineModuleNative(VM* vm, ObjMap* module, const char* name,
     ObjString* nameStr = copyString(vm, name, (int)strlen(name));
     *vm->stackTop++ = OBJ_VAL(nameStr);
     *vm->stackTop++ = OBJ_VAL(newNative(vm, function, name, arity));
-    tableSet(&module->table, AS_STRING(vm->stackTop[-2]), vm->stackTop[-1]);
+    mapSet(vm, module, AS_STRING(vm->stackTop[-2]), vm->stackTop[-1]);
     vm->stackTop -= 2;
 }
 
+// ---- Globals ----
+
+int vmGlobalSlot(VM* vm, ObjString* name) {
+    Value existing;
+    if (tableGet(&vm->globalSlots, OBJ_VAL(name), &existing)) return (int)AS_NUMBER(existing);
+
+    *vm->stackTop++ = OBJ_VAL(name); // keep the name alive while growing
+    if (vm->globalCapacity < vm->globalCount + 1) {
+        int oldCapacity = vm->globalCapacity;
+        vm->globalCapacity = GROW_CAPACITY(oldCapacity);
+        vm->globalValues = GROW_ARRAY(Value, vm->globalValues,
+            oldCapacity, vm->globalCapacity);
+        vm->globalNames = GROW_ARRAY(ObjString*, vm->globalNames,
+            oldCapacity, vm->globalCapacity);
+    }
+    int slot = vm->globalCount++;
+    vm->globalValues[slot] = UNDEFINED_VAL;
+    vm->globalNames[slot] = name;
+    tableSet(&vm->globalSlots, OBJ_VAL(name), NUMBER_VAL(slot));
+    vm->stackTop--;
+    return slot;
+}
+
+void vmDefineGlobal(VM* vm, ObjString* name, Value value) {
+    *vm->stackTop++ = value;
+    int slot = vmGlobalSlot(vm, name);
+    vm->globalValues[slot] = value;
+    vm->stackTop--;
+}
+
+bool vmGetGlobal(VM* vm, ObjString* name, Value* value) {
+    Value slot;
+    if (!tableGet(&vm->globalSlots, OBJ_VAL(name), &slot)) return false;
+    Value current = vm->globalValues[(int)AS_NUMBER(slot)];
+    if (IS_UNDEFINED(current)) return false;
+    *value = current;
+    return true;
+}
+
 void vmPush(VM* vm, Value value) {
     if (vm->stackTop >= vm->stack + STACK_MAX) {
         fprintf(stderr, "Stack overflow.\n");
@@ -1277,21 +1501,14 @@ void vmRaiseError(VM* vm, const char* message, const char* type) {
     ObjMap* errorMap = newMap(vm);
     vmPush(vm, OBJ_VAL(errorMap));
 
-    ObjString* msgKey = copyString(vm, "message", 7);
-    ObjString* msgVal = copyString(vm, message, (int)strlen(message));
-    tableSet(&errorMap->table, msgKey, OBJ_VAL(msgVal));
+    mapSetString(vm, errorMap, "message", message, (int)strlen(message));
 
-    ObjString* typeKey = copyString(vm, "type", 4);
-    ObjString* typeVal = copyString(vm, type, (int)strlen(type));
-    tableSet(&errorMap->table, typeKey, OBJ_VAL(typeVal));
+    mapSetString(vm, errorMap, "type", type, (int)strlen(type));
 
     if (vm->frameCount > 0) {
-        CallFrame* frame = &vm->frames[vm->frameCount - 1];
-        ObjFunction* fn = frame->closure->function;
-        size_t instruction = frame->ip - fn->chunk.code - 1;
-        int line = fn->chunk.lines[instruction];
+        int line = frameLine(&vm->frames[vm->frameCount - 1]);
         ObjString* lineKey = copyString(vm, "line", 4);
-        tableSet(&errorMap->table, lineKey, NUMBER_VAL((double)line));
+        mapSet(vm, errorMap, lineKey, NUMBER_VAL((double)line));
     }
 
     vmPop(vm);
@@ -1302,6 +1519,19 @@ void vmRaiseError(VM* vm, const char* message, const char* type) {
 
 // ---- Runtime Errors ----
 
+// Source line of the instruction a frame is executing. The allocator can
+// raise an error before the running frame has stored its ip even once;
+// that reports the frame's first line.
+static int frameLine(CallFrame* frame) {
+    ObjFunction* function = frame->closure->function;
+    if (frame->regIP != NULL) {
+        RegChunk* chunk = function->regChunk;
+        return chunk->lines[frame->regIP > chunk->code ? frame->regIP - chunk->code - 1 : 0];
+    }
+    Chunk* chunk = &function->chunk;
+    return chunk->lines[frame->ip > chunk->code ? frame->ip - chunk->code - 1 : 0];
+}
+
 static void runtimeError(VM* vm, const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -1312,8 +1542,7 @@ static void runtimeError(VM* vm, const char* format, ...) {
     for (int i = vm->frameCount - 1; i >= 0; i--) {
         CallFrame* frame = &vm->frames[i];
         ObjFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        fprintf(stderr, "[line %d] in ", frameLine(frame));
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -1332,21 +1561,14 @@ static void raiseError(VM* vm, const char* message, const char* type) {
     ObjMap* errorMap = newMap(vm);
     push(vm, OBJ_VAL(errorMap)); // GC protection while building the map
 
-    ObjString* msgKey = copyString(vm, "message", 7);
-    ObjString* msgVal = copyString(vm, message, (int)strlen(message));
-    tableSet(&errorMap->table, msgKey, OBJ_VAL(msgVal));
+    mapSetString(vm, errorMap, "message", message, (int)strlen(message));
 
-    ObjString* typeKey = copyString(vm, "type", 4);
-    ObjString* typeVal = copyString(vm, type, (int)strlen(type));
-    tableSet(&errorMap->table, typeKey, OBJ_VAL(typeVal));
+    mapSetString(vm, errorMap, "type", type, (int)strlen(type));
 
     if (vm->frameCount > 0) {
-        CallFrame* frame = &vm->frames[vm->frameCount - 1];
-        ObjFunction* fn = frame->closure->function;
-        size_t instruction = frame->ip - fn->chunk.code - 1;
-        int line = fn->chunk.lines[instruction];
+        int line = frameLine(&vm->frames[vm->frameCount - 1]);
         ObjString* lineKey = copyString(vm, "line", 4);
-        tableSet(&errorMap->table, lineKey, NUMBER_VAL((double)line));
+        mapSet(vm, errorMap, lineKey, NUMBER_VAL((double)line));
     }
 
     pop(vm);
@@ -1394,7 +1616,22 @@ static bool callClosure(VM* vm, ObjClosure* closure, int argCount) {
     CallFrame* frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
+    frame->regIP = NULL;
     frame->slots = vm->stackTop - argCount - 1;
+
+    // Register code runs here to completion and leaves its result where
+    // the callee was, as if the stack VM had returned (unless it tail-calls
+    // stack code, which it leaves in this frame like any stack callee)
+    if (closure->function->regChunk != NULL) return runRegister(vm);
+
+    // Machine code also runs to completion here
+    if (vm->jitEnabled) {
+        ObjFunction* function = closure->function;
+        if (function->jitCode != NULL ||
+            (++function->hotness == JIT_THRESHOLD && jitCompile(vm, function))) {
+            return runJit(vm);
+        }
+    }
     return true;
 }
 
@@ -1412,6 +1649,10 @@ static bool callValue(VM* vm, Value callee, int argCount) {
                 }
                 Value result = native->function(vm, argCount,
                     vm->stackTop - argCount);
+                if (UNLIKELY(vm->frameCount == 0)) {
+                    // A callback hit a runtime error; the stack is already reset
+                    return false;
+                }
                 vm->stackTop -= argCount + 1;
                 push(vm, result);
                 return true;
@@ -1424,6 +1665,22 @@ static bool callValue(VM* vm, Value callee, int argCount) {
     return false;
 }
 
+// An intrinsic site whose name no longer holds the built-in: slide the
+// arguments up, put the current global value under them as the callee and
+// make an ordinary call.
+static bool callRebound(VM* vm, uint16_t slot, int argCount) {
+    Value callee = vm->globalValues[slot];
+    if (IS_UNDEFINED(callee)) {
+        runtimeError(vm, "Undefined variable '%s'.", vm->globalNames[slot]->chars);
+        return false;
+    }
+    Value* args = vm->stackTop - argCount;
+    memmove(args + 1, args, sizeof(Value) * argCount);
+    args[0] = callee;
+    vm->stackTop++;
+    return callValue(vm, callee, argCount);
+}
+
 // ---- Upvalue Operations ----
 
 static ObjUpvalue* captureUpvalue(VM* vm, Value* local) {
@@ -1456,10 +1713,105 @@ static void closeUpvalues(VM* vm, Value* last) {
         ObjUpvalue* upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        WRITE_BARRIER(upvalue, upvalue->closed);
         vm->openUpvalues = upvalue->next;
     }
 }
 
+// ---- Number arithmetic ----
+// Shared by both interpreters; operands have already been checked to be
+// numbers. Ints stay ints where the result is exact.
+
+#define COMPARE_RESULT(a, b, op) BOOL_VAL(NUMBER_COMPARE(a, b, op))
+
+// Divisor known to be nonzero
+static inline Value divideNumbers(Value a, Value b) {
+    if (IS_INT2(a, b) && (int64_t)AS_INT(a) % AS_INT(b) == 0) {
+        return intValue((int64_t)AS_INT(a) / AS_INT(b));
+    }
+    return NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+}
+
+// Truncated remainder (the sign follows the dividend, as with fmod)
+static inline Value moduloNumbers(Value a, Value b) {
+    if (IS_INT2(a, b) && AS_INT(b) != 0) {
+        return intValue((int64_t)AS_INT(a) % AS_INT(b));
+    }
+    return NUMBER_VAL(fmod(AS_NUMBER(a), AS_NUMBER(b)));
+}
+
+static inline Value negateNumber(Value a) {
+    if (IS_INT(a)) return intValue(-(int64_t)AS_INT(a));
+    return NUMBER_VAL(-AS_NUMBER(a));
+}
+
+// ---- Indexing ----
+// Shared by both interpreters. Operands stay where the caller keeps them
+// (stack or registers) so they remain rooted; on failure a runtime error
+// has been reported and the caller returns.
+
+static bool indexGet(VM* vm, Value obj, Value index, Value* result) {
+    if (IS_LIST(obj)) {
+        if (!IS_NUMBER(index)) {
+            runtimeError(vm, "List index must be a number.");
+            return false;
+        }
+        ObjList* list = AS_LIST(obj);
+        int i = asInt(index);
+        if (i < 0) i += list->count;
+        if (i < 0 || i >= list->count) {
+            runtimeError(vm, "List index %d out of range (length %d).", i, list->count);
+            return false;
+        }
+        *result = list->items[i];
+    } else if (IS_MAP(obj)) {
+        if (!mapGetKey(AS_MAP(obj), index, result)) {
+            *result = NIL_VAL;
+        }
+    } else if (IS_STRING(obj)) {
+        if (!IS_NUMBER(index)) {
+            runtimeError(vm, "String index must be a number.");
+            return false;
+        }
+        ObjString* str = AS_STRING(obj);
+        int i = asInt(index);
+        if (i < 0) i += str->length;
+        if (i < 0 || i >= str->length) {
+            runtimeError(vm, "String index out of range.");
+            return false;
+        }
+        *result = OBJ_VAL(copyString(vm, &str->chars[i], 1));
+    } else {
+        runtimeError(vm, "Only lists, maps, and strings support indexing.");
+        return false;
+    }
+    return true;
+}
+
+static bool indexSet(VM* vm, Value obj, Value index, Value value) {
+    if (IS_LIST(obj)) {
+        if (!IS_NUMBER(index)) {
+            runtimeError(vm, "List index must be a number.");
+            return false;
+        }
+        ObjList* list = AS_LIST(obj);
+        int i = asInt(index);
+        if (i < 0) i += list->count;
+        if (i < 0 || i >= list->count) {
+            runtimeError(vm, "List index out of range.");
+            return false;
+        }
+        list->items[i] = value;
+        LIST_WRITE_BARRIER(list, i, value);
+    } else if (IS_MAP(obj)) {
+        mapSetKey(vm, AS_MAP(obj), index, value);
+    } else {
+        runtimeError(vm, "Only lists and maps support index assignment.");
+        return false;
+    }
+    return true;
+}
+
 // ---- String Concatenation ----
 
 static void concatenate(VM* vm) {
@@ -1478,17 +1830,199 @@ static void concatenate(VM* vm) {
     push(vm, OBJ_VAL(result));
 }
 
+// ---- Quickening ----
+// Generic arithmetic/compare sites that see two numbers rewrite their opcode
+// in place to a *_NUM form. A *_NUM site that sees anything else rewrites
+// itself back and bumps its miss count; after QUICKEN_MISS_LIMIT misses the
+// site stays generic so polymorphic code does not flip-flop.
+
+static inline void quicken(CallFrame* frame, uint8_t* site, OpCode op) {
+    Chunk* chunk = &frame->closure->function->chunk;
+    if (chunk->quickenMisses != NULL &&
+        chunk->quickenMisses[site - chunk->code] >= QUICKEN_MISS_LIMIT) {
+        return;
+    }
+    *site = (uint8_t)op;
+}
+
+static void dequicken(CallFrame* frame, uint8_t* site, OpCode op) {
+    Chunk* chunk = &frame->closure->function->chunk;
+    if (chunk->quickenMisses == NULL) {
+        chunk->quickenMisses = GROW_ARRAY(uint8_t, NULL, 0, chunk->capacity);
+        memset(chunk->quickenMisses, 0, chunk->capacity);
+    }
+    chunk->quickenMisses[site - chunk->code]++;
+    *site = (uint8_t)op;
+}
+
+#ifdef DEBUG_IC_STATS
+#define IC_STAT(counter) (vm->counter++)
+#else
+#define IC_STAT(counter) ((void)0)
+#endif
+
+// ---- Property Inline Cache ----
+// Shape-mode maps hit when the map still has the cached shape; dictionary
+// maps hit when the cached entry still holds the name. Misses do the full
+// lookup and refill the slot for whichever mode the map is in.
+
+// Entries still in the old block of a table being rebuilt (see table.h)
+// move on later inserts, so only those in its current block are cached
+static inline void cacheTableEntry(PropertyICSlot* ic, Table* table, Entry* entry) {
+    uintptr_t offset = (uintptr_t)entry - (uintptr_t)table->entries;
+    ic->shape = NULL;
+    if (offset < sizeof(Entry) * (size_t)table->used) {
+        ic->tableCapacity = table->capacity;
+        ic->index = (int)(offset / sizeof(Entry));
+    } else {
+        ic->tableCapacity = -1;
+    }
+}
+
+// The slot for a site's IC operand, or NULL for an uncached site
+static inline PropertyICSlot* propertyIC(Chunk* chunk, uint8_t operand) {
+    if (UNLIKELY(operand == PROPERTY_IC_NONE)) return NULL;
+    return &chunk->propertyICs[operand];
+}
+
+static inline Value getPropertyCached(VM* vm, ObjMap* map, ObjString* name,
+                                      PropertyICSlot* ic) {
+    (void)vm;
+    if (UNLIKELY(ic == NULL)) {
+        Value value;
+        return mapGet(map, name, &value) ? value : NIL_VAL;
+    }
+    if (map->shape != NULL) {
+        if (LIKELY(map->shape == ic->shape)) {
+            IC_STAT(propertyICHits);
+            return map->values[ic->index];
+        }
+        IC_STAT(propertyICMisses);
+        int slot = shapeFind(map->shape, name);
+        if (slot < 0) return NIL_VAL;
+        ic->shape = map->shape;
+        ic->tableCapacity = -1;
+        ic->index = slot;
+        return map->values[slot];
+    }
+
+    Table* table = &map->table;
+    if (LIKELY(ic->tableCapacity == table->capacity &&
+               table->entries[ic->index].key == OBJ_VAL(name))) {
+        IC_STAT(propertyICHits);
+        return table->entries[ic->index].value;
+    }
+    IC_STAT(propertyICMisses);
+    Entry* entry;
+    if (!tableGetEntry(table, OBJ_VAL(name), &entry)) return NIL_VAL;
+    cacheTableEntry(ic, table, entry);
+    return entry->value;
+}
+
+static inline void setPropertyCached(VM* vm, ObjMap* map, ObjString* name,
+                                     PropertyICSlot* ic, Value value) {
+    if (UNLIKELY(ic == NULL)) {
+        mapSet(vm, map, name, value);
+        return;
+    }
+    if (map->shape != NULL && map->shape == ic->shape) {
+        IC_STAT(propertyICHits);
+        map->values[ic->index] = value;
+        WRITE_BARRIER(map, value);
+        return;
+    }
+    if (map->shape == NULL && ic->tableCapacity == map->table.capacity &&
+        map->table.entries[ic->index].key == OBJ_VAL(name)) {
+        IC_STAT(propertyICHits);
+        map->table.entries[ic->index].value = value;
+        WRITE_BARRIER(map, value);
+        return;
+    }
+
+    IC_STAT(propertyICMisses);
+    mapSet(vm, map, name, value);
+    if (map->shape != NULL) {
+        ic->shape = map->shape;
+        ic->tableCapacity = -1;
+        ic->index = shapeFind(map->shape, name);
+    } else {
+        Entry* entry;
+        tableGetEntry(&map->table, OBJ_VAL(name), &entry);
+        cacheTableEntry(ic, &map->table, entry);
+    }
+}
+
 // ---- Execution Loop ----
 
+// Computed goto dispatch avoids indirect branch misprediction from switch (~15-25% faster on GCC/Clang)
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_COMPUTED_GOTO
+#endif
+
+// Threaded code needs label addresses
+#if defined(THREADED_CODE) && !defined(USE_COMPUTED_GOTO)
+#undef THREADED_CODE
+#endif
+
+#ifdef THREADED_CODE
+// Pre-decode a chunk for threaded dispatch: one word per bytecode byte, so
+// jump offsets and operand positions carry over unchanged. Opcode bytes
+// become their handler's address, operand bytes are stored as integers.
+static void threadChunk(Chunk* chunk, void* const* handlers) {
+    chunk->threaded = GROW_ARRAY(void*, NULL, 0, chunk->count);
+    int offset = 0;
+    while (offset < chunk->count) {
+        int length = instructionLength(chunk, offset);
+        chunk->threaded[offset] = handlers[chunk->code[offset]];
+        for (int i = 1; i < length && offset + i < chunk->count; i++) {
+            chunk->threaded[offset + i] = (void*)(uintptr_t)chunk->code[offset + i];
+        }
+        offset += length;
+    }
+}
+#endif
+
 static InterpretResult run(VM* vm) {
     CallFrame* frame = &vm->frames[vm->frameCount - 1];
 
     // 'ip' and 'constants' are cached in locals to avoid pointer chasing on every instruction
+#ifdef THREADED_CODE
+    // ip walks the chunk's threaded words; frame->ip stays a bytecode
+    // pointer so errors, handlers and the rest of the VM are unaffected
+    register void** ip = NULL;
+    uint8_t* codeBase = NULL;
+    void** threadBase = NULL;
+    register Value* constants = NULL;
+#else
     register uint8_t* ip = frame->ip;
     register Value* constants = frame->closure->function->chunk.constants.values;
+#endif
 
     // STORE_FRAME before any call that may need the current ip (errors, callValue)
     // LOAD_FRAME after any call that may switch to a new frame (calls, returns)
+#ifdef THREADED_CODE
+#define STORE_FRAME() (frame->ip = codeBase + (ip - threadBase))
+#define LOAD_FRAME() \
+    do { \
+        frame = &vm->frames[vm->frameCount - 1]; \
+        Chunk* frameChunk = &frame->closure->function->chunk; \
+        if (UNLIKELY(frameChunk->threaded == NULL)) { \
+            threadChunk(frameChunk, dispatch_table); \
+        } \
+        codeBase = frameChunk->code; \
+        threadBase = frameChunk->threaded; \
+        ip = threadBase + (frame->ip - codeBase); \
+        constants = frameChunk->constants.values; \
+    } while (false)
+
+#define READ_BYTE() ((uint8_t)(uintptr_t)*ip++)
+#define READ_SHORT() \
+    (ip += 2, (uint16_t)(((uintptr_t)ip[-2] << 8) | (uintptr_t)ip[-1]))
+// Bytecode address of an ip, and re-sync a threaded word after the byte
+// under it was rewritten (quickening)
+#define SITE(p) (codeBase + ((p) - threadBase))
+#define SYNC_SITE(p) (*(p) = dispatch_table[*SITE(p)])
+#else
 #define STORE_FRAME() (frame->ip = ip)
 #define LOAD_FRAME() \
     do { \
@@ -1500,25 +2034,55 @@ static InterpretResult run(VM* vm) {
 #define READ_BYTE() (*ip++)
 #define READ_SHORT() \
     (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define SITE(p) (p)
+#define SYNC_SITE(p) ((void)0)
+#endif
 #define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
+// 'result' is NUMBER_ARITH or COMPARE_RESULT (int fast path, else doubles)
+#define BINARY_OP(result, op, quickOp) \
     do { \
-        if (!IS_NUMBER(vm->stackTop[-1]) || !IS_NUMBER(vm->stackTop[-2])) { \
+        if (!IS_NUMBER2(vm->stackTop[-1], vm->stackTop[-2])) { \
             STORE_FRAME(); \
             runtimeError(vm, "Operands must be numbers."); \
             return INTERPRET_RUNTIME_ERROR; \
         } \
-        double b = AS_NUMBER(vm->stackTop[-1]); \
-        double a = AS_NUMBER(vm->stackTop[-2]); \
+        quicken(frame, SITE(ip - 1), quickOp); \
+        SYNC_SITE(ip - 1); \
+        Value b = vm->stackTop[-1]; \
+        Value a = vm->stackTop[-2]; \
         vm->stackTop--; \
-        vm->stackTop[-1] = valueType(a op b); \
+        vm->stackTop[-1] = result(a, b, op); \
+    } while (false)
+// Quickened form: on a type miss, revert the site and re-dispatch it generically
+#define QUICK_BINARY_OP(result, op, genericOp) \
+    do { \
+        if (UNLIKELY(!IS_NUMBER2(vm->stackTop[-1], vm->stackTop[-2]))) { \
+            dequicken(frame, SITE(--ip), genericOp); \
+            SYNC_SITE(ip); \
+            NEXT(); \
+        } \
+        Value b = vm->stackTop[-1]; \
+        Value a = vm->stackTop[-2]; \
+        vm->stackTop--; \
+        vm->stackTop[-1] = result(a, b, op); \
     } while (false)
 
-    // Computed goto dispatch avoids indirect branch misprediction from switch (~15-25% faster on GCC/Clang)
-#if defined(__GNUC__) || defined(__clang__)
-#define USE_COMPUTED_GOTO
-#endif
+// Intrinsic sites: run the inline fast path only while the global still
+// holds the native installed by initVM
+#define INTRINSIC_GUARD(nativeFn, argCount) \
+    do { \
+        uint16_t slot = READ_SHORT(); \
+        Value callee = vm->globalValues[slot]; \
+        if (UNLIKELY(!IS_NATIVE(callee) || AS_NATIVE(callee)->function != nativeFn)) { \
+            STORE_FRAME(); \
+            if (!callRebound(vm, slot, argCount)) { \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            LOAD_FRAME(); \
+            goto callReturned; \
+        } \
+    } while (false)
 
 #ifdef USE_COMPUTED_GOTO
     static void* dispatch_table[] = {
@@ -1550,6 +2114,12 @@ static InterpretResult run(VM* vm) {
         [OP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
         [OP_LOOP]          = &&op_LOOP,
         [OP_CALL]          = &&op_CALL,
+        [OP_LEN]           = &&op_LEN,
+        [OP_TYPE]          = &&op_TYPE,
+        [OP_STR]           = &&op_STR,
+        [OP_APPEND]        = &&op_APPEND,
+        [OP_CONTAINS]      = &&op_CONTAINS,
+        [OP_TAIL_CALL]     = &&op_TAIL_CALL,
         [OP_CLOSURE]       = &&op_CLOSURE,
         [OP_RETURN]        = &&op_RETURN,
         [OP_CLOSE_UPVALUE] = &&op_CLOSE_UPVALUE,
@@ -1566,9 +2136,30 @@ static InterpretResult run(VM* vm) {
         [OP_POP_HANDLER]   = &&op_POP_HANDLER,
         [OP_THROW]         = &&op_THROW,
         [OP_IMPORT]        = &&op_IMPORT,
+        [OP_RANGE]             = &&op_RANGE,
+        [OP_FOR_ITER]          = &&op_FOR_ITER,
+        [OP_SET_LOCAL_POP]     = &&op_SET_LOCAL_POP,
+        [OP_SET_GLOBAL_POP]    = &&op_SET_GLOBAL_POP,
+        [OP_INC_LOCAL]         = &&op_INC_LOCAL,
+        [OP_INC_GLOBAL]        = &&op_INC_GLOBAL,
+        [OP_POP_JUMP_IF_FALSE] = &&op_POP_JUMP_IF_FALSE,
+        [OP_LESS_JUMP]         = &&op_LESS_JUMP,
+        [OP_LESS_CONST_JUMP]   = &&op_LESS_CONST_JUMP,
+        [OP_LESS_LOCALS_JUMP]  = &&op_LESS_LOCALS_JUMP,
+        [OP_ADD_NUM]           = &&op_ADD_NUM,
+        [OP_SUBTRACT_NUM]      = &&op_SUBTRACT_NUM,
+        [OP_MULTIPLY_NUM]      = &&op_MULTIPLY_NUM,
+        [OP_GREATER_NUM]       = &&op_GREATER_NUM,
+        [OP_GREATER_EQUAL_NUM] = &&op_GREATER_EQUAL_NUM,
+        [OP_LESS_NUM]          = &&op_LESS_NUM,
+        [OP_LESS_EQUAL_NUM]    = &&op_LESS_EQUAL_NUM,
     };
 
+#ifdef THREADED_CODE
+    #define DISPATCH() goto **ip++
+#else
     #define DISPATCH() goto *dispatch_table[READ_BYTE()]
+#endif
     #define CASE(name) op_##name
     #define NEXT() DISPATCH()
     #define LOOP_START DISPATCH();
@@ -1581,6 +2172,10 @@ static InterpretResult run(VM* vm) {
     #define LOOP_END }}
 #endif
 
+#ifdef THREADED_CODE
+    LOAD_FRAME();
+#endif
+
     LOOP_START
 
 #ifdef DEBUG_TRACE
@@ -1594,7 +2189,7 @@ static InterpretResult run(VM* vm) {
         }
         printf("\n");
         disassembleInstruction(&frame->closure->function->chunk,
-            (int)(ip - frame->closure->function->chunk.code));
+            (int)(SITE(ip) - frame->closure->function->chunk.code));
 #endif
 
     CASE(CONSTANT): {
@@ -1607,11 +2202,13 @@ static InterpretResult run(VM* vm) {
     CASE(FALSE): *vm->stackTop++ = FALSE_VAL; NEXT();
 
     CASE(ADD): {
-        if (IS_NUMBER(vm->stackTop[-1]) && IS_NUMBER(vm->stackTop[-2])) {
-            double b = AS_NUMBER(vm->stackTop[-1]);
-            double a = AS_NUMBER(vm->stackTop[-2]);
+        if (IS_NUMBER2(vm->stackTop[-1], vm->stackTop[-2])) {
+            quicken(frame, SITE(ip - 1), OP_ADD_NUM);
+            SYNC_SITE(ip - 1);
+            Value b = vm->stackTop[-1];
+            Value a = vm->stackTop[-2];
             vm->stackTop--;
-            vm->stackTop[-1] = NUMBER_VAL(a + b);
+            vm->stackTop[-1] = NUMBER_ARITH(a, b, +);
         } else if (IS_STRING(vm->stackTop[-1]) && IS_STRING(vm->stackTop[-2])) {
             concatenate(vm);
         } else {
@@ -1622,23 +2219,23 @@ static InterpretResult run(VM* vm) {
         NEXT();
     }
 
-    CASE(SUBTRACT): BINARY_OP(NUMBER_VAL, -); NEXT();
-    CASE(MULTIPLY): BINARY_OP(NUMBER_VAL, *); NEXT();
+    CASE(SUBTRACT): BINARY_OP(NUMBER_ARITH, -, OP_SUBTRACT_NUM); NEXT();
+    CASE(MULTIPLY): BINARY_OP(NUMBER_ARITH, *, OP_MULTIPLY_NUM); NEXT();
     CASE(DIVIDE): {
         if (!IS_NUMBER(vm->stackTop[-1]) || !IS_NUMBER(vm->stackTop[-2])) {
             STORE_FRAME();
             runtimeError(vm, "Operands must be numbers.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        double b = AS_NUMBER(vm->stackTop[-1]);
-        if (b == 0) {
+        Value b = vm->stackTop[-1];
+        Value a = vm->stackTop[-2];
+        if (AS_NUMBER(b) == 0) {
             STORE_FRAME();
             runtimeError(vm, "Division by zero.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        double a = AS_NUMBER(vm->stackTop[-2]);
         vm->stackTop--;
-        vm->stackTop[-1] = NUMBER_VAL(a / b);
+        vm->stackTop[-1] = divideNumbers(a, b);
         NEXT();
     }
     CASE(MODULO): {
@@ -1647,10 +2244,10 @@ static InterpretResult run(VM* vm) {
             runtimeError(vm, "Operands must be numbers.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        double b = AS_NUMBER(vm->stackTop[-1]);
-        double a = AS_NUMBER(vm->stackTop[-2]);
+        Value b = vm->stackTop[-1];
+        Value a = vm->stackTop[-2];
         vm->stackTop--;
-        vm->stackTop[-1] = NUMBER_VAL(fmod(a, b));
+        vm->stackTop[-1] = moduloNumbers(a, b);
         NEXT();
     }
 
@@ -1660,7 +2257,7 @@ static InterpretResult run(VM* vm) {
             runtimeError(vm, "Operand must be a number.");
             return INTERPRET_RUNTIME_ERROR;
         }
-        vm->stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm->stackTop[-1]));
+        vm->stackTop[-1] = negateNumber(vm->stackTop[-1]);
         NEXT();
     }
 
@@ -1678,10 +2275,18 @@ static InterpretResult run(VM* vm) {
         vm->stackTop[-1] = BOOL_VAL(!valuesEqual(a, b));
         NEXT();
     }
-    CASE(GREATER):       BINARY_OP(BOOL_VAL, >); NEXT();
-    CASE(GREATER_EQUAL): BINARY_OP(BOOL_VAL, >=); NEXT();
-    CASE(LESS):          BINARY_OP(BOOL_VAL, <); NEXT();
-    CASE(LESS_EQUAL):    BINARY_OP(BOOL_VAL, <=); NEXT();
+    CASE(GREATER):       BINARY_OP(COMPARE_RESULT, >, OP_GREATER_NUM); NEXT();
+    CASE(GREATER_EQUAL): BINARY_OP(COMPARE_RESULT, >=, OP_GREATER_EQUAL_NUM); NEXT();
+    CASE(LESS):          BINARY_OP(COMPARE_RESULT, <, OP_LESS_NUM); NEXT();
+    CASE(LESS_EQUAL):    BINARY_OP(COMPARE_RESULT, <=, OP_LESS_EQUAL_NUM); NEXT();
+
+    CASE(ADD_NUM):           QUICK_BINARY_OP(NUMBER_ARITH, +, OP_ADD); NEXT();
+    CASE(SUBTRACT_NUM):      QUICK_BINARY_OP(NUMBER_ARITH, -, OP_SUBTRACT); NEXT();
+    CASE(MULTIPLY_NUM):      QUICK_BINARY_OP(NUMBER_ARITH, *, OP_MULTIPLY); NEXT();
+    CASE(GREATER_NUM):       QUICK_BINARY_OP(COMPARE_RESULT, >, OP_GREATER); NEXT();
+    CASE(GREATER_EQUAL_NUM): QUICK_BINARY_OP(COMPARE_RESULT, >=, OP_GREATER_EQUAL); NEXT();
+    CASE(LESS_NUM):          QUICK_BINARY_OP(COMPARE_RESULT, <, OP_LESS); NEXT();
+    CASE(LESS_EQUAL_NUM):    QUICK_BINARY_OP(COMPARE_RESULT, <=, OP_LESS_EQUAL); NEXT();
 
     CASE(NOT):
         vm->stackTop[-1] = BOOL_VAL(isFalsey(vm->stackTop[-1]));
@@ -1699,46 +2304,24 @@ static InterpretResult run(VM* vm) {
     }
 
     CASE(GET_GLOBAL): {
-        ObjString* name = READ_STRING();
-        uint32_t slot = name->hash & (GLOBAL_IC_SIZE - 1);
-        GlobalICSlot* ic = &vm->globalIC[slot];
-        if (LIKELY(ic->key == name && ic->tableCapacity == vm->globals.capacity)) {
-            *vm->stackTop++ = ic->entry->value;
-        } else {
-            Entry* entry;
-            if (UNLIKELY(!tableGetEntry(&vm->globals, name, &entry))) {
-                STORE_FRAME();
-                runtimeError(vm, "Undefined variable '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ic->key = name;
-            ic->entry = entry;
-            ic->tableCapacity = vm->globals.capacity;
-            *vm->stackTop++ = entry->value;
+        uint16_t slot = READ_SHORT();
+        Value value = vm->globalValues[slot];
+        if (UNLIKELY(IS_UNDEFINED(value))) {
+            STORE_FRAME();
+            runtimeError(vm, "Undefined variable '%s'.", vm->globalNames[slot]->chars);
+            return INTERPRET_RUNTIME_ERROR;
         }
+        *vm->stackTop++ = value;
         NEXT();
     }
     CASE(SET_GLOBAL): {
-        ObjString* name = READ_STRING();
-        Value value = vm->stackTop[-1];
-        uint32_t slot = name->hash & (GLOBAL_IC_SIZE - 1);
-        GlobalICSlot* ic = &vm->globalIC[slot];
-        if (LIKELY(ic->key == name && ic->tableCapacity == vm->globals.capacity)) {
-            ic->entry->value = value;
-        } else {
-            tableSet(&vm->globals, name, value);
-            Entry* entry;
-            tableGetEntry(&vm->globals, name, &entry);
-            ic->key = name;
-            ic->entry = entry;
-            ic->tableCapacity = vm->globals.capacity;
-        }
+        uint16_t slot = READ_SHORT();
+        vm->globalValues[slot] = vm->stackTop[-1];
         NEXT();
     }
     CASE(DEFINE_GLOBAL): {
-        ObjString* name = READ_STRING();
-        tableSet(&vm->globals, name, vm->stackTop[-1]);
-        vm->stackTop--;
+        uint16_t slot = READ_SHORT();
+        vm->globalValues[slot] = *(--vm->stackTop);
         NEXT();
     }
 
@@ -1749,7 +2332,9 @@ static InterpretResult run(VM* vm) {
     }
     CASE(SET_UPVALUE): {
         uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->location = vm->stackTop[-1];
+        ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+        *upvalue->location = vm->stackTop[-1];
+        WRITE_BARRIER(upvalue, vm->stackTop[-1]);
         NEXT();
     }
 
@@ -1765,7 +2350,28 @@ static InterpretResult run(VM* vm) {
     }
     CASE(LOOP): {
         uint16_t offset = READ_SHORT();
+        // Raised by the allocator (the heap limit) in a loop without calls
+        if (UNLIKELY(vm->hasError)) goto callReturned;
         ip -= offset;
+        if (vm->compactPending && vm->baseFrameCount == 0) {
+            // Safepoint: no native or nested run() below us holds an object
+            STORE_FRAME();
+            compactHeap(vm);
+            LOAD_FRAME();
+        }
+        if (vm->jitEnabled) {
+            // Hot loop: continue this frame in machine code from the loop header
+            ObjFunction* function = frame->closure->function;
+            if (function->jitCode != NULL ||
+                (++function->hotness == JIT_THRESHOLD && jitCompile(vm, function))) {
+                STORE_FRAME();
+                if (jitEnter(vm, frame, (int)(frame->ip - function->chunk.code)) == JIT_ERROR) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                goto callReturned;
+            }
+        }
         NEXT();
     }
 
@@ -1777,26 +2383,36 @@ static InterpretResult run(VM* vm) {
         }
         LOAD_FRAME();
 
+    callReturned:
         // Check for raised errors (e.g. from exec, permission denied)
         if (vm->hasError) {
-            if (vm->handlerCount > 0) {
+            if (vm->handlerCount > 0 &&
+                vm->handlers[vm->handlerCount - 1].frameCount > vm->baseFrameCount) {
                 ErrorHandler* handler = &vm->handlers[vm->handlerCount - 1];
                 // Unwind to handler state
                 vm->frameCount = handler->frameCount;
+                vm->frames[vm->frameCount - 1].ip = handler->handlerIP;
                 LOAD_FRAME();
                 vm->stackTop = handler->stackTop;
                 // Push error value for the handler to use
                 push(vm, vm->currentError);
-                ip = handler->handlerIP;
                 vm->hasError = false;
                 vm->currentError = NIL_VAL;
+            } else if (vm->handlerCount > 0) {
+                // The handler belongs to a caller below a nested run()
+                // (native callback or register frame): return nil to it
+                // with the error still pending
+                vm->stackTop = vm->frames[vm->baseFrameCount].slots;
+                vm->frameCount = vm->baseFrameCount;
+                push(vm, NIL_VAL);
+                return INTERPRET_OK;
             } else {
                 // No handler - print error and terminate
                 if (IS_OBJ(vm->currentError) && IS_MAP(vm->currentError)) {
                     ObjMap* errMap = AS_MAP(vm->currentError);
                     Value msgVal;
                     ObjString* msgKey = copyString(vm, "message", 7);
-                    if (tableGet(&errMap->table, msgKey, &msgVal) && IS_STRING(msgVal)) {
+                    if (mapGet(errMap, msgKey, &msgVal) && IS_STRING(msgVal)) {
                         STORE_FRAME();
                         runtimeError(vm, "%s", AS_CSTRING(msgVal));
                     } else {
@@ -1815,6 +2431,103 @@ static InterpretResult run(VM* vm) {
         NEXT();
     }
 
+    CASE(TAIL_CALL): {
+        int argCount = READ_BYTE();
+        Value callee = peek(vm, argCount);
+        if (!IS_CLOSURE(callee)) {
+            // Natives and errors behave exactly like OP_CALL; the OP_RETURN
+            // that follows hands the result back
+            STORE_FRAME();
+            if (!callValue(vm, callee, argCount)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            goto callReturned;
+        }
+
+        ObjClosure* closure = AS_CLOSURE(callee);
+        if (argCount != closure->function->arity) {
+            STORE_FRAME();
+            runtimeError(vm, "Expected %d arguments but got %d.",
+                         closure->function->arity, argCount);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+
+        // Reuse the current frame: close anything captured from it, then
+        // slide callee + arguments down over its slots
+        closeUpvalues(vm, frame->slots);
+        memmove(frame->slots, vm->stackTop - argCount - 1,
+                sizeof(Value) * (argCount + 1));
+        vm->stackTop = frame->slots + argCount + 1;
+        frame->closure = closure;
+        frame->ip = closure->function->chunk.code;
+
+        if (closure->function->regChunk != NULL) {
+            // Register code runs the frame, and either returns from it or
+            // hands it back with stack code to go on with
+            int frames = vm->frameCount;
+            if (!runRegister(vm)) return INTERPRET_RUNTIME_ERROR;
+            if (vm->frameCount < frames) {
+                // Returned, with the result where the callee was: finish
+                // as OP_RETURN would (a register frame may leave an error)
+                if (vm->baseFrameCount > 0 && vm->frameCount == vm->baseFrameCount) {
+                    return INTERPRET_OK;
+                }
+                LOAD_FRAME();
+                goto callReturned;
+            }
+        }
+        LOAD_FRAME();
+        NEXT();
+    }
+
+    CASE(LEN): {
+        INTRINSIC_GUARD(lenNative, 1);
+        Value value = vm->stackTop[-1];
+        if (IS_STRING(value)) {
+            vm->stackTop[-1] = INT_VAL(AS_STRING(value)->length);
+        } else if (IS_LIST(value)) {
+            vm->stackTop[-1] = INT_VAL(AS_LIST(value)->count);
+        } else {
+            vm->stackTop[-1] = lenNative(vm, 1, vm->stackTop - 1);
+        }
+        NEXT();
+    }
+
+    CASE(TYPE): {
+        INTRINSIC_GUARD(typeNative, 1);
+        vm->stackTop[-1] = typeNative(vm, 1, vm->stackTop - 1);
+        NEXT();
+    }
+
+    CASE(STR): {
+        INTRINSIC_GUARD(strNative, 1);
+        if (!IS_STRING(vm->stackTop[-1])) {
+            vm->stackTop[-1] = strNative(vm, 1, vm->stackTop - 1);
+        }
+        NEXT();
+    }
+
+    CASE(APPEND): {
+        INTRINSIC_GUARD(appendNative, 2);
+        Value list = vm->stackTop[-2];
+        if (IS_LIST(list)) {
+            listAppend(vm, AS_LIST(list), vm->stackTop[-1]);
+        } else {
+            vm->stackTop[-2] = NIL_VAL;
+        }
+        vm->stackTop--;
+        NEXT();
+    }
+
+    CASE(CONTAINS): {
+        INTRINSIC_GUARD(containsNative, 2);
+        Value result = containsNative(vm, 2, vm->stackTop - 2);
+        vm->stackTop--;
+        vm->stackTop[-1] = result;
+        NEXT();
+    }
+
     CASE(CLOSURE): {
         ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
         ObjClosure* closure = newClosure(vm, function);
@@ -1827,6 +2540,7 @@ static InterpretResult run(VM* vm) {
             } else {
                 closure->upvalues[i] = frame->closure->upvalues[index];
             }
+            WRITE_BARRIER(closure, OBJ_VAL(closure->upvalues[i]));
         }
         NEXT();
     }
@@ -1887,12 +2601,7 @@ static InterpretResult run(VM* vm) {
         for (int i = count; i > 0; i--) {
             Value val = vm->stackTop[-1 - (2 * i - 1)];
             Value key = vm->stackTop[-1 - (2 * i)];
-            if (!IS_STRING(key)) {
-                STORE_FRAME();
-                runtimeError(vm, "Map key must be a string.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            tableSet(&map->table, AS_STRING(key), val);
+            mapSetKey(vm, map, key, val);
         }
 
         vm->stackTop -= 2 * count + 1;
@@ -1901,115 +2610,39 @@ static InterpretResult run(VM* vm) {
     }
 
     CASE(INDEX_GET): {
-        Value index = pop(vm);
-        Value obj = pop(vm);
-
-        if (IS_LIST(obj)) {
-            if (!IS_NUMBER(index)) {
-                STORE_FRAME();
-                runtimeError(vm, "List index must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ObjList* list = AS_LIST(obj);
-            int i = (int)AS_NUMBER(index);
-            if (i < 0) i += list->count;
-            if (i < 0 || i >= list->count) {
-                STORE_FRAME();
-                runtimeError(vm, "List index %d out of range (length %d).", i, list->count);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(vm, list->items[i]);
-        } else if (IS_MAP(obj)) {
-            if (!IS_STRING(index)) {
-                STORE_FRAME();
-                runtimeError(vm, "Map key must be a string.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ObjMap* map = AS_MAP(obj);
-            Value value;
-            if (tableGet(&map->table, AS_STRING(index), &value)) {
-                push(vm, value);
-            } else {
-                push(vm, NIL_VAL);
-            }
-        } else if (IS_STRING(obj)) {
-            if (!IS_NUMBER(index)) {
-                STORE_FRAME();
-                runtimeError(vm, "String index must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ObjString* str = AS_STRING(obj);
-            int i = (int)AS_NUMBER(index);
-            if (i < 0) i += str->length;
-            if (i < 0 || i >= str->length) {
-                STORE_FRAME();
-                runtimeError(vm, "String index out of range.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(vm, OBJ_VAL(copyString(vm, &str->chars[i], 1)));
-        } else {
-            STORE_FRAME();
-            runtimeError(vm, "Only lists, maps, and strings support indexing.");
+        Value result;
+        STORE_FRAME();
+        if (!indexGet(vm, vm->stackTop[-2], vm->stackTop[-1], &result)) {
             return INTERPRET_RUNTIME_ERROR;
         }
+        vm->stackTop--;
+        vm->stackTop[-1] = result;
         NEXT();
     }
 
     CASE(INDEX_SET): {
-        Value value = pop(vm);
-        Value index = pop(vm);
-        Value obj = pop(vm);
-
-        if (IS_LIST(obj)) {
-            if (!IS_NUMBER(index)) {
-                STORE_FRAME();
-                runtimeError(vm, "List index must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            ObjList* list = AS_LIST(obj);
-            int i = (int)AS_NUMBER(index);
-            if (i < 0) i += list->count;
-            if (i < 0 || i >= list->count) {
-                STORE_FRAME();
-                runtimeError(vm, "List index out of range.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            list->items[i] = value;
-            push(vm, value);
-        } else if (IS_MAP(obj)) {
-            if (!IS_STRING(index)) {
-                STORE_FRAME();
-                runtimeError(vm, "Map key must be a string.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            tableSet(&AS_MAP(obj)->table, AS_STRING(index), value);
-            push(vm, value);
-        } else {
-            STORE_FRAME();
-            runtimeError(vm, "Only lists and maps support index assignment.");
+        Value value = vm->stackTop[-1];
+        STORE_FRAME();
+        if (!indexSet(vm, vm->stackTop[-3], vm->stackTop[-2], value)) {
             return INTERPRET_RUNTIME_ERROR;
         }
+        vm->stackTop -= 2;
+        vm->stackTop[-1] = value;
         NEXT();
     }
 
     CASE(GET_PROPERTY): {
         Value obj = peek(vm, 0);
         ObjString* name = READ_STRING();
+        PropertyICSlot* ic = propertyIC(&frame->closure->function->chunk, READ_BYTE());
 
         if (IS_MAP(obj)) {
-            Value value;
-            if (tableGet(&AS_MAP(obj)->table, name, &value)) {
-                pop(vm);
-                push(vm, value);
-            } else {
-                pop(vm);
-                push(vm, NIL_VAL);
-            }
+            vm->stackTop[-1] = getPropertyCached(vm, AS_MAP(obj), name, ic);
         } else if (IS_LIST(obj)) {
             ObjList* list = AS_LIST(obj);
             if (name->length == 6 && memcmp(name->chars, "length", 6) == 0) {
                 pop(vm);
-                push(vm, NUMBER_VAL(list->count));
+                push(vm, INT_VAL(list->count));
             } else {
                 STORE_FRAME();
                 runtimeError(vm, "List has no property '%s'.", name->chars);
@@ -2019,7 +2652,7 @@ static InterpretResult run(VM* vm) {
             ObjString* str = AS_STRING(obj);
             if (name->length == 6 && memcmp(name->chars, "length", 6) == 0) {
                 pop(vm);
-                push(vm, NUMBER_VAL(str->length));
+                push(vm, INT_VAL(str->length));
             } else {
                 STORE_FRAME();
                 runtimeError(vm, "String has no property '%s'.", name->chars);
@@ -2037,6 +2670,7 @@ static InterpretResult run(VM* vm) {
         Value value = peek(vm, 0);
         Value obj = peek(vm, 1);
         ObjString* name = READ_STRING();
+        PropertyICSlot* ic = propertyIC(&frame->closure->function->chunk, READ_BYTE());
 
         if (!IS_MAP(obj)) {
             STORE_FRAME();
@@ -2044,10 +2678,9 @@ static InterpretResult run(VM* vm) {
             return INTERPRET_RUNTIME_ERROR;
         }
 
-        tableSet(&AS_MAP(obj)->table, name, value);
-        Value assignedValue = pop(vm);
-        pop(vm);
-        push(vm, assignedValue);
+        setPropertyCached(vm, AS_MAP(obj), name, ic, value);
+        vm->stackTop--;
+        vm->stackTop[-1] = value;
         NEXT();
     }
 
@@ -2067,7 +2700,7 @@ static InterpretResult run(VM* vm) {
             return INTERPRET_RUNTIME_ERROR;
         }
         ErrorHandler* handler = &vm->handlers[vm->handlerCount++];
-        handler->handlerIP = ip + offset;
+        handler->handlerIP = SITE(ip + offset);
         handler->frameCount = vm->frameCount;
         handler->stackTop = vm->stackTop;
         NEXT();
@@ -2082,6 +2715,169 @@ static InterpretResult run(VM* vm) {
     CASE(THROW):
         NEXT();
 
+    // ---- Iteration ----
+
+    CASE(RANGE): {
+        // Always followed by OP_CALL with the same count. If the callee is the
+        // builtin range(), replace the call with a lazy ObjRange and skip it;
+        // otherwise (rebound name, bad arguments) let the call run normally.
+        uint8_t argCount = READ_BYTE();
+        Value callee = vm->stackTop[-1 - argCount];
+        Value* args = vm->stackTop - argCount;
+        if (IS_NATIVE(callee) && AS_NATIVE(callee)->function == rangeNative &&
+            argCount >= 2 && IS_NUMBER2(args[0], args[1])) {
+            double step = 1;
+            if (argCount >= 3 && IS_NUMBER(args[2])) step = AS_NUMBER(args[2]);
+            if (step != 0) {
+                ObjRange* range = newRange(vm, AS_NUMBER(args[0]),
+                                           AS_NUMBER(args[1]), step);
+                vm->stackTop -= argCount;
+                vm->stackTop[-1] = OBJ_VAL(range);
+                ip += 2;
+            }
+        }
+        NEXT();
+    }
+
+    CASE(FOR_ITER): {
+        // iter[0] = iterable, iter[1] = cursor, iter[2] = loop variable
+        Value* iter = &frame->slots[READ_BYTE()];
+        uint16_t offset = READ_SHORT();
+        Value iterable = iter[0];
+        int cursor = asInt(iter[1]);
+
+        if (IS_LIST(iterable)) {
+            ObjList* list = AS_LIST(iterable);
+            if (cursor >= list->count) {
+                ip += offset;
+                NEXT();
+            }
+            iter[2] = list->items[cursor++];
+        } else if (IS_RANGE(iterable)) {
+            ObjRange* range = AS_RANGE(iterable);
+            double value = range->next;
+            if (range->step > 0 ? !(value < range->end) : !(value > range->end)) {
+                ip += offset;
+                NEXT();
+            }
+            iter[2] = numberValue(value);
+            range->next = value + range->step;
+        } else if (IS_STRING(iterable)) {
+            ObjString* str = AS_STRING(iterable);
+            if (cursor >= str->length) {
+                ip += offset;
+                NEXT();
+            }
+            iter[2] = OBJ_VAL(copyString(vm, &str->chars[cursor++], 1));
+        } else if (IS_MAP(iterable)) {
+            Value key;
+            Value value;
+            if (!mapNext(AS_MAP(iterable), &cursor, &key, &value)) {
+                ip += offset;
+                NEXT();
+            }
+            iter[2] = key;
+        } else if (IS_SET(iterable)) {
+            Value member;
+            if (!setNext(AS_SET(iterable), &cursor, &member)) {
+                ip += offset;
+                NEXT();
+            }
+            iter[2] = member;
+        } else {
+            STORE_FRAME();
+            runtimeError(vm, "Can only iterate over lists, strings, maps, sets and ranges.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        iter[1] = INT_VAL(cursor);
+        NEXT();
+    }
+
+    // ---- Superinstructions ----
+
+    CASE(SET_LOCAL_POP): {
+        uint8_t slot = READ_BYTE();
+        frame->slots[slot] = *(--vm->stackTop);
+        NEXT();
+    }
+    CASE(SET_GLOBAL_POP): {
+        uint16_t slot = READ_SHORT();
+        vm->globalValues[slot] = *(--vm->stackTop);
+        NEXT();
+    }
+    CASE(INC_LOCAL): {
+        uint8_t slot = READ_BYTE();
+        Value increment = READ_CONSTANT();
+        Value* local = &frame->slots[slot];
+        if (UNLIKELY(!IS_NUMBER(*local))) {
+            STORE_FRAME();
+            runtimeError(vm, "Operands must be two numbers or two strings.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        *local = NUMBER_ARITH(*local, increment, +);
+        NEXT();
+    }
+    CASE(INC_GLOBAL): {
+        uint16_t slot = READ_SHORT();
+        Value increment = READ_CONSTANT();
+        Value* global = &vm->globalValues[slot];
+        if (UNLIKELY(IS_UNDEFINED(*global))) {
+            STORE_FRAME();
+            runtimeError(vm, "Undefined variable '%s'.", vm->globalNames[slot]->chars);
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        if (UNLIKELY(!IS_NUMBER(*global))) {
+            STORE_FRAME();
+            runtimeError(vm, "Operands must be two numbers or two strings.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        *global = NUMBER_ARITH(*global, increment, +);
+        NEXT();
+    }
+    CASE(POP_JUMP_IF_FALSE): {
+        uint16_t offset = READ_SHORT();
+        if (isFalsey(*(--vm->stackTop))) ip += offset;
+        NEXT();
+    }
+    CASE(LESS_JUMP): {
+        uint16_t offset = READ_SHORT();
+        Value b = vm->stackTop[-1];
+        Value a = vm->stackTop[-2];
+        if (UNLIKELY(!IS_NUMBER(a) || !IS_NUMBER(b))) {
+            STORE_FRAME();
+            runtimeError(vm, "Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        vm->stackTop -= 2;
+        if (!NUMBER_COMPARE(a, b, <)) ip += offset;
+        NEXT();
+    }
+    CASE(LESS_CONST_JUMP): {
+        Value b = READ_CONSTANT();
+        uint16_t offset = READ_SHORT();
+        Value a = vm->stackTop[-1];
+        if (UNLIKELY(!IS_NUMBER(a) || !IS_NUMBER(b))) {
+            STORE_FRAME();
+            runtimeError(vm, "Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        vm->stackTop--;
+        if (!NUMBER_COMPARE(a, b, <)) ip += offset;
+        NEXT();
+    }
+    CASE(LESS_LOCALS_JUMP): {
+        Value a = frame->slots[READ_BYTE()];
+        Value b = frame->slots[READ_BYTE()];
+        uint16_t offset = READ_SHORT();
+        if (UNLIKELY(!IS_NUMBER(a) || !IS_NUMBER(b))) {
+            STORE_FRAME();
+            runtimeError(vm, "Operands must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        if (!NUMBER_COMPARE(a, b, <)) ip += offset;
+        NEXT();
+    }
+
     CASE(IMPORT): {
         ObjString* path = READ_STRING();
         ObjString* modName = READ_STRING();
@@ -2090,8 +2886,8 @@ static InterpretResult run(VM* vm) {
 
         // Check cache first
         Value cached;
-        if (tableGet(&vm->modules, path, &cached)) {
-            tableSet(&vm->globals, modName, cached);
+        if (tableGet(&vm->modules, OBJ_VAL(path), &cached)) {
+            vmDefineGlobal(vm, modName, cached);
             NEXT();
         }
 
@@ -2139,16 +2935,20 @@ static InterpretResult run(VM* vm) {
         modSource[bytesRead] = '\0';
         fclose(modFile);
 
-        // Snapshot existing global keys so we can diff after module execution
-        Table existingGlobals;
-        initTable(&existingGlobals);
-        tableAddAll(&vm->globals, &existingGlobals);
+        // Snapshot the global slots so we can diff after module execution
+        // (the module's compile may add new slots). The values are kept in
+        // a list so that builtins the module rebinds stay alive.
+        int globalsBefore = vm->globalCount;
+        ObjList* previous = newList(vm);
+        push(vm, OBJ_VAL(previous));
+        for (int i = 0; i < globalsBefore; i++) {
+            listAppend(vm, previous, vm->globalValues[i]);
+        }
 
         // Compile the module source
         ObjFunction* modFunc = compile(vm, modSource);
         free(modSource);
         if (modFunc == NULL) {
-            freeTable(&existingGlobals);
             runtimeError(vm, "Compilation error in module '%s'.", path->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
@@ -2160,7 +2960,6 @@ static InterpretResult run(VM* vm) {
         push(vm, OBJ_VAL(modClosure));
 
         if (!callClosure(vm, modClosure, 0)) {
-            freeTable(&existingGlobals);
             runtimeError(vm, "Error calling module '%s'.", path->chars);
             return INTERPRET_RUNTIME_ERROR;
         }
@@ -2171,31 +2970,32 @@ static InterpretResult run(VM* vm) {
         vm->baseFrameCount = savedBase;
 
         if (modResult != INTERPRET_OK) {
-            freeTable(&existingGlobals);
             return INTERPRET_RUNTIME_ERROR;
         }
 
         // Diff globals: anything the module added goes into the module map,
-        // then gets removed from globals to keep the namespace clean.
+        // then gets removed from globals to keep the namespace clean. So
+        // does a builtin the module redefined (its own add, say), and the
+        // builtin is put back.
         ObjMap* moduleMap = newMap(vm);
         push(vm, OBJ_VAL(moduleMap));
 
-        for (int i = 0; i < vm->globals.capacity; i++) {
-            Entry* entry = &vm->globals.entries[i];
-            if (entry->key == NULL) continue;
-
-            Value dummy;
-            if (!tableGet(&existingGlobals, entry->key, &dummy)) {
-                tableSet(&moduleMap->table, entry->key, entry->value);
-                tableDelete(&vm->globals, entry->key);
+        for (int i = 0; i < vm->globalCount; i++) {
+            if (IS_UNDEFINED(vm->globalValues[i])) continue;
+            Value before = i < globalsBefore ? previous->items[i] : UNDEFINED_VAL;
+            if (!IS_UNDEFINED(before) &&
+                (!IS_NATIVE(before) || before == vm->globalValues[i])) {
+                continue;
             }
+            mapSet(vm, moduleMap, vm->globalNames[i], vm->globalValues[i]);
+            vm->globalValues[i] = before;
         }
 
         pop(vm);
-        freeTable(&existingGlobals);
+        pop(vm);
 
-        tableSet(&vm->modules, path, OBJ_VAL(moduleMap)); // cache for future imports
-        tableSet(&vm->globals, modName, OBJ_VAL(moduleMap));
+        tableSet(&vm->modules, OBJ_VAL(path), OBJ_VAL(moduleMap)); // cache for future imports
+        vmDefineGlobal(vm, modName, OBJ_VAL(moduleMap));
 
         LOAD_FRAME();
         NEXT();
@@ -2210,6 +3010,10 @@ static InterpretResult run(VM* vm) {
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef QUICK_BINARY_OP
+#undef SITE
+#undef SYNC_SITE
+#undef INTRINSIC_GUARD
 #undef DISPATCH
 #undef CASE
 #undef NEXT
@@ -2217,6 +3021,365 @@ static InterpretResult run(VM* vm) {
 #undef LOOP_END
 }
 
+// ---- Register Execution ----
+// Runs one register-mode frame (see regcode.h) until it returns, or until a
+// tail call leaves stack code in it for the caller to run. Calls nest
+// through callClosure: register callees recurse into runRegister, stack
+// callees get a nested run() bounded by baseFrameCount. Returns false after
+// a runtime error.
+
+static bool runRegister(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    Value* R = frame->slots;
+    RegChunk* chunk;
+    Value* constants;
+    register uint32_t* ip;
+
+    // A tail call comes back here with the new closure in the frame
+enter:
+    chunk = frame->closure->function->regChunk;
+    constants = frame->closure->function->chunk.constants.values;
+    ip = chunk->code;
+    frame->regIP = ip;
+    if (R + chunk->maxRegisters > vm->stack + STACK_MAX) {
+        frame->regIP = ip + 1;
+        runtimeError(vm, "Stack overflow.");
+        return false;
+    }
+    // Registers above the parameters start out nil; everything below
+    // stackTop is a GC root
+    for (Value* slot = R + frame->closure->function->arity + 1;
+         slot < R + chunk->maxRegisters; slot++) {
+        *slot = NIL_VAL;
+    }
+    vm->stackTop = R + chunk->maxRegisters;
+
+#define RFAIL(...) \
+    do { \
+        frame->regIP = ip; \
+        runtimeError(vm, __VA_ARGS__); \
+        return false; \
+    } while (false)
+#define RNUMBER_OP(result, op) \
+    do { \
+        Value b = R[REG_B(i)], c = R[REG_C(i)]; \
+        if (UNLIKELY(!IS_NUMBER2(b, c))) RFAIL("Operands must be numbers."); \
+        R[REG_A(i)] = result(b, c, op); \
+    } while (false)
+// A raised error unwinds register frames; the nearest stack frame
+// dispatches it to its handler. Checked after calls and on loop back-edges
+// (the heap limit is raised by whatever allocation crosses it).
+#define RCHECK_ERROR() \
+    do { \
+        if (UNLIKELY(vm->hasError)) { \
+            R[0] = NIL_VAL; \
+            vm->stackTop = R + 1; \
+            vm->frameCount--; \
+            return true; \
+        } \
+    } while (false)
+#define RCOMPARE_JUMP(op) \
+    do { \
+        Value a = R[REG_A(i)], b = R[REG_B(i)]; \
+        if (UNLIKELY(!IS_NUMBER2(a, b))) RFAIL("Operands must be numbers."); \
+        int32_t offset = (int32_t)*ip++; \
+        if (!NUMBER_COMPARE(a, b, op)) ip += offset; \
+    } while (false)
+
+#ifdef USE_COMPUTED_GOTO
+    static void* dispatch_table[] = {
+        &&rop_MOVE, &&rop_LOADK, &&rop_LOADNIL, &&rop_LOADBOOL,
+        &&rop_GET_GLOBAL, &&rop_SET_GLOBAL,
+        &&rop_ADD, &&rop_SUBTRACT, &&rop_MULTIPLY, &&rop_DIVIDE, &&rop_MODULO,
+        &&rop_ADDK, &&rop_SUBTRACTK,
+        &&rop_EQUAL, &&rop_NOT_EQUAL, &&rop_LESS, &&rop_LESS_EQUAL,
+        &&rop_GREATER, &&rop_GREATER_EQUAL, &&rop_NOT, &&rop_NEGATE,
+        &&rop_JUMP, &&rop_JUMP_IF_FALSE, &&rop_JUMP_IF_TRUE,
+        &&rop_JUMP_UNLESS_LESS, &&rop_JUMP_UNLESS_LESS_EQUAL,
+        &&rop_FOR_PREP, &&rop_FOR_LOOP,
+        &&rop_INDEX_GET, &&rop_INDEX_SET, &&rop_BUILD_LIST,
+        &&rop_CALL, &&rop_TAIL_CALL, &&rop_RETURN, &&rop_RETURN_NIL,
+    };
+    uint32_t i;
+    #define RCASE(name) rop_##name
+    #define RNEXT() do { i = *ip++; goto *dispatch_table[REG_OP(i)]; } while (false)
+    #define RLOOP_START RNEXT();
+    #define RLOOP_END
+#else
+    #define RCASE(name) case ROP_##name
+    #define RNEXT() break
+    #define RLOOP_START for (;;) { uint32_t i = *ip++; switch (REG_OP(i)) {
+    #define RLOOP_END }}
+#endif
+
+    RLOOP_START
+
+    RCASE(MOVE):
+        R[REG_A(i)] = R[REG_B(i)];
+        RNEXT();
+    RCASE(LOADK):
+        R[REG_A(i)] = constants[REG_BX(i)];
+        RNEXT();
+    RCASE(LOADNIL):
+        R[REG_A(i)] = NIL_VAL;
+        RNEXT();
+    RCASE(LOADBOOL):
+        R[REG_A(i)] = BOOL_VAL(REG_B(i) != 0);
+        RNEXT();
+
+    RCASE(GET_GLOBAL): {
+        Value value = vm->globalValues[REG_BX(i)];
+        if (UNLIKELY(IS_UNDEFINED(value))) {
+            RFAIL("Undefined variable '%s'.", vm->globalNames[REG_BX(i)]->chars);
+        }
+        R[REG_A(i)] = value;
+        RNEXT();
+    }
+    RCASE(SET_GLOBAL):
+        vm->globalValues[REG_BX(i)] = R[REG_A(i)];
+        RNEXT();
+
+    RCASE(ADD): {
+        Value b = R[REG_B(i)], c = R[REG_C(i)];
+        if (LIKELY(IS_NUMBER2(b, c))) {
+            R[REG_A(i)] = NUMBER_ARITH(b, c, +);
+        } else if (IS_STRING(b) && IS_STRING(c)) {
+            push(vm, b);
+            push(vm, c);
+            concatenate(vm);
+            R[REG_A(i)] = pop(vm);
+        } else {
+            RFAIL("Operands must be two numbers or two strings.");
+        }
+        RNEXT();
+    }
+    RCASE(SUBTRACT): RNUMBER_OP(NUMBER_ARITH, -); RNEXT();
+    RCASE(MULTIPLY): RNUMBER_OP(NUMBER_ARITH, *); RNEXT();
+    RCASE(DIVIDE): {
+        Value b = R[REG_B(i)], c = R[REG_C(i)];
+        if (UNLIKELY(!IS_NUMBER2(b, c))) RFAIL("Operands must be numbers.");
+        if (UNLIKELY(AS_NUMBER(c) == 0)) RFAIL("Division by zero.");
+        R[REG_A(i)] = divideNumbers(b, c);
+        RNEXT();
+    }
+    RCASE(MODULO): {
+        Value b = R[REG_B(i)], c = R[REG_C(i)];
+        if (UNLIKELY(!IS_NUMBER2(b, c))) RFAIL("Operands must be numbers.");
+        R[REG_A(i)] = moduloNumbers(b, c);
+        RNEXT();
+    }
+    RCASE(ADDK): {
+        Value b = R[REG_B(i)];
+        if (UNLIKELY(!IS_NUMBER(b))) RFAIL("Operands must be two numbers or two strings.");
+        R[REG_A(i)] = NUMBER_ARITH(b, constants[REG_C(i)], +);
+        RNEXT();
+    }
+    RCASE(SUBTRACTK): {
+        Value b = R[REG_B(i)];
+        if (UNLIKELY(!IS_NUMBER(b))) RFAIL("Operands must be numbers.");
+        R[REG_A(i)] = NUMBER_ARITH(b, constants[REG_C(i)], -);
+        RNEXT();
+    }
+
+    RCASE(EQUAL):
+        R[REG_A(i)] = BOOL_VAL(valuesEqual(R[REG_B(i)], R[REG_C(i)]));
+        RNEXT();
+    RCASE(NOT_EQUAL):
+        R[REG_A(i)] = BOOL_VAL(!valuesEqual(R[REG_B(i)], R[REG_C(i)]));
+        RNEXT();
+    RCASE(LESS):          RNUMBER_OP(COMPARE_RESULT, <); RNEXT();
+    RCASE(LESS_EQUAL):    RNUMBER_OP(COMPARE_RESULT, <=); RNEXT();
+    RCASE(GREATER):       RNUMBER_OP(COMPARE_RESULT, >); RNEXT();
+    RCASE(GREATER_EQUAL): RNUMBER_OP(COMPARE_RESULT, >=); RNEXT();
+    RCASE(NOT):
+        R[REG_A(i)] = BOOL_VAL(isFalsey(R[REG_B(i)]));
+        RNEXT();
+    RCASE(NEGATE): {
+        Value b = R[REG_B(i)];
+        if (UNLIKELY(!IS_NUMBER(b))) RFAIL("Operand must be a number.");
+        R[REG_A(i)] = negateNumber(b);
+        RNEXT();
+    }
+
+    RCASE(JUMP):
+        if (REG_SBX(i) < 0) RCHECK_ERROR();
+        ip += REG_SBX(i);
+        RNEXT();
+    RCASE(JUMP_IF_FALSE):
+        if (isFalsey(R[REG_A(i)])) ip += REG_SBX(i);
+        RNEXT();
+    RCASE(JUMP_IF_TRUE):
+        if (!isFalsey(R[REG_A(i)])) ip += REG_SBX(i);
+        RNEXT();
+    RCASE(JUMP_UNLESS_LESS):       RCOMPARE_JUMP(<); RNEXT();
+    RCASE(JUMP_UNLESS_LESS_EQUAL): RCOMPARE_JUMP(<=); RNEXT();
+
+    RCASE(FOR_PREP): {
+        Value* loop = &R[REG_A(i)];
+        if (UNLIKELY(!IS_NUMBER2(loop[0], loop[1]))) RFAIL("Operands must be numbers.");
+        if (NUMBER_COMPARE(loop[0], loop[1], <)) {
+            loop[2] = loop[0];
+        } else {
+            ip += REG_SBX(i);
+        }
+        RNEXT();
+    }
+    RCASE(FOR_LOOP): {
+        Value* loop = &R[REG_A(i)];
+        loop[0] = NUMBER_ARITH(loop[0], INT_VAL(1), +);
+        if (NUMBER_COMPARE(loop[0], loop[1], <)) {
+            loop[2] = loop[0];
+            ip += REG_SBX(i);
+            RCHECK_ERROR();
+        }
+        RNEXT();
+    }
+
+    RCASE(INDEX_GET): {
+        Value object = R[REG_B(i)], index = R[REG_C(i)];
+        if (IS_LIST(object) && IS_NUMBER(index)) {
+            ObjList* list = AS_LIST(object);
+            int n = asInt(index);
+            if (n >= 0 && n < list->count) {
+                R[REG_A(i)] = list->items[n];
+                RNEXT();
+            }
+        }
+        Value result;
+        frame->regIP = ip;
+        if (!indexGet(vm, object, index, &result)) return false;
+        R[REG_A(i)] = result;
+        RNEXT();
+    }
+    RCASE(INDEX_SET):
+        frame->regIP = ip;
+        if (!indexSet(vm, R[REG_A(i)], R[REG_B(i)], R[REG_C(i)])) return false;
+        RNEXT();
+    RCASE(BUILD_LIST): {
+        ObjList* list = newList(vm);
+        R[REG_A(i)] = OBJ_VAL(list);
+        Value* items = &R[REG_B(i)];
+        for (int n = 0; n < REG_C(i); n++) {
+            listAppend(vm, list, items[n]);
+        }
+        RNEXT();
+    }
+
+    RCASE(CALL):
+    call: {
+        Value* base = &R[REG_A(i)];
+        int argCount = REG_B(i);
+        int frames = vm->frameCount;
+        frame->regIP = ip;
+        vm->stackTop = base + argCount + 1;
+        if (!callValue(vm, *base, argCount)) return false;
+        if (vm->frameCount > frames) {
+            // Stack-code callee: run it until it returns to this frame
+            int savedBase = vm->baseFrameCount;
+            vm->baseFrameCount = frames;
+            InterpretResult result = run(vm);
+            vm->baseFrameCount = savedBase;
+            if (result != INTERPRET_OK) return false;
+        }
+        *base = vm->stackTop[-1];
+        vm->stackTop = R + chunk->maxRegisters;
+        RCHECK_ERROR();
+        RNEXT();
+    }
+
+    RCASE(TAIL_CALL): {
+        // A closure callee takes over the frame (nothing in it was captured:
+        // register code has no upvalues), so deep tail recursion runs in
+        // constant space. Stack code is handed back to the caller to run,
+        // as if callClosure had pushed it. Anything else is an ordinary call.
+        Value callee = R[REG_A(i)];
+        int argCount = REG_B(i);
+        if (!IS_CLOSURE(callee) || AS_CLOSURE(callee)->function->arity != argCount) {
+            goto call;
+        }
+        ObjClosure* closure = AS_CLOSURE(callee);
+        memmove(R, &R[REG_A(i)], sizeof(Value) * (argCount + 1));
+        frame->closure = closure;
+        if (closure->function->regChunk != NULL) goto enter;
+        frame->ip = closure->function->chunk.code;
+        frame->regIP = NULL;
+        vm->stackTop = R + argCount + 1;
+        return true;
+    }
+
+    RCASE(RETURN):
+        R[0] = R[REG_A(i)];
+        vm->stackTop = R + 1;
+        vm->frameCount--;
+        return true;
+    RCASE(RETURN_NIL):
+        R[0] = NIL_VAL;
+        vm->stackTop = R + 1;
+        vm->frameCount--;
+        return true;
+
+    RLOOP_END
+
+#undef RFAIL
+#undef RNUMBER_OP
+#undef RCOMPARE_JUMP
+#undef RCHECK_ERROR
+#undef RCASE
+#undef RNEXT
+#undef RLOOP_START
+#undef RLOOP_END
+    return false;
+}
+
+// ---- Machine Code ----
+
+// Run the top frame's machine code (--jit) from its first instruction until
+// the frame returns. A guard exit finishes the frame in a nested run(); a
+// raised error unwinds it like a register frame (jitCompile leaves functions
+// with their own handlers interpreted).
+static bool runJit(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    JitStatus status = jitEnter(vm, frame, 0);
+    if (status == JIT_ERROR) return false;
+
+    if (status == JIT_EXIT && vm->hasError) {
+        closeUpvalues(vm, frame->slots);
+        vm->stackTop = frame->slots;
+        vm->frameCount--;
+        push(vm, NIL_VAL);
+        return true;
+    }
+
+    if (status == JIT_EXIT) {
+        int savedBase = vm->baseFrameCount;
+        vm->baseFrameCount = vm->frameCount - 1;
+        InterpretResult result = run(vm);
+        vm->baseFrameCount = savedBase;
+        return result == INTERPRET_OK;
+    }
+
+    Value result = vm->stackTop[-1];
+    closeUpvalues(vm, frame->slots);
+    vm->frameCount--;
+    vm->stackTop = frame->slots;
+    push(vm, result);
+    return true;
+}
+
+JitStatus vmJitCall(VM* vm, int argCount) {
+    int frames = vm->frameCount;
+    if (!callValue(vm, vm->stackTop[-1 - argCount], argCount)) return JIT_ERROR;
+    if (vm->frameCount > frames) {
+        // Interpreted callee: run it until it returns to the compiled frame
+        int savedBase = vm->baseFrameCount;
+        vm->baseFrameCount = frames;
+        InterpretResult result = run(vm);
+        vm->baseFrameCount = savedBase;
+        if (result != INTERPRET_OK) return JIT_ERROR;
+    }
+    return vm->hasError ? JIT_EXIT : JIT_CONTINUE;
+}
+
 // ---- Public API ----
 
 InterpretResult interpret(VM* vm, const char* source) {
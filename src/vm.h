@@ -6,22 +6,18 @@
 #include "chunk.h"
 #include "table.h"
 #include "object.h"
+#include "shape.h"
 #include "permission.h"
+#include "marker.h"
 
 #define FRAMES_MAX 256
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 #define HANDLER_MAX 64
-#define GLOBAL_IC_SIZE 512
-
-typedef struct {
-    ObjString* key;
-    Entry* entry;
-    int tableCapacity;
-} GlobalICSlot;
 
 typedef struct {
     ObjClosure* closure;
     uint8_t* ip;
+    uint32_t* regIP;    // register-mode frames: next register instruction, else NULL
     Value* slots;
 } CallFrame;
 
@@ -40,18 +36,48 @@ struct VM {
     Value stack[STACK_MAX];
     Value* stackTop;
 
-    Table globals;
+    // Globals live in a dense array. The compiler resolves each name to a
+    // slot once through globalSlots; unassigned slots hold UNDEFINED_VAL.
+    Table globalSlots;          // ObjString* name -> slot index
+    Value* globalValues;
+    ObjString** globalNames;    // slot -> name
+    int globalCount;
+    int globalCapacity;
+
     Table strings;
+    // One-byte strings, filled in on first use (see copyString): character
+    // loops (indexing, iteration, split(s, "")) then neither hash nor allocate
+    ObjString* charStrings[256];
 
     ObjUpvalue* openUpvalues;
 
-    // GC state
-    Obj* objects;
-    int grayCount;
-    int grayCapacity;
-    Obj** grayStack;
+    // GC state (generational, see memory.c)
+    Heap heap;              // object storage (see heap.h)
+    GCWorker gcWorkers[GC_MAX_THREADS]; // gray deques; [0] is this thread's
+    int gcThreads;          // markers in a full collection (run --gc-threads=N)
+    struct MarkerPool* markerPool;
+    Obj** remembered;       // old objects written to since the last collection
+    int rememberedCount;
+    int rememberedCapacity;
     size_t bytesAllocated;
-    size_t nextGC;
+    size_t nextGC;          // full collection threshold for bytesAllocated
+    double gcGrowth;        // nextGC = live bytes * this (run --gc-growth=F)
+    size_t maxHeap;         // raise an error beyond this (run --gc-max-heap=SIZE); 0: none
+    bool heapLimitRaised;   // that error is out and the heap is still over the limit
+    bool raisingHeapLimit;  // building that error, which allocates too
+    bool shrinkingStrings;  // the intern table is shrinking after a collection:
+                            // its new block must not start another one
+    size_t youngBytes;      // allocated since the last collection
+    size_t nurserySize;     // minor collection threshold for youngBytes
+    GCPhase gcPhase;        // of the full collection in progress
+    int sweepClass;         // GC_SWEEP: size class being swept,
+    HeapPage** sweepPageLink; // its next page,
+    LargeObject** sweepLink;  // then the next large object
+    size_t gcDebt;          // allocated since the last slice
+    int gcPauseUs;          // slice budget (run --gc-pause-us=N); 0: not incremental
+    bool gcCompact;         // compact after full collections (run --gc-compact)
+    bool compactPending;    // compactHeap at the next safepoint
+    GCStats gcStats;
 
     // Permission system
     PermissionSet permissions;
@@ -64,8 +90,22 @@ struct VM {
     bool hasError;
     Value currentError;     // error map: {message, type, exitCode, ...}
 
-    // Global variable inline cache
-    GlobalICSlot globalIC[GLOBAL_IC_SIZE];
+    // Map shape tree (see shape.h)
+    Shape* rootShape;
+    Shape* shapes;
+    int shapeCount;
+
+#ifdef DEBUG_IC_STATS
+    uint64_t propertyICHits;
+    uint64_t propertyICMisses;
+#endif
+
+    // --vm=register: functions the register backend can translate run as
+    // register code (see regcode.h)
+    bool registerMode;
+
+    // --jit: compile hot functions to machine code (see jit.h)
+    bool jitEnabled;
 
     // For calling closures from native functions (run() returns when
     // frameCount drops to baseFrameCount instead of 0)
@@ -98,7 +138,13 @@ void vmRaiseError(VM* vm, const char* message, const char* type);
 void defineModuleNative(VM* vm, ObjMap* module, const char* name,
                         NativeFn function, int arity);
 
+// Global variables by name (definition, imports, dynamic lookups)
+int vmGlobalSlot(VM* vm, ObjString* name);
+void vmDefineGlobal(VM* vm, ObjString* name, Value value);
+bool vmGetGlobal(VM* vm, ObjString* name, Value* value);
+
 // Used by memory.c
 void setCurrentVM(VM* vm);
+VM* getCurrentVM(void);
 
 #endif